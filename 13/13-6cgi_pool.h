@@ -0,0 +1,462 @@
+#ifndef CGI_POOL_H
+#define CGI_POOL_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+
+/* 常驻的CGI工作进程池。6-1testdup.cpp把连接socket dup到标准输出，CGI程序的输出就直接发给客户，
+    但实际的CGI服务器要为每个请求fork、exec一次。这里事先fork出若干个工作进程，每个进程用一对UNIX域socket和父进程通信：
+    父进程accept连接之后，用13-5passfd.cpp的SCM_RIGHTS把连接socket交给一个空闲的工作进程，然后关闭自己的副本；
+    工作进程处理完请求、关闭连接之后回送一个字节，表示自己又空闲了。没有空闲进程时连接排队等待。
+    工作进程退出（崩溃或者处理了max_requests个请求之后主动退出）时父进程在通信socket上读到EOF，回收它并补充一个新的。
+    回收用waitpid的WNOHANG，不会因为一个还没有退出的进程而阻塞事件循环；补充失败的位置在之后的accept或者tick中重试
+*/
+
+#define MAX_CGI_WORKERS 256     // 工作进程数上限
+#define MAX_PENDING_CONNS 1024  // 等待空闲工作进程的连接数上限，超过时直接关闭新连接
+#define WORKER_IDLE 'I'         // 工作进程处理完一个连接后回送的字节
+
+/**
+ * @brief: 工作进程中的请求处理函数
+ * @param connfd: 客户连接，处理函数返回后由工作进程关闭
+*/
+typedef void (*cgi_handler)(int connfd);
+
+/**
+ * @brief: 发送文件描述符。和13-5passfd.cpp相同，但辅助数据缓冲区按cmsghdr对齐，并检查sendmsg的结果
+ * @param fd: 传递信息的UNIX域socket
+ * @param fd_to_send: 待发送的文件描述符
+ * @return: 成功时返回true
+*/
+inline bool send_fd(int fd, int fd_to_send)
+{
+    char byte = 0;
+    struct iovec iov[1];
+    iov[0].iov_base = &byte;
+    iov[0].iov_len = 1;     // 至少要发送1个字节的普通数据，辅助数据才能随之发出
+
+    union
+    {
+        cmsghdr cm;
+        char control[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.control;
+    msg.msg_controllen = sizeof(control.control);
+
+    cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    memcpy(CMSG_DATA(cm), &fd_to_send, sizeof(int));
+
+    ssize_t ret;
+    while ((ret = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+    {
+    }
+    return ret == 1;
+}
+
+/**
+ * @brief: 接收文件描述符
+ * @param fd: 传递信息的UNIX域socket
+ * @return: 收到的文件描述符，对方关闭socket或者出错时返回-1
+*/
+inline int recv_fd(int fd)
+{
+    char byte;
+    struct iovec iov[1];
+    iov[0].iov_base = &byte;
+    iov[0].iov_len = 1;
+
+    union
+    {
+        cmsghdr cm;
+        char control[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.control;
+    msg.msg_controllen = sizeof(control.control);
+
+    ssize_t ret;
+    while ((ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+    {
+    }
+    if (ret <= 0)
+    {
+        return -1;
+    }
+    cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len != CMSG_LEN(sizeof(int)))
+    {
+        return -1;
+    }
+    int fd_to_read;
+    memcpy(&fd_to_read, CMSG_DATA(cm), sizeof(int));
+    return fd_to_read;
+}
+
+/* 父进程眼中的一个工作进程 */
+struct cgi_worker
+{
+    pid_t pid;          // -1表示这个位置没有进程
+    int channel;        // 与工作进程通信的UNIX域socket
+    bool busy;          // 正在处理连接
+    long long served;   // 交给它的连接数
+};
+
+class cgi_pool
+{
+public:
+    cgi_pool() : handler(NULL), max_requests(0), epollfd(-1), worker_count(0), dead(0), dispatched(0), respawned(0), dropped(0) {}
+    ~cgi_pool() { shutdown(); }
+
+    /**
+     * @brief: 创建工作进程。通信socket以worker的地址为事件数据注册到epollfd，父进程在事件循环中把它们交给handle_event
+     * @param workers: 工作进程数
+     * @param cgi: 请求处理函数
+     * @param max_requests_per_worker: 每个工作进程处理多少个连接之后退出、由父进程重新创建，0表示不限制
+     * @param epoll_fd: 父进程的epoll内核事件表
+     * @return: 有工作进程创建失败时返回false
+    */
+    bool init(int workers, cgi_handler cgi, int max_requests_per_worker, int epoll_fd)
+    {
+        if (workers <= 0 || workers > MAX_CGI_WORKERS)
+        {
+            return false;
+        }
+        handler = cgi;
+        max_requests = max_requests_per_worker;
+        epollfd = epoll_fd;
+        worker_count = workers;
+        for (int i = 0; i < workers; i++)
+        {
+            pool[i].pid = -1;
+            pool[i].channel = -1;
+        }
+        for (int i = 0; i < workers; i++)
+        {
+            if (!spawn(i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* 事件数据ptr是否属于这个进程池 */
+    bool owns(const void* ptr) const
+    {
+        return ptr >= (const void*)pool && ptr < (const void*)(pool + worker_count);
+    }
+
+    /**
+     * @brief: 把连接交给一个空闲的工作进程，没有空闲进程时排队。无论哪种情况父进程都不再使用connfd
+     * @param connfd: 客户连接
+    */
+    void dispatch(int connfd)
+    {
+        if (dead > 0)
+        {
+            respawn();
+        }
+        while (!idle.empty())
+        {
+            int i = idle.back();
+            idle.pop_back();
+            if (pass(i, connfd))
+            {
+                return;
+            }
+        }
+        if ((int)pending.size() >= MAX_PENDING_CONNS)
+        {
+            dropped++;
+            close(connfd);
+            return;
+        }
+        pending.push_back(connfd);
+    }
+
+    /**
+     * @brief: 处理工作进程通信socket上的事件：读到空闲通知时把排队的连接交给它，读到EOF时回收并重新创建进程
+     * @param ptr: 事件数据，即工作进程
+    */
+    void handle_event(void* ptr)
+    {
+        int i = (cgi_worker*)ptr - pool;
+        char buf[64];
+        while (1)
+        {
+            ssize_t n = recv(pool[i].channel, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                break;  // EAGAIN
+            }
+            if (n == 0)
+            {
+                reap(i);
+                if (spawn(i))
+                {
+                    respawned++;
+                }
+                else
+                {
+                    dead++;     // 位置空着，之后重试
+                }
+                collect();
+                break;
+            }
+            /* 每个空闲通知对应一个处理完的连接 */
+            pool[i].busy = false;
+            make_idle(i);
+        }
+    }
+
+    /* 定期调用（例如每次epoll_wait超时之后）：回收已经退出的工作进程，重新创建之前创建失败的 */
+    void tick()
+    {
+        collect();
+        if (dead > 0)
+        {
+            respawn();
+        }
+    }
+
+    /* 已经交给工作进程的连接数 */
+    long long dispatched_count() const { return dispatched; }
+
+    /* 重新创建的工作进程数 */
+    long long respawned_count() const { return respawned; }
+
+    /* 没有工作进程的位置数，重新创建失败的进程在重试成功之前不处理连接 */
+    int dead_count() const { return dead; }
+
+    /* 因为排队太长而关闭的连接数 */
+    long long dropped_count() const { return dropped; }
+
+    /* 等待空闲工作进程的连接数 */
+    int pending_count() const { return pending.size(); }
+
+    /* 关闭所有通信socket，工作进程读到EOF后退出，然后回收它们 */
+    void shutdown()
+    {
+        for (int i = 0; i < worker_count; i++)
+        {
+            reap(i);
+        }
+        for (size_t k = 0; k < exited.size(); k++)  // 这里不在事件循环中，可以等它们退出
+        {
+            while (waitpid(exited[k], NULL, 0) < 0 && errno == EINTR)
+            {
+            }
+        }
+        exited.clear();
+        while (!pending.empty())
+        {
+            close(pending.front());
+            pending.pop_front();
+        }
+        idle.clear();
+        worker_count = 0;
+        dead = 0;
+    }
+
+private:
+    /**
+     * @brief: 在第i个位置创建一个工作进程
+     * @param i: 位置
+     * @return: 失败时返回false
+    */
+    bool spawn(int i)
+    {
+        int fds[2];
+        if (socketpair(PF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        {
+            return false;
+        }
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+        if (pid == 0)
+        {
+            /* 子进程不需要父进程的监听socket、排队的连接和其他工作进程的通信socket，只保留标准输入输出和自己的通信socket */
+            if (fds[1] != 3)
+            {
+                dup2(fds[1], 3);
+            }
+            close_range(4, ~0U, 0);
+            worker_main(3);
+        }
+        close(fds[1]);
+        pool[i].pid = pid;
+        pool[i].channel = fds[0];
+        pool[i].busy = false;
+        pool[i].served = 0;
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        epoll_event event;
+        event.data.ptr = &pool[i];
+        event.events = EPOLLIN | EPOLLRDHUP;    // LT模式，一次没有读完的通知下一轮继续读
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fds[0], &event);
+        make_idle(i);
+        return true;
+    }
+
+    /* 关闭第i个工作进程的通信socket，腾出位置。进程可能还没有退出，记下它的pid，由collect回收 */
+    void reap(int i)
+    {
+        if (pool[i].pid < 0)
+        {
+            return;
+        }
+        close(pool[i].channel);     // 关闭时epoll自动删除它
+        exited.push_back(pool[i].pid);
+        pool[i].pid = -1;
+        pool[i].channel = -1;
+        for (size_t k = 0; k < idle.size(); k++)
+        {
+            if (idle[k] == i)
+            {
+                idle.erase(idle.begin() + k);
+                break;
+            }
+        }
+    }
+
+    /* 不阻塞地回收所有已经退出的工作进程。只等待自己的工作进程，不会回收嵌入它的程序的其他子进程 */
+    void collect()
+    {
+        for (size_t k = 0; k < exited.size(); )
+        {
+            int status;
+            pid_t pid = waitpid(exited[k], &status, WNOHANG);
+            if (pid < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (pid == 0)   // 还在运行，下次再回收
+            {
+                k++;
+                continue;
+            }
+            exited.erase(exited.begin() + k);   // 已经回收；ECHILD表示它已经被别处回收了
+        }
+    }
+
+    /* 重新创建空着的位置上的工作进程，失败的留到下次 */
+    void respawn()
+    {
+        for (int i = 0; i < worker_count && dead > 0; i++)
+        {
+            if (pool[i].pid < 0 && spawn(i))
+            {
+                dead--;
+                respawned++;
+            }
+        }
+    }
+
+    /**
+     * @brief: 把连接交给第i个工作进程
+     * @param i: 位置
+     * @param connfd: 客户连接
+     * @return: 工作进程已经退出时返回false，它会在handle_event中被重新创建
+    */
+    bool pass(int i, int connfd)
+    {
+        if (pool[i].pid < 0 || !send_fd(pool[i].channel, connfd))
+        {
+            return false;
+        }
+        close(connfd);  // 工作进程持有它自己的副本
+        pool[i].busy = true;
+        pool[i].served++;
+        dispatched++;
+        return true;
+    }
+
+    /* 第i个工作进程空闲了：有排队的连接就交给它，否则放入空闲栈 */
+    void make_idle(int i)
+    {
+        if (pending.empty())
+        {
+            idle.push_back(i);
+            return;
+        }
+        int connfd = pending.front();
+        pending.pop_front();
+        if (!pass(i, connfd))   // 进程已经退出，连接继续排队，等它被重新创建
+        {
+            pending.push_front(connfd);
+        }
+    }
+
+    /**
+     * @brief: 工作进程的主循环：接收连接，调用处理函数，关闭连接，回送空闲通知
+     * @param channel: 与父进程通信的socket
+    */
+    void worker_main(int channel)
+    {
+        long long count = 0;
+        while (max_requests == 0 || count < max_requests)
+        {
+            int connfd = recv_fd(channel);
+            if (connfd < 0)     // 父进程关闭了通信socket
+            {
+                break;
+            }
+            handler(connfd);
+            close(connfd);
+            count++;
+            char byte = WORKER_IDLE;
+            if (max_requests == 0 || count < max_requests)    // 最后一个连接之后直接退出，父进程读到EOF
+            {
+                send(channel, &byte, 1, MSG_NOSIGNAL);
+            }
+        }
+        _exit(0);
+    }
+
+private:
+    cgi_handler handler;
+    int max_requests;               // 每个工作进程处理的连接数上限
+    int epollfd;
+    cgi_worker pool[MAX_CGI_WORKERS];
+    int worker_count;
+    int dead;                       // 没有工作进程的位置数
+    std::vector<int> idle;          // 空闲工作进程的位置，后进先出，最近用过的进程缓存更热
+    std::deque<int> pending;        // 等待空闲工作进程的连接
+    std::vector<pid_t> exited;      // 已经关闭通信socket、还没有回收的工作进程
+    long long dispatched;
+    long long respawned;
+    long long dropped;
+};
+
+#endif  // CGI_POOL_H
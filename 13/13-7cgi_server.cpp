@@ -0,0 +1,176 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include "13-6cgi_pool.h"
+
+#define MAX_EVENT_NUMBER 1024
+#define TICK_MS 1000    // 进程池回收退出的工作进程、重试创建失败的工作进程的间隔（毫秒）
+
+/* CGI程序：从标准输入读请求行，向标准输出写应答。和6-1testdup.cpp一样，它不知道标准输入输出其实是客户连接 */
+static void cgi_main()
+{
+    char line[1024];
+    int len = 0;
+    while (len < (int)sizeof(line) - 1)    // 不用stdio读，工作进程中stdin的缓冲区会把上一个连接的数据留给下一个
+    {
+        ssize_t n = read(STDIN_FILENO, line + len, sizeof(line) - 1 - len);
+        if (n <= 0)
+        {
+            break;
+        }
+        len += n;
+        if (memchr(line, '\n', len))
+        {
+            break;
+        }
+    }
+    line[len] = '\0';
+    char* end = strpbrk(line, "\r\n");
+    if (end)
+    {
+        *end = '\0';
+    }
+    printf("HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n");
+    printf("pid %d served: %s\n", getpid(), line);
+    fflush(stdout);
+}
+
+/* 工作进程中的处理函数：把连接dup到标准输入输出，运行CGI程序，再恢复标准输入输出，否则连接关不掉 */
+static void pool_handler(int connfd)
+{
+    int saved_in = dup(STDIN_FILENO);
+    int saved_out = dup(STDOUT_FILENO);
+    dup2(connfd, STDIN_FILENO);
+    dup2(connfd, STDOUT_FILENO);
+    cgi_main();
+    dup2(saved_in, STDIN_FILENO);
+    dup2(saved_out, STDOUT_FILENO);
+    close(saved_in);
+    close(saved_out);
+}
+
+/* 传统的CGI：每个连接fork一个子进程，把连接dup到标准输入输出之后exec CGI程序（这里是本程序加--cgi参数） */
+static void fork_cgi(int listenfd, int connfd)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(listenfd);
+        dup2(connfd, STDIN_FILENO);
+        dup2(connfd, STDOUT_FILENO);
+        close(connfd);
+        execl("/proc/self/exe", "cgi", "--cgi", (char*)NULL);
+        _exit(1);
+    }
+    close(connfd);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 2 && strcmp(argv[1], "--cgi") == 0)     // 被fork模式exec
+    {
+        cgi_main();
+        return 0;
+    }
+    if (argc <= 2)
+    {
+        printf("usage: %s ip_address port_number [pool|fork] [workers] [max_requests]\n", basename(argv[0]));
+        return 1;
+    }
+
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+    bool use_pool = !(argc > 3 && strcmp(argv[3], "fork") == 0);
+    int workers = (argc > 4) ? atoi(argv[4]) : 8;
+    int max_requests = (argc > 5) ? atoi(argv[5]) : 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    if (!use_pool)
+    {
+        signal(SIGCHLD, SIG_IGN);   // 由内核回收fork模式的子进程；进程池的工作进程用waitpid回收，不受影响之前先设置
+    }
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    address.sin_port = htons(port);
+
+    int listenfd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    assert(listenfd >= 0);
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    int ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
+    assert(ret != -1);
+    ret = listen(listenfd, SOMAXCONN);
+    assert(ret != -1);
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+
+    int epollfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(epollfd != -1);
+    epoll_event event;
+    event.data.ptr = NULL;
+    event.events = EPOLLIN;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &event);
+
+    cgi_pool pool;
+    if (use_pool && !pool.init(workers, pool_handler, max_requests, epollfd))
+    {
+        printf("cannot start %d workers\n", workers);
+        return 1;
+    }
+    printf("serving %s:%d with %s\n", ip, port, use_pool ? "a worker pool" : "fork/exec per request");
+    fflush(stdout);
+
+    epoll_event events[MAX_EVENT_NUMBER];
+    while (1)
+    {
+        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, use_pool ? TICK_MS : -1);
+        if (number < 0 && errno != EINTR)
+        {
+            printf("epoll failure\n");
+            break;
+        }
+        if (use_pool)
+        {
+            pool.tick();
+        }
+        for (int i = 0; i < number; i++)
+        {
+            void* ptr = events[i].data.ptr;
+            if (ptr)    // 工作进程空闲了或者退出了
+            {
+                pool.handle_event(ptr);
+                continue;
+            }
+            while (1)
+            {
+                int connfd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+                if (connfd < 0)
+                {
+                    break;
+                }
+                if (use_pool)
+                {
+                    pool.dispatch(connfd);
+                }
+                else
+                {
+                    fork_cgi(listenfd, connfd);
+                }
+            }
+        }
+    }
+
+    close(epollfd);
+    close(listenfd);
+    return 0;
+}
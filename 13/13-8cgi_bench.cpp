@@ -0,0 +1,131 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+/* 13-7cgi_server.cpp的压测客户端：若干个线程各自循环“连接、发送请求行、读到EOF”，
+    报告每秒处理的请求数和延迟分布，用来比较进程池和每个请求fork/exec一次的CGI
+    编译：g++ -O2 -pthread 13-8cgi_bench.cpp；用法：cgi_bench ip port [请求数] [并发数]
+*/
+
+static const char* REQUEST = "GET /cgi HTTP/1.0\r\n\r\n";
+
+static sockaddr_in server_addr;
+static int requests_per_thread;
+
+struct bench_result
+{
+    std::vector<double> latency;    // 每个请求的延迟，秒
+    int failed;
+};
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 完成一个请求，收到非空的应答时返回true */
+static bool one_request()
+{
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0
+        || send(fd, REQUEST, strlen(REQUEST), MSG_NOSIGNAL) < 0)
+    {
+        close(fd);
+        return false;
+    }
+    char buf[4096];
+    int total = 0;
+    bool ok = false;
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+    {
+        if (total == 0)     // 状态行很短，总在第一次recv中
+        {
+            ok = (n >= 12 && strncmp(buf, "HTTP/1.0 200", 12) == 0);
+        }
+        total += n;
+    }
+    close(fd);
+    return n == 0 && ok;
+}
+
+static void* client(void* arg)
+{
+    bench_result* result = (bench_result*)arg;
+    result->failed = 0;
+    result->latency.reserve(requests_per_thread);
+    for (int i = 0; i < requests_per_thread; i++)
+    {
+        double start = now();
+        if (one_request())
+        {
+            result->latency.push_back(now() - start);
+        }
+        else
+        {
+            result->failed++;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 2)
+    {
+        printf("usage: %s ip_address port_number [requests] [concurrency]\n", basename(argv[0]));
+        return 1;
+    }
+    bzero(&server_addr, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[1], &server_addr.sin_addr);
+    server_addr.sin_port = htons(atoi(argv[2]));
+    int requests = (argc > 3) ? atoi(argv[3]) : 10000;
+    int concurrency = (argc > 4) ? atoi(argv[4]) : 8;
+    assert(concurrency > 0);
+    requests_per_thread = requests / concurrency;
+
+    std::vector<pthread_t> tids(concurrency);
+    std::vector<bench_result> results(concurrency);
+    double start = now();
+    for (int i = 0; i < concurrency; i++)
+    {
+        pthread_create(&tids[i], NULL, client, &results[i]);
+    }
+    std::vector<double> latency;
+    int failed = 0;
+    for (int i = 0; i < concurrency; i++)
+    {
+        pthread_join(tids[i], NULL);
+        latency.insert(latency.end(), results[i].latency.begin(), results[i].latency.end());
+        failed += results[i].failed;
+    }
+    double elapsed = now() - start;
+
+    if (latency.empty())
+    {
+        printf("all %d requests failed\n", failed);
+        return 1;
+    }
+    std::sort(latency.begin(), latency.end());
+    printf("%d requests, concurrency %d: %.0f req/s, p50 %.3f ms, p99 %.3f ms, max %.3f ms, failed %d\n",
+           (int)latency.size() + failed, concurrency, latency.size() / elapsed,
+           latency[latency.size() / 2] * 1e3, latency[latency.size() * 99 / 100] * 1e3,
+           latency.back() * 1e3, failed);
+    return 0;
+}
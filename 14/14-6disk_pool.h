@@ -0,0 +1,347 @@
+#ifndef DISK_POOL_H
+#define DISK_POOL_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <exception>
+#include <list>
+#include <string>
+#include <vector>
+#include "14-2locker.h"
+
+/* 磁盘I/O线程池。6-2testwritev.cpp直接在服务线程中read整个文件，页缓存没有命中时整个事件循环都要等磁盘。
+    这里把open、stat、pread交给若干个I/O线程执行，请求在有上限的队列中排队；完成的请求放进完成队列，
+    再写eventfd通知事件循环，事件循环把eventfd注册到epoll，可读时调用reap取回完成的请求。
+    队列深度、排队时间和执行时间的统计可以看出存储是不是瓶颈：排队时间远大于执行时间、队列经常接近上限，
+    说明磁盘跟不上；两者都很小时瓶颈在别处。线程数为0时在submit中同步执行，用来和线程池对比。
+    pread先在调用者线程中用preadv2的RWF_NOWAIT试一次，数据在页缓存中时立即完成，不必经过线程切换，
+    只有需要等磁盘时才排队
+*/
+
+#define DISK_THREADS 4          // 默认的I/O线程数
+#define MAX_DISK_REQUESTS 1024  // 默认的排队请求数上限
+
+/* 磁盘操作 */
+enum DISK_OP {
+    DISK_OPEN = 0,  // open(path, flags)，result为文件描述符
+    DISK_STAT,      // stat(path)，结果在st中
+    DISK_PREAD      // pread(fd, buf, len, offset)，result为读到的字节数
+};
+
+/* 一个磁盘请求。调用者分配并填写输入部分，在reap取回之前不能释放它 */
+struct disk_request
+{
+    DISK_OP op;
+    std::string path;       // DISK_OPEN、DISK_STAT
+    int flags;              // DISK_OPEN
+    int fd;                 // DISK_PREAD
+    char* buf;
+    size_t len;
+    off_t offset;
+    void* user;             // 调用者的上下文，例如连接
+
+    ssize_t result;         // 系统调用的返回值，失败时为-1
+    int err;                // 失败时的errno，被取消时为ECANCELED
+    struct stat st;         // DISK_STAT的结果
+
+    double submit_time;     // 提交、开始执行和完成的时刻，秒
+    double start_time;
+    double finish_time;
+};
+
+/* 线程池的统计 */
+struct disk_stats
+{
+    int queued;             // 正在排队的请求数
+    int running;            // 正在执行的请求数
+    int peak_queued;        // 排队请求数的峰值
+    long long submitted;
+    long long completed;
+    long long rejected;     // 队列已满而被拒绝的请求数
+    long long cached;       // 在页缓存中命中、没有排队的pread数
+    double wait_time;       // 已完成请求的排队时间之和，秒
+    double service_time;    // 已完成请求的执行时间之和，秒
+};
+
+class disk_pool
+{
+public:
+    /**
+     * @brief: 创建eventfd和I/O线程，失败时抛出异常
+     * @param thread_number: I/O线程数，0表示在submit中同步执行
+     * @param max_requests: 排队请求数上限
+    */
+    disk_pool(int thread_number = DISK_THREADS, int max_requests = MAX_DISK_REQUESTS)
+        : m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL), m_stop(false)
+    {
+        if (thread_number < 0 || max_requests <= 0)
+        {
+            throw std::exception();
+        }
+        m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_eventfd < 0)
+        {
+            throw std::exception();
+        }
+        memset(&m_stats, 0, sizeof(m_stats));
+        m_threads = new pthread_t[thread_number > 0 ? thread_number : 1];
+        for (int i = 0; i < thread_number; i++)
+        {
+            if (pthread_create(m_threads + i, NULL, worker, this) != 0)
+            {
+                m_thread_number = i;    // 只回收已经创建的线程
+                stop();
+                close(m_eventfd);
+                delete[] m_threads;
+                throw std::exception();
+            }
+        }
+    }
+
+    ~disk_pool()
+    {
+        stop();
+        close(m_eventfd);
+        delete[] m_threads;
+    }
+
+    /* 完成通知的eventfd，以EPOLLIN注册到事件循环 */
+    int event_fd() const { return m_eventfd; }
+
+    /**
+     * @brief: 提交一个请求
+     * @param request: 请求，完成之后从reap取回
+     * @return: 队列已满或者线程池已经停止时返回false，请求没有被接受
+    */
+    bool submit(disk_request* request)
+    {
+        request->result = -1;
+        request->err = 0;
+        request->submit_time = now();
+        if (m_thread_number == 0)   // 同步执行，和线程池一样通过完成队列交给调用者
+        {
+            m_queuelocker.lock();
+            m_stats.submitted++;
+            m_queuelocker.unlock();
+            execute(request);
+            complete(request);
+            return true;
+        }
+        if (request->op == DISK_PREAD && read_cached(request))
+        {
+            m_queuelocker.lock();
+            m_stats.submitted++;
+            m_stats.cached++;
+            m_queuelocker.unlock();
+            complete(request);
+            return true;
+        }
+        m_queuelocker.lock();
+        if (m_stop || (int)m_workqueue.size() >= m_max_requests)
+        {
+            m_stats.rejected++;
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(request);
+        m_stats.submitted++;
+        if ((int)m_workqueue.size() > m_stats.peak_queued)
+        {
+            m_stats.peak_queued = m_workqueue.size();
+        }
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+
+    /**
+     * @brief: 取回所有已经完成的请求，并清除eventfd的计数。eventfd可读时调用
+     * @param done: 追加完成的请求，按完成的顺序
+     * @return: 取回的请求数
+    */
+    int reap(std::vector<disk_request*>& done)
+    {
+        uint64_t count;
+        while (read(m_eventfd, &count, sizeof(count)) < 0 && errno == EINTR)
+        {
+        }
+        m_donelocker.lock();
+        int n = m_donequeue.size();
+        done.insert(done.end(), m_donequeue.begin(), m_donequeue.end());
+        m_donequeue.clear();
+        m_donelocker.unlock();
+        return n;
+    }
+
+    /* 当前的统计 */
+    disk_stats stats()
+    {
+        m_queuelocker.lock();
+        disk_stats s = m_stats;
+        s.queued = m_workqueue.size();
+        m_queuelocker.unlock();
+        return s;
+    }
+
+    /* 停止I/O线程：正在执行的请求执行完，还在排队的请求以ECANCELED完成，之后submit总是失败 */
+    void stop()
+    {
+        m_queuelocker.lock();
+        bool stopped = m_stop;
+        m_stop = true;
+        m_queuelocker.unlock();
+        if (stopped)
+        {
+            return;
+        }
+        for (int i = 0; i < m_thread_number; i++)
+        {
+            m_queuestat.post();
+        }
+        for (int i = 0; i < m_thread_number; i++)
+        {
+            pthread_join(m_threads[i], NULL);
+        }
+        m_queuelocker.lock();
+        std::list<disk_request*> cancelled;
+        cancelled.swap(m_workqueue);
+        m_queuelocker.unlock();
+        for (std::list<disk_request*>::iterator it = cancelled.begin(); it != cancelled.end(); ++it)
+        {
+            (*it)->err = ECANCELED;
+            (*it)->start_time = now();
+            complete(*it);
+        }
+    }
+
+private:
+    static double now()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    /* 工作线程运行的函数，它不断从工作队列中取出请求并执行 */
+    static void* worker(void* arg)
+    {
+        disk_pool* pool = (disk_pool*)arg;
+        pool->run();
+        return NULL;
+    }
+
+    void run()
+    {
+        while (1)
+        {
+            m_queuestat.wait();
+            m_queuelocker.lock();
+            if (m_stop)
+            {
+                m_queuelocker.unlock();
+                break;
+            }
+            if (m_workqueue.empty())
+            {
+                m_queuelocker.unlock();
+                continue;
+            }
+            disk_request* request = m_workqueue.front();
+            m_workqueue.pop_front();
+            m_stats.running++;
+            m_queuelocker.unlock();
+            execute(request);
+            m_queuelocker.lock();
+            m_stats.running--;
+            m_queuelocker.unlock();
+            complete(request);
+        }
+    }
+
+    /**
+     * @brief: 不等待磁盘地读页缓存中的数据
+     * @param request: DISK_PREAD请求
+     * @return: 读到了数据（可能比请求的少）或者到了文件末尾时返回true，请求已经完成；需要等磁盘或者内核不支持时返回false
+    */
+    bool read_cached(disk_request* request)
+    {
+        request->start_time = request->submit_time;
+        struct iovec iv;
+        iv.iov_base = request->buf;
+        iv.iov_len = request->len;
+        ssize_t n = preadv2(request->fd, &iv, 1, request->offset, RWF_NOWAIT);
+        if (n < 0)
+        {
+            return false;   // EAGAIN，或者较老的内核、文件系统不支持RWF_NOWAIT（EOPNOTSUPP），都交给I/O线程
+        }
+        request->result = n;
+        request->err = 0;
+        return true;
+    }
+
+    /* 执行请求，调用者线程或者I/O线程中调用 */
+    void execute(disk_request* request)
+    {
+        request->start_time = now();
+        do
+        {
+            switch (request->op)
+            {
+            case DISK_OPEN:
+                request->result = open(request->path.c_str(), request->flags | O_CLOEXEC);
+                break;
+            case DISK_STAT:
+                request->result = stat(request->path.c_str(), &request->st);
+                break;
+            case DISK_PREAD:
+                request->result = pread(request->fd, request->buf, request->len, request->offset);
+                break;
+            default:
+                request->result = -1;
+                errno = EINVAL;
+                break;
+            }
+        } while (request->result < 0 && errno == EINTR);
+        request->err = (request->result < 0) ? errno : 0;
+    }
+
+    /* 把请求放进完成队列，累计统计，通知事件循环 */
+    void complete(disk_request* request)
+    {
+        request->finish_time = now();
+        m_queuelocker.lock();
+        m_stats.completed++;
+        m_stats.wait_time += request->start_time - request->submit_time;
+        m_stats.service_time += request->finish_time - request->start_time;
+        m_queuelocker.unlock();
+        m_donelocker.lock();
+        m_donequeue.push_back(request);
+        m_donelocker.unlock();
+        uint64_t one = 1;
+        ssize_t ret = write(m_eventfd, &one, sizeof(one));
+        (void)ret;  // 只在计数将要溢出时失败，那时eventfd一定可读
+    }
+
+private:
+    int m_thread_number;                    // 线程池中的线程数
+    int m_max_requests;                     // 请求队列中允许的最大请求数
+    pthread_t* m_threads;                   // 描述线程池的数组
+    std::list<disk_request*> m_workqueue;   // 请求队列
+    locker m_queuelocker;                   // 保护请求队列和统计的互斥锁
+    sem m_queuestat;                        // 是否有任务需要处理
+    std::vector<disk_request*> m_donequeue; // 完成队列
+    locker m_donelocker;                    // 保护完成队列的互斥锁
+    int m_eventfd;                          // 完成通知
+    bool m_stop;                            // 是否结束线程
+    disk_stats m_stats;
+};
+
+#endif  // DISK_POOL_H
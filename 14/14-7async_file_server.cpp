@@ -0,0 +1,530 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include "14-6disk_pool.h"
+
+/* 6-2testwritev.cpp的文件服务器，改为epoll事件循环同时服务多个连接，stat、open和pread交给磁盘I/O线程池。
+    每个连接同时只有一个磁盘请求：stat -> open -> pread一块 -> 用writev发出（第一块和头部一起） -> pread下一块……
+    发完之后关闭连接。一个100ms的timerfd测量事件循环的延迟：定时器到期之后过了多久才被处理，
+    每秒输出一次延迟的最大值和线程池的统计。线程数为0时磁盘操作在事件循环中同步执行，可以对比两种方式的延迟
+    用法：async_file_server ip port 文档根目录 [I/O线程数] [队列上限]
+*/
+
+#define MAX_EVENT_NUMBER 1024
+#define REQUEST_SIZE 1024
+#define CHUNK_SIZE (256 * 1024)     // 每次pread的字节数
+#define TICK_MS 100                 // 测量延迟的定时器周期
+
+/* 连接的状态 */
+enum CONN_STATE {
+    CONN_REQUEST = 0,   // 读请求
+    CONN_DISK,          // 等待磁盘请求完成
+    CONN_SEND           // 等待socket可写
+};
+
+struct file_conn
+{
+    int sockfd;
+    CONN_STATE state;
+    bool closed;                // 磁盘请求还没有完成时客户关闭了连接，等请求完成之后再释放
+    bool dead;                  // 已经释放，等本轮事件处理完再delete
+    char request[REQUEST_SIZE];
+    int request_len;
+    int filefd;
+    off_t size;
+    off_t offset;               // 已经读出的位置
+    char header[256];
+    int header_len;
+    int header_sent;
+    char* buf;
+    int buf_len;
+    int buf_sent;
+    disk_request disk;
+};
+
+static const char* doc_root;
+static disk_pool* pool;
+static int epollfd;
+static int conn_count;
+static std::vector<file_conn*> dead_conns;    // 同一批事件中后面可能还有它的事件，处理完这一批再delete
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 修改连接上注册的事件，等待磁盘时不关心socket上的数据 */
+static void watch(file_conn* c, unsigned int events)
+{
+    epoll_event event;
+    event.data.ptr = c;
+    event.events = events;
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, c->sockfd, &event);
+}
+
+static void free_conn(file_conn* c)
+{
+    if (c->filefd >= 0)
+    {
+        close(c->filefd);
+    }
+    c->filefd = -1;
+    c->dead = true;
+    dead_conns.push_back(c);
+    conn_count--;
+}
+
+/* 关闭连接。磁盘请求还在I/O线程中时只关闭socket，请求完成时再释放连接 */
+static void close_conn(file_conn* c)
+{
+    if (c->sockfd >= 0)
+    {
+        close(c->sockfd);   // 关闭时epoll自动删除它
+        c->sockfd = -1;
+    }
+    if (c->state == CONN_DISK)
+    {
+        c->closed = true;
+        return;
+    }
+    free_conn(c);
+}
+
+/* 提交连接的磁盘请求，队列已满时应答503 */
+static void submit(file_conn* c);
+
+/* 准备应答头部 */
+static void set_header(file_conn* c, const char* status, off_t length)
+{
+    c->header_len = snprintf(c->header, sizeof(c->header), "HTTP/1.1 %s\r\nContent-Length: %lld\r\n\r\n",
+                             status, (long long)length);
+    c->header_sent = 0;
+}
+
+/**
+ * @brief: 把头部剩下的部分和缓冲区中的数据一并写出，写完之后读下一块或者关闭连接
+ * @param c: 连接
+*/
+static void send_response(file_conn* c)
+{
+    while (c->header_sent < c->header_len || c->buf_sent < c->buf_len)
+    {
+        struct iovec iv[2];
+        int count = 0;
+        if (c->header_sent < c->header_len)
+        {
+            iv[count].iov_base = c->header + c->header_sent;
+            iv[count].iov_len = c->header_len - c->header_sent;
+            count++;
+        }
+        if (c->buf_sent < c->buf_len)
+        {
+            iv[count].iov_base = c->buf + c->buf_sent;
+            iv[count].iov_len = c->buf_len - c->buf_sent;
+            count++;
+        }
+        ssize_t n = writev(c->sockfd, iv, count);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                c->state = CONN_SEND;
+                watch(c, EPOLLOUT);
+                return;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            close_conn(c);
+            return;
+        }
+        int head = c->header_len - c->header_sent;
+        if (n <= head)
+        {
+            c->header_sent += n;
+            continue;
+        }
+        c->header_sent = c->header_len;
+        c->buf_sent += n - head;
+    }
+    if (c->filefd >= 0 && c->offset < c->size)  // 读下一块
+    {
+        c->disk.op = DISK_PREAD;
+        c->disk.fd = c->filefd;
+        c->disk.buf = c->buf;
+        c->disk.len = (c->size - c->offset < CHUNK_SIZE) ? c->size - c->offset : CHUNK_SIZE;
+        c->disk.offset = c->offset;
+        submit(c);
+        return;
+    }
+    close_conn(c);
+}
+
+/* 直接应答一个错误 */
+static void send_error(file_conn* c, const char* status)
+{
+    set_header(c, status, 0);
+    c->buf_len = c->buf_sent = 0;
+    if (c->filefd >= 0)
+    {
+        close(c->filefd);
+        c->filefd = -1;
+    }
+    send_response(c);
+}
+
+static void submit(file_conn* c)
+{
+    c->state = CONN_DISK;
+    watch(c, 0);    // 等待磁盘期间只关心错误和挂起，epoll总是报告它们
+    if (!pool->submit(&c->disk))
+    {
+        c->state = CONN_SEND;
+        if (c->header_sent > 0)     // 已经发出了一部分文件，只能关闭连接
+        {
+            close_conn(c);
+            return;
+        }
+        send_error(c, "503 Service Unavailable");
+    }
+}
+
+/* 请求已经完整：解析请求行，提交stat */
+static void start_request(file_conn* c)
+{
+    char* method = c->request;
+    char* url = strpbrk(method, " \t");
+    if (!url)
+    {
+        send_error(c, "400 Bad Request");
+        return;
+    }
+    *url++ = '\0';
+    url += strspn(url, " \t");
+    char* end = strpbrk(url, " \t\r\n");
+    if (end)
+    {
+        *end = '\0';
+    }
+    if (strcasecmp(method, "GET") != 0)
+    {
+        send_error(c, "501 Not Implemented");
+        return;
+    }
+    if (url[0] != '/' || strstr(url, "/.."))
+    {
+        send_error(c, "404 Not Found");
+        return;
+    }
+    c->disk.op = DISK_STAT;
+    c->disk.path = std::string(doc_root) + url;
+    submit(c);
+}
+
+/* 连接上可读：读请求直到空行 */
+static void read_request(file_conn* c)
+{
+    while (1)
+    {
+        ssize_t n = recv(c->sockfd, c->request + c->request_len, REQUEST_SIZE - 1 - c->request_len, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        if (n <= 0)
+        {
+            close_conn(c);
+            return;
+        }
+        c->request_len += n;
+        c->request[c->request_len] = '\0';
+        if (strstr(c->request, "\r\n\r\n") || strstr(c->request, "\n\n"))
+        {
+            start_request(c);
+            return;
+        }
+        if (c->request_len == REQUEST_SIZE - 1)
+        {
+            send_error(c, "400 Bad Request");
+            return;
+        }
+    }
+}
+
+/* 一个磁盘请求完成了，推进它所属的连接 */
+static void disk_done(disk_request* request)
+{
+    file_conn* c = (file_conn*)request->user;
+    if (c->closed)
+    {
+        if (request->op == DISK_OPEN && request->result >= 0)
+        {
+            close(request->result);
+        }
+        c->state = CONN_SEND;
+        free_conn(c);
+        return;
+    }
+    c->state = CONN_SEND;
+    switch (request->op)
+    {
+    case DISK_STAT:
+        if (request->result < 0)
+        {
+            send_error(c, (request->err == ENOENT || request->err == ENOTDIR) ? "404 Not Found" : "500 Internal server error");
+        }
+        else if (S_ISDIR(request->st.st_mode) || !(request->st.st_mode & S_IROTH))
+        {
+            send_error(c, "403 Forbidden");
+        }
+        else
+        {
+            c->size = request->st.st_size;
+            c->disk.op = DISK_OPEN;
+            c->disk.flags = O_RDONLY;
+            submit(c);
+        }
+        break;
+    case DISK_OPEN:
+        if (request->result < 0)
+        {
+            send_error(c, "500 Internal server error");
+            break;
+        }
+        c->filefd = request->result;
+        set_header(c, "200 OK", c->size);
+        c->offset = 0;
+        c->buf_len = c->buf_sent = 0;
+        if (!c->buf && c->size > 0 && !(c->buf = (char*)malloc(CHUNK_SIZE)))
+        {
+            send_error(c, "500 Internal server error");
+            break;
+        }
+        send_response(c);  // 先发头部，然后提交第一个pread
+        break;
+    case DISK_PREAD:
+        if (request->result <= 0)   // 文件在发送过程中被截短或者读出错，应答已经无法完成
+        {
+            close_conn(c);
+            break;
+        }
+        c->offset += request->result;
+        c->buf_len = request->result;
+        c->buf_sent = 0;
+        send_response(c);
+        break;
+    }
+}
+
+static void accept_all(int listenfd)
+{
+    while (1)
+    {
+        int sockfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sockfd < 0)
+        {
+            return;
+        }
+        file_conn* c = new file_conn;
+        c->sockfd = sockfd;
+        c->state = CONN_REQUEST;
+        c->closed = false;
+        c->dead = false;
+        c->request_len = 0;
+        c->filefd = -1;
+        c->size = c->offset = 0;
+        c->header_len = c->header_sent = 0;
+        c->buf = NULL;
+        c->buf_len = c->buf_sent = 0;
+        c->disk.user = c;
+        conn_count++;
+        epoll_event event;
+        event.data.ptr = c;
+        event.events = EPOLLIN;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &event);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 3)
+    {
+        printf("usage: %s ip_address port_number doc_root [io_threads] [max_queue]\n", basename(argv[0]));
+        return 1;
+    }
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+    doc_root = argv[3];
+    int threads = (argc > 4) ? atoi(argv[4]) : DISK_THREADS;
+    int max_queue = (argc > 5) ? atoi(argv[5]) : MAX_DISK_REQUESTS;
+
+    signal(SIGPIPE, SIG_IGN);
+    try
+    {
+        pool = new disk_pool(threads, max_queue);
+    }
+    catch (...)
+    {
+        printf("cannot create disk pool\n");
+        return 1;
+    }
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    address.sin_port = htons(port);
+
+    int listenfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    assert(listenfd >= 0);
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    int ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
+    assert(ret != -1);
+    ret = listen(listenfd, SOMAXCONN);
+    assert(ret != -1);
+
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec tick;
+    tick.it_value.tv_sec = tick.it_interval.tv_sec = 0;
+    tick.it_value.tv_nsec = tick.it_interval.tv_nsec = TICK_MS * 1000000L;
+    timerfd_settime(timerfd, 0, &tick, NULL);
+
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(epollfd != -1);
+    /* 三个特殊的fd用事件数据中的哨兵地址区分，连接用file_conn的地址 */
+    static char listen_tag, pool_tag, timer_tag;
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &listen_tag;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &event);
+    event.data.ptr = &pool_tag;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, pool->event_fd(), &event);
+    event.data.ptr = &timer_tag;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &event);
+
+    printf("serving %s on %s:%d, %d io threads\n", doc_root, ip, port, threads);
+    fflush(stdout);
+
+    double next_tick = now() + TICK_MS / 1e3;
+    double max_lag = 0;
+    int ticks = 0;
+    disk_stats last;
+    memset(&last, 0, sizeof(last));
+    std::vector<disk_request*> done;
+    epoll_event events[MAX_EVENT_NUMBER];
+    while (1)
+    {
+        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        if (number < 0 && errno != EINTR)
+        {
+            printf("epoll failure\n");
+            break;
+        }
+        for (int i = 0; i < number; i++)
+        {
+            void* ptr = events[i].data.ptr;
+            if (ptr == &listen_tag)
+            {
+                accept_all(listenfd);
+            }
+            else if (ptr == &pool_tag)
+            {
+                done.clear();
+                pool->reap(done);
+                for (size_t k = 0; k < done.size(); k++)
+                {
+                    disk_done(done[k]);
+                }
+            }
+            else if (ptr == &timer_tag)
+            {
+                uint64_t expired = 0;
+                if (read(timerfd, &expired, sizeof(expired)) <= 0)
+                {
+                    continue;
+                }
+                /* next_tick是最早那次到期的时刻，现在才处理，差值就是事件循环的延迟 */
+                double lag = now() - next_tick;
+                if (lag > max_lag)
+                {
+                    max_lag = lag;
+                }
+                next_tick += expired * TICK_MS / 1e3;
+                ticks += expired;
+                if (ticks < 1000 / TICK_MS)
+                {
+                    continue;
+                }
+                disk_stats s = pool->stats();
+                long long finished = s.completed - last.completed;
+                if (finished > 0 || s.queued > 0 || s.rejected != last.rejected)
+                {
+                    printf("loop lag max %.1f ms | disk queue %d (peak %d) running %d | done %lld/s rejected %lld | "
+                           "avg wait %.2f ms service %.2f ms | cached reads %lld | conns %d\n",
+                           max_lag * 1e3, s.queued, s.peak_queued, s.running, finished, s.rejected - last.rejected,
+                           finished ? (s.wait_time - last.wait_time) * 1e3 / finished : 0.0,
+                           finished ? (s.service_time - last.service_time) * 1e3 / finished : 0.0,
+                           s.cached - last.cached, conn_count);
+                    fflush(stdout);
+                }
+                last = s;
+                ticks = 0;
+                max_lag = 0;
+            }
+            else
+            {
+                file_conn* c = (file_conn*)ptr;
+                if (c->dead)
+                {
+                    continue;
+                }
+                if (c->state == CONN_DISK)  // 等待磁盘时只会收到错误或者挂起
+                {
+                    close_conn(c);
+                }
+                else if (events[i].events & (EPOLLERR | EPOLLHUP))
+                {
+                    close_conn(c);
+                }
+                else if (c->state == CONN_REQUEST)
+                {
+                    read_request(c);
+                }
+                else
+                {
+                    send_response(c);
+                }
+            }
+        }
+        for (size_t k = 0; k < dead_conns.size(); k++)
+        {
+            free(dead_conns[k]->buf);
+            delete dead_conns[k];
+        }
+        dead_conns.clear();
+    }
+
+    close(timerfd);
+    close(epollfd);
+    close(listenfd);
+    delete pool;
+    return 0;
+}
@@ -0,0 +1,543 @@
+#ifndef TEE_MIRROR_H
+#define TEE_MIRROR_H
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include "6-6splice_relay.h"
+
+/* 流量镜像。6-5testtee.cpp用一次tee把标准输入复制到一个文件和标准输出，这里把客户连接上行的数据流复制给
+    一个主后端和若干个影子后端或者抓包文件，数据不进入用户空间：
+        客户 -> 暂存管道 --tee--> 每个镜像的管道 -> 影子后端socket或文件
+                        \--splice--> 主后端
+    tee总是从管道开头复制，所以暂存管道只在空的时候读入新数据，读入的数据立刻tee给所有镜像，然后才写给主后端。
+    镜像的管道放不下新数据（镜像写得太慢）时丢弃这个镜像，主路径从不等待镜像。
+    主后端的应答照常splice回客户；影子后端的应答经过一个公用的管道splice到/dev/null
+*/
+
+#define MAX_MIRRORS 8   // 每个会话最多的镜像数
+
+/* 镜像目标的类型 */
+enum MIRROR_KIND {
+    MIRROR_SOCKET = 0,  // 影子后端
+    MIRROR_FILE         // 抓包文件，每个会话一个，文件名为“路径.会话序号”
+};
+
+/* 镜像目标的配置 */
+struct mirror_target
+{
+    MIRROR_KIND kind;
+    sockaddr_in addr;       // 影子后端地址
+    const char* path;       // 抓包文件路径
+};
+
+/* 一个会话中的一路镜像 */
+struct mirror_stream
+{
+    int fd;
+    MIRROR_KIND kind;
+    bool connected;         // 影子后端的连接已经建立，文件总是true
+    bool dropped;           // 已经因为太慢或出错而丢弃
+    bool shut;              // 数据已经全部写出并且shutdown
+    splice_pipe pipe;       // tee出来、尚未写出的数据
+    long long bytes;        // 已经写出的字节数
+};
+
+/* 一个镜像会话 */
+struct mirror_session
+{
+    int client;
+    int primary;            // 主后端
+    bool connected;         // 到主后端的连接是否已经建立
+    bool closed;            // 已经关闭，等本轮事件处理完再释放
+    mirror_session* next;   // 等待释放的会话链表
+    splice_pipe stage;      // 暂存管道
+    bool client_eof;        // 客户已经关闭写
+    bool primary_shut;      // 已经对主后端shutdown(SHUT_WR)
+    long long bytes;        // 写给主后端的字节数
+    relay_channel down;     // 主后端 -> 客户
+    int mirror_count;
+    mirror_stream mirrors[MAX_MIRRORS];
+};
+
+class mirror_server
+{
+public:
+    mirror_server() : epollfd(-1), listenfd(-1), devnull(-1), pool(NULL), target_count(0), closed(NULL),
+        sessions(0), session_seq(0), drop_count(0), mirrored_bytes(0)
+    {
+        discard.fd[0] = discard.fd[1] = -1;
+    }
+    ~mirror_server()
+    {
+        if (epollfd >= 0)
+        {
+            close(epollfd);
+        }
+        if (devnull >= 0)
+        {
+            close(devnull);
+        }
+        close_pipe(discard);
+    }
+
+    /**
+     * @brief: 初始化
+     * @param listen_fd: 已经开始监听的socket
+     * @param primary_addr: 主后端地址
+     * @param mirror_targets: 镜像目标
+     * @param count: 镜像目标数，不超过MAX_MIRRORS
+     * @param pipes: 管道池
+     * @return: 失败时返回false
+    */
+    bool init(int listen_fd, const sockaddr_in& primary_addr, const mirror_target* mirror_targets, int count, pipe_pool* pipes)
+    {
+        if (count > MAX_MIRRORS)
+        {
+            return false;
+        }
+        listenfd = listen_fd;
+        primary = primary_addr;
+        for (int i = 0; i < count; i++)
+        {
+            targets[i] = mirror_targets[i];
+        }
+        target_count = count;
+        pool = pipes;
+        devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (devnull < 0 || epollfd < 0 || !open_pipe(discard))
+        {
+            return false;
+        }
+        fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+        epoll_event event;
+        event.data.ptr = NULL;
+        event.events = EPOLLIN | EPOLLET;
+        return epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &event) == 0;
+    }
+
+    /**
+     * @brief: 等待一次事件并处理
+     * @param timeout_ms: epoll_wait的超时时间
+    */
+    void run_once(int timeout_ms)
+    {
+        epoll_event events[MAX_RELAY_EVENTS];
+        int number = epoll_wait(epollfd, events, MAX_RELAY_EVENTS, timeout_ms);
+        for (int i = 0; i < number; i++)
+        {
+            mirror_session* session = (mirror_session*)events[i].data.ptr;
+            if (!session)
+            {
+                accept_all();
+            }
+            else if (!session->closed && !handle(session))
+            {
+                close_session(session);
+            }
+        }
+        while (closed)
+        {
+            mirror_session* session = closed;
+            closed = session->next;
+            delete session;
+        }
+    }
+
+    /* 当前的会话数 */
+    int size() const { return sessions; }
+
+    /* 因为太慢或出错而丢弃的镜像数 */
+    long long dropped() const { return drop_count; }
+
+    /* 已经关闭的会话写给镜像的总字节数 */
+    long long mirrored() const { return mirrored_bytes; }
+
+private:
+    /* 把会话的一个fd以ET模式注册到epoll */
+    void add_fd(int fd, mirror_session* session)
+    {
+        epoll_event event;
+        event.data.ptr = session;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    /* 发起到addr的非阻塞连接，失败时返回-1 */
+    static int connect_to(const sockaddr_in& addr)
+    {
+        int fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+        {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    /**
+     * @brief: 检查非阻塞connect的结果
+     * @param fd: socket
+     * @return: 已经连接时返回1，还在连接时返回0，失败时返回-1
+    */
+    static int check_connected(int fd)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+        {
+            return -1;
+        }
+        sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        return (getpeername(fd, (sockaddr*)&peer, &peer_len) == 0) ? 1 : 0;
+    }
+
+    /* 为一个新会话打开所有镜像。某个镜像打不开时只是没有这一路，不影响主路径 */
+    void open_mirrors(mirror_session* session)
+    {
+        session->mirror_count = 0;
+        for (int i = 0; i < target_count; i++)
+        {
+            mirror_stream& m = session->mirrors[session->mirror_count];
+            m.kind = targets[i].kind;
+            m.dropped = m.shut = false;
+            m.bytes = 0;
+            if (m.kind == MIRROR_SOCKET)
+            {
+                m.fd = connect_to(targets[i].addr);
+                m.connected = false;
+            }
+            else
+            {
+                char path[256];
+                snprintf(path, sizeof(path), "%s.%lld", targets[i].path, session_seq);
+                m.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);    // splice不能写O_APPEND的文件
+                m.connected = true;
+            }
+            if (m.fd < 0)
+            {
+                continue;
+            }
+            if (!pool->acquire(m.pipe))
+            {
+                close(m.fd);
+                continue;
+            }
+            if (m.kind == MIRROR_SOCKET)
+            {
+                add_fd(m.fd, session);
+            }
+            session->mirror_count++;
+        }
+    }
+
+    /* 接受所有等待中的客户连接 */
+    void accept_all()
+    {
+        while (1)
+        {
+            int client = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client < 0)
+            {
+                return;
+            }
+            int server = connect_to(primary);
+            if (server < 0)
+            {
+                close(client);
+                continue;
+            }
+            mirror_session* session = new mirror_session;
+            session->client = client;
+            session->primary = server;
+            session->connected = session->closed = false;
+            session->next = NULL;
+            session->client_eof = session->primary_shut = false;
+            session->bytes = 0;
+            session->mirror_count = 0;
+            if (!pool->acquire(session->stage))
+            {
+                close(client);
+                close(server);
+                delete session;
+                continue;
+            }
+            if (!session->down.init(server, client, RELAY_SPLICE, pool))
+            {
+                pool->release(session->stage);
+                close(client);
+                close(server);
+                delete session;
+                continue;
+            }
+            session_seq++;
+            sessions++;
+            open_mirrors(session);
+            add_fd(client, session);
+            add_fd(server, session);
+        }
+    }
+
+    /* 丢弃一路镜像，管道中的数据随之丢弃 */
+    void drop_mirror(mirror_stream& m)
+    {
+        if (m.dropped)
+        {
+            return;
+        }
+        m.dropped = true;
+        mirrored_bytes += m.bytes;
+        close(m.fd);
+        pool->release(m.pipe);  // 管道不空时池会关闭它
+        drop_count++;
+    }
+
+    /**
+     * @brief: 把暂存管道中新读入的n个字节tee给一路镜像。镜像的管道放不下时丢弃它，不能让主路径等待
+     * @param session: 会话
+     * @param m: 镜像
+     * @param n: 新读入的字节数，即暂存管道中的全部数据
+    */
+    void mirror_tee(mirror_session* session, mirror_stream& m, int n)
+    {
+        if (m.dropped)
+        {
+            return;
+        }
+        if (m.pipe.queued + n > m.pipe.capacity)
+        {
+            drop_mirror(m);
+            return;
+        }
+        ssize_t ret = tee(session->stage.fd[0], m.pipe.fd[1], n, SPLICE_F_NONBLOCK);
+        if (ret != n)   // 只复制了一部分时镜像的数据流已经不完整（槽位不够也是写得太慢）
+        {
+            drop_mirror(m);
+            return;
+        }
+        m.pipe.queued += n;
+    }
+
+    /**
+     * @brief: 把镜像管道中的数据写出，读出并丢弃影子后端的应答
+     * @param session: 会话
+     * @param m: 镜像
+     * @return: 有进展时返回true
+    */
+    bool mirror_flush(mirror_session* session, mirror_stream& m)
+    {
+        if (m.dropped || !m.connected)
+        {
+            return false;
+        }
+        bool progress = false;
+        if (m.kind == MIRROR_SOCKET)
+        {
+            while (1)
+            {
+                ssize_t n = splice(m.fd, NULL, discard.fd[1], NULL, discard.capacity, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n <= 0)
+                {
+                    break;
+                }
+                splice(discard.fd[0], NULL, devnull, NULL, n, SPLICE_F_MOVE);
+            }
+        }
+        while (m.pipe.queued > 0)
+        {
+            ssize_t n = splice(m.pipe.fd[0], NULL, m.fd, NULL, m.pipe.queued, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0)
+            {
+                m.pipe.queued -= n;
+                m.bytes += n;
+                progress = true;
+            }
+            else if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else
+            {
+                if (n == 0 || errno != EAGAIN)
+                {
+                    drop_mirror(m);
+                }
+                return progress;
+            }
+        }
+        if (session->client_eof && !m.shut)
+        {
+            if (m.kind == MIRROR_SOCKET)
+            {
+                shutdown(m.fd, SHUT_WR);
+            }
+            m.shut = true;
+        }
+        return progress;
+    }
+
+    /**
+     * @brief: 转发客户的上行数据：读入暂存管道，tee给镜像，再写给主后端
+     * @param session: 会话
+     * @return: RELAY_STATUS
+    */
+    RELAY_STATUS pump_inbound(mirror_session* session)
+    {
+        splice_pipe& stage = session->stage;
+        bool progress = true;
+        while (progress)
+        {
+            progress = false;
+            /* 只在暂存管道为空时读入，保证tee复制的都是新数据 */
+            if (stage.queued == 0 && !session->client_eof)
+            {
+                ssize_t n = splice(session->client, NULL, stage.fd[1], NULL, stage.capacity, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n > 0)
+                {
+                    stage.queued = n;
+                    for (int i = 0; i < session->mirror_count; i++)
+                    {
+                        mirror_tee(session, session->mirrors[i], n);
+                    }
+                    progress = true;
+                }
+                else if (n == 0)
+                {
+                    session->client_eof = true;
+                    progress = true;
+                }
+                else if (errno != EAGAIN && errno != EINTR)
+                {
+                    return RELAY_ERROR;
+                }
+            }
+            if (stage.queued > 0 && session->connected)
+            {
+                ssize_t n = splice(stage.fd[0], NULL, session->primary, NULL, stage.queued, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n > 0)
+                {
+                    stage.queued -= n;
+                    session->bytes += n;
+                    progress = true;
+                }
+                else if (n < 0 && errno != EAGAIN && errno != EINTR)
+                {
+                    return RELAY_ERROR;
+                }
+            }
+            for (int i = 0; i < session->mirror_count; i++)
+            {
+                progress = mirror_flush(session, session->mirrors[i]) || progress;
+            }
+        }
+        if (session->client_eof && stage.queued == 0)
+        {
+            if (!session->primary_shut)
+            {
+                shutdown(session->primary, SHUT_WR);
+                session->primary_shut = true;
+            }
+            return RELAY_DONE;
+        }
+        return RELAY_WAIT;
+    }
+
+    /**
+     * @brief: 处理会话上的事件
+     * @param session: 会话
+     * @return: 会话应当关闭时返回false
+    */
+    bool handle(mirror_session* session)
+    {
+        if (!session->connected)
+        {
+            int ret = check_connected(session->primary);
+            if (ret < 0)
+            {
+                return false;
+            }
+            session->connected = (ret > 0);
+        }
+        for (int i = 0; i < session->mirror_count; i++)
+        {
+            mirror_stream& m = session->mirrors[i];
+            if (!m.dropped && !m.connected)
+            {
+                int ret = check_connected(m.fd);
+                if (ret < 0)
+                {
+                    drop_mirror(m);
+                }
+                m.connected = (ret > 0);
+            }
+        }
+        RELAY_STATUS up = pump_inbound(session);
+        if (up == RELAY_ERROR)
+        {
+            return false;
+        }
+        RELAY_STATUS down = session->connected ? relay_pump(session->down, RELAY_SPLICE) : RELAY_WAIT;
+        if (down == RELAY_ERROR)
+        {
+            return false;
+        }
+        if (up != RELAY_DONE || down != RELAY_DONE)
+        {
+            return true;
+        }
+        /* 主路径已经结束，还要等镜像写完 */
+        for (int i = 0; i < session->mirror_count; i++)
+        {
+            if (!session->mirrors[i].dropped && !session->mirrors[i].shut)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* 关闭会话的所有连接和文件 */
+    void close_session(mirror_session* session)
+    {
+        for (int i = 0; i < session->mirror_count; i++)
+        {
+            mirror_stream& m = session->mirrors[i];
+            if (!m.dropped)
+            {
+                mirrored_bytes += m.bytes;
+                close(m.fd);
+                pool->release(m.pipe);
+            }
+        }
+        pool->release(session->stage);
+        close(session->client);
+        close(session->primary);
+        session->closed = true;
+        session->next = closed;
+        closed = session;
+        sessions--;
+    }
+
+private:
+    int epollfd;
+    int listenfd;
+    int devnull;                // 影子后端的应答splice到这里
+    splice_pipe discard;        // 丢弃应答用的公用管道，每次读入之后立即排空
+    pipe_pool* pool;
+    sockaddr_in primary;        // 主后端地址
+    mirror_target targets[MAX_MIRRORS];
+    int target_count;
+    mirror_session* closed;     // 本轮事件中关闭的会话
+    int sessions;               // 当前的会话数
+    long long session_seq;      // 会话序号，用于抓包文件名
+    long long drop_count;       // 丢弃的镜像数
+    long long mirrored_bytes;   // 已经关闭的会话写给镜像的总字节数
+};
+
+#endif  // TEE_MIRROR_H
@@ -0,0 +1,109 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "6-10tee_mirror.h"
+
+/* 解析“ip:port”形式的地址 */
+static bool parse_addr(const char* text, sockaddr_in& addr)
+{
+    char ip[64];
+    const char* colon = strrchr(text, ':');
+    if (!colon || colon - text >= (int)sizeof(ip))
+    {
+        return false;
+    }
+    memcpy(ip, text, colon - text);
+    ip[colon - text] = '\0';
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(colon + 1));
+    return inet_pton(AF_INET, ip, &addr.sin_addr) == 1;
+}
+
+/* 流量镜像：客户的上行数据转发给主后端，同时tee给影子后端（ip:port）或抓包文件（file:路径） */
+int main(int argc, char* argv[])
+{
+    if (argc <= 4)
+    {
+        printf("usage: %s ip_address port_number primary_ip:port mirror...\n"
+               "       mirror is shadow_ip:port or file:path\n", basename(argv[0]));
+        return 1;
+    }
+
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    address.sin_port = htons(port);
+
+    struct sockaddr_in primary;
+    if (!parse_addr(argv[3], primary))
+    {
+        printf("bad primary address: %s\n", argv[3]);
+        return 1;
+    }
+
+    mirror_target targets[MAX_MIRRORS];
+    int count = 0;
+    for (int i = 4; i < argc && count < MAX_MIRRORS; i++, count++)
+    {
+        if (strncmp(argv[i], "file:", 5) == 0)
+        {
+            targets[count].kind = MIRROR_FILE;
+            targets[count].path = argv[i] + 5;
+        }
+        else if (parse_addr(argv[i], targets[count].addr))
+        {
+            targets[count].kind = MIRROR_SOCKET;
+        }
+        else
+        {
+            printf("bad mirror: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int sock = socket(PF_INET, SOCK_STREAM, 0);
+    assert(sock >= 0);
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    int ret = bind(sock, (struct sockaddr*)&address, sizeof(address));
+    assert(ret != -1);
+
+    ret = listen(sock, 128);
+    assert(ret != -1);
+
+    pipe_pool pipes;
+    mirror_server server;
+    if (!server.init(sock, primary, targets, count, &pipes))
+    {
+        printf("init failure, errno: %d\n", errno);
+        return 1;
+    }
+    long long dropped = 0;
+    while (1)
+    {
+        server.run_once(-1);
+        if (server.dropped() != dropped)
+        {
+            dropped = server.dropped();
+            printf("mirrors dropped: %lld, sessions: %d\n", dropped, server.size());
+            fflush(stdout);
+        }
+    }
+
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,685 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include "6-9pipe_pool.h"
+
+/* 比较发送文件的五种方式：read+send、read+writev（6-2testwritev.cpp）、mmap+writev、sendfile（6-3testsendfile.cpp）
+    和经过管道的splice（6-4testsplice.cpp）。服务器线程用LT模式的epoll处理所有连接，每个连接收到请求之后发送
+    一个HTTP应答头部和整个文件，然后关闭；若干个客户线程各自循环“连接、发送请求、读到EOF”。
+    每种方式在不同的文件大小和并发数下各跑一轮，报告吞吐量、服务器线程每发送1GB消耗的CPU时间和请求延迟的p50/p99，
+    每组最后列出吞吐量最高和CPU最省的方式。为了公平，每次可写事件每种方式最多发送CHUNK_SIZE字节；
+    read的两种方式每次读CHUNK_SIZE字节到缓冲区，而不是像6-2testwritev.cpp那样把整个文件读进内存；
+    mmap方式每个文件只映射一次，相当于服务器缓存了映射。默认测试页缓存中的文件，加cold参数时每轮之前用
+    posix_fadvise把文件逐出页缓存（只对干净的页有效，磁盘足够慢时才有意义）
+    编译：g++ -O2 -pthread 6-12io_bench.cpp
+    用法：io_bench 目录 [最大文件MB] [每轮字节数MB] [并发数列表，如1,8,64] [cold]
+*/
+
+#define CHUNK_SIZE (256 * 1024)     // 每次可写事件最多发送的字节数，也是读缓冲区和管道的大小
+#define MAX_REQUESTS 5000           // 每轮最多的请求数
+#define MAX_EVENT_NUMBER 1024
+#define RECV_BUFFER_SIZE (1024 * 1024)
+
+enum IO_STRATEGY {
+    IO_READ_SEND = 0,
+    IO_READ_WRITEV,
+    IO_MMAP_WRITEV,
+    IO_SENDFILE,
+    IO_SPLICE,
+    IO_STRATEGY_COUNT
+};
+
+static const char* strategy_name[IO_STRATEGY_COUNT] = {"read+send", "read+writev", "mmap+writev", "sendfile", "splice"};
+
+/* 一轮测试的参数和结果 */
+struct bench_round
+{
+    IO_STRATEGY strategy;
+    const char* path;       // 文件
+    long long size;         // 文件大小
+    int requests;
+    int concurrency;
+    volatile bool stop;     // 客户线程都已结束，服务器线程不必再等，由run_round设置
+    /* 结果 */
+    double elapsed;
+    double server_cpu;      // 服务器线程的CPU时间
+    double p50;
+    double p99;
+    int failed;
+};
+
+/* 服务器端的一个连接 */
+struct io_conn
+{
+    int sockfd;
+    bool started;           // 已经收到请求
+    int filefd;             // mmap方式不打开文件
+    char header[64];
+    int header_len;
+    int header_sent;
+    off_t off;              // 文件中已经发送（read方式是已经读出）的位置
+    char* buf;              // read方式的缓冲区
+    int buf_len;
+    int buf_sent;
+    splice_pipe pipe;
+};
+
+static sockaddr_in server_addr;
+static int listenfd;
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double thread_cpu()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 服务器线程的状态，只在服务器线程中使用 */
+struct io_server
+{
+    bench_round* round;
+    char* map;                      // mmap方式的文件映射
+    std::vector<char*> buffers;     // 空闲的读缓冲区
+    pipe_pool* pipes;
+    int epollfd;
+    int served;
+};
+
+/**
+ * @brief: 发送头部剩下的部分
+ * @return: 本次发送的字节数，socket写满时返回-1且errno为EAGAIN
+*/
+static ssize_t send_header(io_conn* c, int flags)
+{
+    ssize_t n = send(c->sockfd, c->header + c->header_sent, c->header_len - c->header_sent, flags | MSG_NOSIGNAL);
+    if (n > 0)
+    {
+        c->header_sent += n;
+    }
+    return n;
+}
+
+/* 用writev一并发送头部剩下的部分和一段数据，返回其中数据的字节数，头部和数据都没有发出时返回writev的结果 */
+static ssize_t writev_with_header(io_conn* c, const char* data, size_t len)
+{
+    struct iovec iv[2];
+    int count = 0;
+    if (c->header_sent < c->header_len)
+    {
+        iv[count].iov_base = c->header + c->header_sent;
+        iv[count].iov_len = c->header_len - c->header_sent;
+        count++;
+    }
+    iv[count].iov_base = (void*)data;
+    iv[count].iov_len = len;
+    count++;
+    ssize_t n = writev(c->sockfd, iv, count);
+    if (n <= 0)
+    {
+        return n;
+    }
+    int head = c->header_len - c->header_sent;
+    if (n <= head)
+    {
+        c->header_sent += n;
+        return 0;
+    }
+    c->header_sent = c->header_len;
+    return n - head;
+}
+
+/**
+ * @brief: 用一种方式发送一步：最多CHUNK_SIZE字节
+ * @return: 本步发送的文件数据字节数（可以为0，例如只发出了头部），socket写满时返回-1且errno为EAGAIN，出错时返回-1
+*/
+static ssize_t send_step(io_server& s, io_conn* c)
+{
+    long long size = s.round->size;
+    long long left = size - c->off;
+    ssize_t n;
+    switch (s.round->strategy)
+    {
+    case IO_READ_SEND:
+    case IO_READ_WRITEV:
+        if (c->buf_sent == c->buf_len && left > 0)
+        {
+            n = pread(c->filefd, c->buf, left < CHUNK_SIZE ? left : CHUNK_SIZE, c->off);
+            if (n <= 0)
+            {
+                errno = EIO;
+                return -1;
+            }
+            c->off += n;
+            c->buf_len = n;
+            c->buf_sent = 0;
+        }
+        if (s.round->strategy == IO_READ_SEND)
+        {
+            if (c->header_sent < c->header_len)
+            {
+                n = send_header(c, 0);
+                return (n < 0) ? -1 : 0;
+            }
+            n = send(c->sockfd, c->buf + c->buf_sent, c->buf_len - c->buf_sent, MSG_NOSIGNAL);
+        }
+        else
+        {
+            n = writev_with_header(c, c->buf + c->buf_sent, c->buf_len - c->buf_sent);
+        }
+        if (n > 0)
+        {
+            c->buf_sent += n;
+        }
+        return n;
+    case IO_MMAP_WRITEV:
+        n = writev_with_header(c, s.map + c->off, left < CHUNK_SIZE ? left : CHUNK_SIZE);
+        if (n > 0)
+        {
+            c->off += n;
+        }
+        return n;
+    case IO_SENDFILE:
+        if (c->header_sent < c->header_len)
+        {
+            n = send_header(c, MSG_MORE);   // 和随后的文件数据合并成一个报文段
+            return (n < 0) ? -1 : 0;
+        }
+        return sendfile(c->sockfd, c->filefd, &c->off, left < CHUNK_SIZE ? left : CHUNK_SIZE);
+    case IO_SPLICE:
+        if (c->header_sent < c->header_len)
+        {
+            n = send_header(c, MSG_MORE);
+            return (n < 0) ? -1 : 0;
+        }
+        if (c->pipe.queued == 0)
+        {
+            long long want = left < c->pipe.capacity ? left : c->pipe.capacity;
+            n = splice(c->filefd, &c->off, c->pipe.fd[1], NULL, want < CHUNK_SIZE ? want : CHUNK_SIZE,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n <= 0)
+            {
+                errno = EIO;
+                return -1;
+            }
+            c->pipe.queued = n;
+        }
+        n = splice(c->pipe.fd[0], NULL, c->sockfd, NULL, c->pipe.queued, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            c->pipe.queued -= n;
+        }
+        return n;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+/* 应答是否已经全部发出 */
+static bool conn_done(io_server& s, io_conn* c)
+{
+    return c->header_sent == c->header_len && c->off == s.round->size && c->buf_sent == c->buf_len && c->pipe.queued == 0;
+}
+
+static void close_conn(io_server& s, io_conn* c)
+{
+    close(c->sockfd);   // 关闭时epoll自动删除它
+    if (c->filefd >= 0)
+    {
+        close(c->filefd);
+    }
+    if (c->buf)
+    {
+        s.buffers.push_back(c->buf);
+    }
+    if (c->pipe.fd[0] >= 0)
+    {
+        s.pipes->release(c->pipe);
+    }
+    delete c;
+    s.served++;
+}
+
+/**
+ * @brief: 发送应答，直到发完、socket写满或者本次事件发送了CHUNK_SIZE字节
+ * @return: 连接已经关闭时返回false
+*/
+static bool serve(io_server& s, io_conn* c)
+{
+    ssize_t budget = CHUNK_SIZE;
+    while (!conn_done(s, c) && budget > 0)
+    {
+        ssize_t n = send_step(s, c);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            close_conn(s, c);
+            return false;
+        }
+        budget -= (n > 0) ? n : 1;
+    }
+    if (conn_done(s, c))
+    {
+        close_conn(s, c);
+        return false;
+    }
+    return true;
+}
+
+/* 接受新连接 */
+static void accept_all(io_server& s)
+{
+    while (1)
+    {
+        int sockfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sockfd < 0)
+        {
+            return;
+        }
+        io_conn* c = new io_conn;
+        c->sockfd = sockfd;
+        c->started = false;
+        c->filefd = -1;
+        c->header_len = snprintf(c->header, sizeof(c->header), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\n\r\n", s.round->size);
+        c->header_sent = 0;
+        c->off = 0;
+        c->buf = NULL;
+        c->buf_len = c->buf_sent = 0;
+        c->pipe.fd[0] = c->pipe.fd[1] = -1;
+        c->pipe.queued = 0;
+        epoll_event event;
+        event.data.ptr = c;
+        event.events = EPOLLIN;     // 先等请求
+        epoll_ctl(s.epollfd, EPOLL_CTL_ADD, sockfd, &event);
+    }
+}
+
+/* 连接上的事件：收到请求时打开文件、准备资源，然后开始发送；没有一次发完时改为等待EPOLLOUT */
+static void handle(io_server& s, io_conn* c, unsigned int events)
+{
+    if (!c->started)
+    {
+        char request[512];
+        ssize_t n = recv(c->sockfd, request, sizeof(request), 0);
+        if (n <= 0)
+        {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            close_conn(s, c);
+            return;
+        }
+        c->started = true;
+        IO_STRATEGY strategy = s.round->strategy;
+        if (strategy != IO_MMAP_WRITEV && (c->filefd = open(s.round->path, O_RDONLY | O_CLOEXEC)) < 0)
+        {
+            close_conn(s, c);
+            return;
+        }
+        if (strategy == IO_READ_SEND || strategy == IO_READ_WRITEV)
+        {
+            if (s.buffers.empty())
+            {
+                c->buf = (char*)malloc(CHUNK_SIZE);
+            }
+            else
+            {
+                c->buf = s.buffers.back();
+                s.buffers.pop_back();
+            }
+        }
+        if (strategy == IO_SPLICE && !s.pipes->acquire(c->pipe))
+        {
+            close_conn(s, c);
+            return;
+        }
+        if (!serve(s, c))
+        {
+            return;
+        }
+        epoll_event event;
+        event.data.ptr = c;
+        event.events = EPOLLOUT;
+        epoll_ctl(s.epollfd, EPOLL_CTL_MOD, c->sockfd, &event);
+        return;
+    }
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        close_conn(s, c);
+        return;
+    }
+    serve(s, c);
+}
+
+/* 服务器线程：处理round->requests个连接之后退出。有的客户连接失败时服务器永远等不到那么多连接，由run_round通知它停止 */
+static void* server_thread(void* arg)
+{
+    bench_round* round = (bench_round*)arg;
+    io_server s;
+    s.round = round;
+    s.map = NULL;
+    s.served = 0;
+    pipe_pool pipes(CHUNK_SIZE);
+    s.pipes = &pipes;
+    s.epollfd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event;
+    event.data.ptr = NULL;
+    event.events = EPOLLIN;
+    epoll_ctl(s.epollfd, EPOLL_CTL_ADD, listenfd, &event);
+
+    double cpu = thread_cpu();
+    if (round->strategy == IO_MMAP_WRITEV && round->size > 0)
+    {
+        int fd = open(round->path, O_RDONLY | O_CLOEXEC);
+        s.map = (char*)mmap(NULL, round->size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        assert(s.map != MAP_FAILED);
+    }
+    epoll_event events[MAX_EVENT_NUMBER];
+    while (s.served < round->requests && !round->stop)
+    {
+        int number = epoll_wait(s.epollfd, events, MAX_EVENT_NUMBER, 1000);   // 超时之后检查stop
+        for (int i = 0; i < number; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                accept_all(s);
+            }
+            else
+            {
+                handle(s, (io_conn*)events[i].data.ptr, events[i].events);
+            }
+        }
+    }
+    if (s.map)
+    {
+        munmap(s.map, round->size);
+    }
+    round->server_cpu = thread_cpu() - cpu;
+    epoll_ctl(s.epollfd, EPOLL_CTL_DEL, listenfd, NULL);
+    close(s.epollfd);
+    for (size_t i = 0; i < s.buffers.size(); i++)
+    {
+        free(s.buffers[i]);
+    }
+    return NULL;
+}
+
+/* 客户线程的参数和结果 */
+struct client_arg
+{
+    bench_round* round;
+    int requests;
+    std::vector<double> latency;
+    int failed;
+};
+
+/* 完成一个请求，收到完整的应答时返回true */
+static bool one_request(const bench_round* round, char* buf)
+{
+    int fd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    static const char request[] = "GET /file HTTP/1.1\r\n\r\n";
+    send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+    long long total = 0;
+    long long header = -1;
+    ssize_t n;
+    while ((n = recv(fd, buf, RECV_BUFFER_SIZE, 0)) > 0)
+    {
+        if (header < 0)     // 头部很短，总在第一次recv中
+        {
+            char* end = (char*)memmem(buf, n, "\r\n\r\n", 4);
+            header = end ? end + 4 - buf : 0;
+        }
+        total += n;
+    }
+    close(fd);
+    return n == 0 && header > 0 && total == header + round->size;
+}
+
+static void* client_thread(void* p)
+{
+    client_arg* arg = (client_arg*)p;
+    char* buf = (char*)malloc(RECV_BUFFER_SIZE);
+    arg->failed = 0;
+    for (int i = 0; i < arg->requests; i++)
+    {
+        double start = now();
+        if (one_request(arg->round, buf))
+        {
+            arg->latency.push_back(now() - start);
+        }
+        else
+        {
+            arg->failed++;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+/* 跑一轮：启动服务器线程和round->concurrency个客户线程，请求平均分给各个客户线程 */
+static void run_round(bench_round& round)
+{
+    pthread_t server;
+    round.stop = false;
+    pthread_create(&server, NULL, server_thread, &round);
+    std::vector<client_arg> args(round.concurrency);
+    std::vector<pthread_t> tids(round.concurrency);
+    double start = now();
+    for (int i = 0; i < round.concurrency; i++)
+    {
+        args[i].round = &round;
+        args[i].requests = round.requests / round.concurrency + (i < round.requests % round.concurrency ? 1 : 0);
+        pthread_create(&tids[i], NULL, client_thread, &args[i]);
+    }
+    std::vector<double> latency;
+    round.failed = 0;
+    for (int i = 0; i < round.concurrency; i++)
+    {
+        pthread_join(tids[i], NULL);
+        latency.insert(latency.end(), args[i].latency.begin(), args[i].latency.end());
+        round.failed += args[i].failed;
+    }
+    round.elapsed = now() - start;
+    round.stop = true;      // 失败的请求没有到达服务器，服务器线程最多再等一次epoll_wait超时
+    pthread_join(server, NULL);
+    std::sort(latency.begin(), latency.end());
+    round.p50 = latency.empty() ? 0 : latency[(latency.size() - 1) / 2];
+    round.p99 = latency.empty() ? 0 : latency[(latency.size() - 1) * 99 / 100];
+}
+
+/* 创建指定大小的测试文件，已经存在时直接使用 */
+static bool make_file(const char* path, long long size)
+{
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size == size)
+    {
+        return true;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    char* buf = (char*)malloc(RECV_BUFFER_SIZE);
+    for (int i = 0; i < RECV_BUFFER_SIZE; i++)
+    {
+        buf[i] = (char)(i * 131);
+    }
+    long long left = size;
+    while (left > 0)
+    {
+        ssize_t n = write(fd, buf, left < RECV_BUFFER_SIZE ? left : RECV_BUFFER_SIZE);
+        if (n <= 0)
+        {
+            break;
+        }
+        left -= n;
+    }
+    free(buf);
+    fdatasync(fd);  // 写回磁盘之后页才是干净的，cold方式才能逐出它们
+    close(fd);
+    return left == 0;
+}
+
+/* 把文件逐出页缓存 */
+static void evict(const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/* 把文件大小写成1K、4M、1G的形式 */
+static const char* size_text(long long size, char* buf, int len)
+{
+    if (size >= (1LL << 30))
+    {
+        snprintf(buf, len, "%lldG", size >> 30);
+    }
+    else if (size >= (1 << 20))
+    {
+        snprintf(buf, len, "%lldM", size >> 20);
+    }
+    else
+    {
+        snprintf(buf, len, "%lldK", size >> 10);
+    }
+    return buf;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc <= 1)
+    {
+        printf("usage: %s directory [max_file_MB] [MB_per_round] [concurrency_list] [cold]\n", basename(argv[0]));
+        return 1;
+    }
+    const char* dir = argv[1];
+    long long max_size = ((argc > 2) ? atoll(argv[2]) : 1024) << 20;
+    long long round_bytes = ((argc > 3) ? atoll(argv[3]) : 2048) << 20;
+    std::vector<int> levels;
+    const char* list = (argc > 4) ? argv[4] : "1,8,64";
+    for (const char* p = list; *p; )
+    {
+        int level = atoi(p);
+        if (level > 0)
+        {
+            levels.push_back(level);
+        }
+        p = strchr(p, ',');
+        if (!p)
+        {
+            break;
+        }
+        p++;
+    }
+    bool cold = (argc > 5) && strcmp(argv[5], "cold") == 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    bzero(&server_addr, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &server_addr.sin_addr);
+    listenfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    assert(listenfd >= 0);
+    int ret = bind(listenfd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+    assert(ret != -1);
+    ret = listen(listenfd, SOMAXCONN);
+    assert(ret != -1);
+    socklen_t len = sizeof(server_addr);
+    getsockname(listenfd, (struct sockaddr*)&server_addr, &len);
+
+    printf("%-12s %6s %5s %6s %9s %9s %10s %9s %9s %6s\n", "strategy", "size", "conc", "reqs",
+           "MB/s", "req/s", "cpu s/GB", "p50 ms", "p99 ms", "failed");
+    for (long long size = 1024; size <= max_size; size *= 4)
+    {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/io_bench.%lld", dir, size);
+        if (!make_file(path, size))
+        {
+            printf("cannot create %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+        for (size_t l = 0; l < levels.size(); l++)
+        {
+            bench_round rounds[IO_STRATEGY_COUNT];
+            for (int k = 0; k < IO_STRATEGY_COUNT; k++)
+            {
+                bench_round& round = rounds[k];
+                round.strategy = (IO_STRATEGY)k;
+                round.path = path;
+                round.size = size;
+                long long requests = round_bytes / size;
+                round.requests = requests < 1 ? 1 : (requests > MAX_REQUESTS ? MAX_REQUESTS : requests);
+                round.concurrency = levels[l] < round.requests ? levels[l] : round.requests;
+                if (cold)
+                {
+                    evict(path);
+                }
+                run_round(round);
+                double gb = (double)size * (round.requests - round.failed) / 1e9;
+                char text[32];
+                printf("%-12s %6s %5d %6d %9.1f %9.0f %10.3f %9.3f %9.3f %6d\n", strategy_name[k],
+                       size_text(size, text, sizeof(text)), round.concurrency, round.requests,
+                       gb * 1e3 / round.elapsed, (round.requests - round.failed) / round.elapsed,
+                       gb > 0 ? round.server_cpu / gb : 0, round.p50 * 1e3, round.p99 * 1e3, round.failed);
+                fflush(stdout);
+            }
+            int fastest = 0;
+            int cheapest = 0;
+            for (int k = 1; k < IO_STRATEGY_COUNT; k++)
+            {
+                if (rounds[k].elapsed < rounds[fastest].elapsed)
+                {
+                    fastest = k;
+                }
+                if (rounds[k].server_cpu < rounds[cheapest].server_cpu)
+                {
+                    cheapest = k;
+                }
+            }
+            printf("  -> fastest: %s, least cpu: %s\n", strategy_name[fastest], strategy_name[cheapest]);
+        }
+        unlink(path);
+    }
+    close(listenfd);
+    return 0;
+}
@@ -0,0 +1,380 @@
+#ifndef SPLICE_RELAY_H
+#define SPLICE_RELAY_H
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "6-9pipe_pool.h"
+
+/* 双向TCP代理。6-4testsplice.cpp只用一个管道把一个连接上的数据splice回去一次，这里把它扩展成完整的代理：
+    接受客户连接，以非阻塞方式连接上游服务器，两个方向各用一个管道，socket -> 管道 -> socket，数据不进入用户空间。
+    所有fd都是非阻塞的，由ET模式的epoll驱动。一个方向读到EOF并且管道排空之后，对另一端shutdown(SHUT_WR)，
+    另一个方向照常转发（半关闭），两个方向都结束后关闭会话。copy模式用read/write和用户态缓冲区做同样的事，作为对照。
+    给出管道池时管道从池中取得，会话结束时排空的管道还给池
+*/
+
+#define RELAY_BUFFER_SIZE DEFAULT_PIPE_SIZE    // copy模式的用户态缓冲区大小，与管道的默认容量相同
+#define MAX_RELAY_EVENTS 1024       // epoll_wait一次最多返回的事件数
+
+/* 转发方式 */
+enum RELAY_MODE {
+    RELAY_SPLICE = 0,   // socket -> 管道 -> socket
+    RELAY_COPY          // read到用户态缓冲区，再write出去
+};
+
+/* 一次转发的结果 */
+enum RELAY_STATUS {
+    RELAY_WAIT = 0,     // 两端都没有进展，等待epoll事件
+    RELAY_DONE,         // 源端已经关闭，数据全部写出，已经对目的端shutdown
+    RELAY_ERROR         // 读写出错，会话应当关闭
+};
+
+/* 一个方向的转发通道：src -> 管道（或用户态缓冲区）-> dst */
+struct relay_channel
+{
+    int src;
+    int dst;
+    splice_pipe pipe;   // splice模式使用的管道
+    pipe_pool* pool;    // 管道的来源，为NULL时自己创建、关闭
+    char* buf;          // copy模式使用的缓冲区
+    int start;          // copy模式下缓冲区中第一个未写出的字节
+    bool src_eof;       // 源端已经读到EOF
+    bool dst_shut;      // 已经对目的端shutdown(SHUT_WR)
+    long long bytes;    // 已经写给目的端的字节数
+
+    relay_channel() : src(-1), dst(-1), pool(NULL), buf(NULL), start(0), src_eof(false), dst_shut(false), bytes(0)
+    {
+        pipe.fd[0] = pipe.fd[1] = -1;
+        pipe.capacity = pipe.queued = 0;
+    }
+    ~relay_channel()
+    {
+        if (pool)
+        {
+            pool->release(pipe);
+        }
+        else
+        {
+            close_pipe(pipe);
+        }
+        free(buf);
+    }
+
+    /**
+     * @brief: 准备管道或缓冲区
+     * @param from: 源端socket
+     * @param to: 目的端socket
+     * @param mode: 转发方式
+     * @param pipes: 管道池，可以为NULL
+     * @return: 申请资源失败时返回false
+    */
+    bool init(int from, int to, RELAY_MODE mode, pipe_pool* pipes)
+    {
+        src = from;
+        dst = to;
+        if (mode == RELAY_SPLICE)
+        {
+            pool = pipes;
+            return pool ? pool->acquire(pipe) : open_pipe(pipe);
+        }
+        buf = (char*)malloc(RELAY_BUFFER_SIZE);
+        pipe.capacity = RELAY_BUFFER_SIZE;
+        pipe.queued = 0;
+        return buf != NULL;
+    }
+};
+
+/**
+ * @brief: 记录一次读入的结果：累计排队的字节数，读到EOF时做标记
+ * @param ch: 通道
+ * @param n: read或splice的返回值
+ * @return: 有进展时返回1，没有时返回0，出错时返回-1
+*/
+inline int relay_filled(relay_channel& ch, ssize_t n)
+{
+    if (n > 0)
+    {
+        ch.pipe.queued += n;
+        return 1;
+    }
+    if (n == 0)
+    {
+        ch.src_eof = true;
+        return 1;
+    }
+    /* EAGAIN表示源端暂时没有数据，或者splice模式下管道的槽位已满（socket数据不满一页时也占一个槽位） */
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+}
+
+/**
+ * @brief: 在一个通道上尽可能多地转发：反复读入、写出，直到两边都没有进展。
+ *        ET模式下源端必须读到EAGAIN，或者管道满了、等目的端可写之后再继续；目的端的EPOLLOUT会再次调用本函数
+ * @param ch: 通道
+ * @param mode: 转发方式
+ * @return: RELAY_STATUS
+*/
+inline RELAY_STATUS relay_pump(relay_channel& ch, RELAY_MODE mode)
+{
+    splice_pipe& p = ch.pipe;
+    int progress = 1;
+    while (progress > 0)
+    {
+        progress = 0;
+        /* 读入 */
+        if (!ch.src_eof && p.queued < p.capacity)
+        {
+            ssize_t n;
+            if (mode == RELAY_SPLICE)
+            {
+                n = splice(ch.src, NULL, p.fd[1], NULL, p.capacity - p.queued, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            }
+            else
+            {
+                if (ch.start > 0 && ch.start + p.queued == p.capacity)    // 缓冲区尾部已满，把数据移到开头
+                {
+                    memmove(ch.buf, ch.buf + ch.start, p.queued);
+                    ch.start = 0;
+                }
+                n = read(ch.src, ch.buf + ch.start + p.queued, p.capacity - ch.start - p.queued);
+            }
+            int ret = relay_filled(ch, n);
+            if (ret < 0)
+            {
+                return RELAY_ERROR;
+            }
+            progress += ret;
+        }
+        /* 写出 */
+        if (p.queued > 0)
+        {
+            ssize_t n = (mode == RELAY_SPLICE)
+                ? splice(p.fd[0], NULL, ch.dst, NULL, p.queued, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+                : write(ch.dst, ch.buf + ch.start, p.queued);
+            if (n > 0)
+            {
+                p.queued -= n;
+                ch.bytes += n;
+                ch.start = (p.queued == 0) ? 0 : ch.start + n;
+                progress++;
+            }
+            else if (n < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                return RELAY_ERROR;
+            }
+        }
+    }
+    /* 源端已经关闭，而且它的数据都已写出：把半关闭传递给目的端 */
+    if (ch.src_eof && p.queued == 0)
+    {
+        if (!ch.dst_shut)
+        {
+            shutdown(ch.dst, SHUT_WR);
+            ch.dst_shut = true;
+        }
+        return RELAY_DONE;
+    }
+    return RELAY_WAIT;
+}
+
+/* 一个代理会话：客户连接和上游连接，以及两个方向的通道 */
+struct relay_session
+{
+    int client;
+    int upstream;
+    bool connected;         // 到上游的非阻塞连接是否已经建立
+    bool closed;            // 已经关闭，等本轮事件处理完再释放
+    relay_session* next;    // 等待释放的会话链表
+    relay_channel up;       // 客户 -> 上游
+    relay_channel down;     // 上游 -> 客户
+};
+
+/* 代理服务器：在一个线程中用一个epoll实例驱动所有会话 */
+class relay_server
+{
+public:
+    relay_server() : epollfd(-1), listenfd(-1), mode(RELAY_SPLICE), pool(NULL), closed(NULL), sessions(0), total_bytes(0) {}
+    ~relay_server()
+    {
+        if (epollfd >= 0)
+        {
+            close(epollfd);
+        }
+    }
+
+    /**
+     * @brief: 初始化
+     * @param listen_fd: 已经开始监听的socket
+     * @param upstream_addr: 上游服务器地址
+     * @param relay_mode: 转发方式
+     * @param pipes: splice模式的管道池，为NULL时每个会话自己创建默认容量的管道
+     * @return: 失败时返回false
+    */
+    bool init(int listen_fd, const sockaddr_in& upstream_addr, RELAY_MODE relay_mode, pipe_pool* pipes = NULL)
+    {
+        listenfd = listen_fd;
+        upstream = upstream_addr;
+        mode = relay_mode;
+        pool = pipes;
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd < 0)
+        {
+            return false;
+        }
+        set_nonblocking(listenfd);
+        epoll_event event;
+        event.data.ptr = NULL;
+        event.events = EPOLLIN | EPOLLET;
+        return epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &event) == 0;
+    }
+
+    /**
+     * @brief: 等待一次事件并处理
+     * @param timeout_ms: epoll_wait的超时时间
+    */
+    void run_once(int timeout_ms)
+    {
+        epoll_event events[MAX_RELAY_EVENTS];
+        int number = epoll_wait(epollfd, events, MAX_RELAY_EVENTS, timeout_ms);
+        for (int i = 0; i < number; i++)
+        {
+            relay_session* session = (relay_session*)events[i].data.ptr;
+            if (!session)
+            {
+                accept_all();
+            }
+            else if (!session->closed && !handle(session))
+            {
+                close_session(session);
+            }
+        }
+        /* 同一轮事件中可能还有这个会话另一个socket的事件，所以会话在本轮结束之后才释放 */
+        while (closed)
+        {
+            relay_session* session = closed;
+            closed = session->next;
+            delete session;
+        }
+    }
+
+    /* 当前的会话数 */
+    int size() const { return sessions; }
+
+    /* 已经关闭的会话转发的总字节数 */
+    long long bytes() const { return total_bytes; }
+
+private:
+    static void set_nonblocking(int fd)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    /* 把会话的一个socket以ET模式注册到epoll，读写事件都关注 */
+    void add_fd(int fd, relay_session* session)
+    {
+        epoll_event event;
+        event.data.ptr = session;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    /* 接受所有等待中的客户连接，为每个连接发起到上游的非阻塞连接 */
+    void accept_all()
+    {
+        while (1)
+        {
+            int client = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client < 0)
+            {
+                return;
+            }
+            int server = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (server < 0 || (connect(server, (const sockaddr*)&upstream, sizeof(upstream)) < 0 && errno != EINPROGRESS))
+            {
+                if (server >= 0)
+                {
+                    close(server);
+                }
+                close(client);
+                continue;
+            }
+            relay_session* session = new relay_session;
+            session->client = client;
+            session->upstream = server;
+            session->connected = false;
+            session->closed = false;
+            session->next = NULL;
+            if (!session->up.init(client, server, mode, pool) || !session->down.init(server, client, mode, pool))
+            {
+                close(client);
+                close(server);
+                delete session;
+                continue;
+            }
+            sessions++;
+            add_fd(client, session);
+            add_fd(server, session);
+        }
+    }
+
+    /**
+     * @brief: 处理会话上的事件：连接建立之后，两个方向都尽可能多地转发
+     * @param session: 会话
+     * @return: 会话应当关闭时返回false
+    */
+    bool handle(relay_session* session)
+    {
+        if (!session->connected)
+        {
+            /* 非阻塞connect完成时上游socket变为可写，用SO_ERROR取得连接结果；还没有完成时继续等待 */
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(session->upstream, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+            {
+                return false;
+            }
+            sockaddr_in peer;
+            socklen_t peer_len = sizeof(peer);
+            if (getpeername(session->upstream, (sockaddr*)&peer, &peer_len) < 0)
+            {
+                return true;
+            }
+            session->connected = true;
+        }
+        RELAY_STATUS up = relay_pump(session->up, mode);
+        RELAY_STATUS down = relay_pump(session->down, mode);
+        if (up == RELAY_ERROR || down == RELAY_ERROR)
+        {
+            return false;
+        }
+        return !(up == RELAY_DONE && down == RELAY_DONE);
+    }
+
+    /* 关闭会话的两个连接，释放管道 */
+    void close_session(relay_session* session)
+    {
+        total_bytes += session->up.bytes + session->down.bytes;
+        close(session->client);     // 关闭fd时epoll自动删除它
+        close(session->upstream);
+        session->closed = true;
+        session->next = closed;
+        closed = session;
+        sessions--;
+    }
+
+private:
+    int epollfd;
+    int listenfd;
+    sockaddr_in upstream;   // 上游服务器地址
+    RELAY_MODE mode;
+    pipe_pool* pool;        // 管道池，可以为NULL
+    relay_session* closed;  // 本轮事件中关闭的会话
+    int sessions;           // 当前的会话数
+    long long total_bytes;  // 已经关闭的会话转发的总字节数
+};
+
+#endif  // SPLICE_RELAY_H
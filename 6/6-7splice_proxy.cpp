@@ -0,0 +1,69 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "6-6splice_relay.h"
+
+/* 双向TCP代理：接受客户连接，连接到上游服务器，两个方向用splice转发。第5个参数为copy时改用read/write转发，
+    第6个参数是管道容量，默认为pipe-max-size */
+int main(int argc, char* argv[])
+{
+    if (argc <= 4)
+    {
+        printf("usage: %s ip_address port_number upstream_ip upstream_port [splice|copy] [pipe_size]\n", basename(argv[0]));
+        return 1;
+    }
+
+    const char* ip = argv[1];
+    int port = atoi(argv[2]);
+    RELAY_MODE mode = (argc > 5 && strcmp(argv[5], "copy") == 0) ? RELAY_COPY : RELAY_SPLICE;
+
+    // 监听地址
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    address.sin_port = htons(port);
+
+    // 上游服务器地址
+    struct sockaddr_in upstream;
+    bzero(&upstream, sizeof(upstream));
+    upstream.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[3], &upstream.sin_addr);
+    upstream.sin_port = htons(atoi(argv[4]));
+
+    signal(SIGPIPE, SIG_IGN);   // 对端已经关闭时splice/write返回EPIPE，不要让信号杀死进程
+
+    int sock = socket(PF_INET, SOCK_STREAM, 0);
+    assert(sock >= 0);
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    int ret = bind(sock, (struct sockaddr*)&address, sizeof(address));
+    assert(ret != -1);
+
+    ret = listen(sock, 128);
+    assert(ret != -1);
+
+    pipe_pool pipes(argc > 6 ? atoi(argv[6]) : 0);
+    relay_server server;
+    if (!server.init(sock, upstream, mode, &pipes))
+    {
+        printf("init failure, errno: %d\n", errno);
+        return 1;
+    }
+    printf("relay %s:%d -> %s:%s by %s, pipe size %d\n", ip, port, argv[3], argv[4],
+           mode == RELAY_SPLICE ? "splice" : "read/write", pipes.size());
+    while (1)
+    {
+        server.run_once(-1);
+    }
+
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,260 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include "6-6splice_relay.h"
+
+/* 比较splice和read/write两种代理的吞吐量。在回环地址上启动一个吸收数据的上游服务器和一个代理线程，
+    每个客户线程经过代理发送一定量的数据然后半关闭，上游读到EOF后回送收到的字节数，客户核对之后结束。
+    报告吞吐量和代理线程每转发1GB消耗的CPU时间。splice按不同的管道容量各跑一轮；
+    最后用大量只发4KB的短连接比较每个会话都创建管道和从管道池取管道的连接速率。编译：g++ -O2 -pthread 6-8relay_bench.cpp
+*/
+
+#define BENCH_BUFFER_SIZE (1024 * 1024)
+#define SHORT_CONN_BYTES 4096       // 短连接发送的字节数
+#define SHORT_CONN_COUNT 5000       // 每个客户线程的短连接数
+
+static char payload[BENCH_BUFFER_SIZE];
+static long long stream_bytes;      // 每个客户发送的字节数
+static int stream_conns;            // 每个客户依次建立的连接数
+static sockaddr_in upstream_addr;
+static sockaddr_in proxy_addr;
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double thread_cpu()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 在回环地址的随机端口上监听，返回监听socket和地址 */
+static int listen_any(sockaddr_in& address)
+{
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    address.sin_port = 0;
+    int sock = socket(PF_INET, SOCK_STREAM, 0);
+    assert(sock >= 0);
+    int ret = bind(sock, (struct sockaddr*)&address, sizeof(address));
+    assert(ret != -1);
+    ret = listen(sock, 128);
+    assert(ret != -1);
+    socklen_t len = sizeof(address);
+    getsockname(sock, (struct sockaddr*)&address, &len);
+    return sock;
+}
+
+/* 上游的一个连接：读到EOF，回送收到的字节数 */
+static void* sink_conn(void* arg)
+{
+    int fd = (int)(long)arg;
+    char* buf = (char*)malloc(BENCH_BUFFER_SIZE);
+    long long total = 0;
+    ssize_t n;
+    while ((n = recv(fd, buf, BENCH_BUFFER_SIZE, 0)) > 0)
+    {
+        total += n;
+    }
+    send(fd, &total, sizeof(total), 0);
+    close(fd);
+    free(buf);
+    return NULL;
+}
+
+/* 上游服务器：每个连接一个线程 */
+static void* sink_server(void* arg)
+{
+    int sock = (int)(long)arg;
+    while (1)
+    {
+        int fd = accept(sock, NULL, NULL);
+        if (fd < 0)
+        {
+            continue;
+        }
+        pthread_t tid;
+        pthread_create(&tid, NULL, sink_conn, (void*)(long)fd);
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+/* 一个连接：经过代理发送stream_bytes字节，半关闭，等待上游回送的字节数 */
+static long long transfer()
+{
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr*)&proxy_addr, sizeof(proxy_addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    long long left = stream_bytes;
+    while (left > 0)
+    {
+        ssize_t n = send(fd, payload, left < BENCH_BUFFER_SIZE ? left : BENCH_BUFFER_SIZE, 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        left -= n;
+    }
+    shutdown(fd, SHUT_WR);
+    long long received = -1;
+    if (recv(fd, &received, sizeof(received), MSG_WAITALL) != sizeof(received))
+    {
+        received = -1;
+    }
+    close(fd);
+    return received;
+}
+
+/* 客户：依次建立stream_conns个连接，有一个连接的字节数不对时结果为-1 */
+static void* client(void* arg)
+{
+    long long result = stream_bytes;
+    for (int i = 0; i < stream_conns; i++)
+    {
+        if (transfer() != stream_bytes)
+        {
+            result = -1;
+        }
+    }
+    *(long long*)arg = result;
+    return NULL;
+}
+
+struct proxy_run
+{
+    relay_server* server;
+    volatile bool stop;
+    double cpu;         // 代理线程消耗的CPU时间
+};
+
+static void* proxy_thread(void* arg)
+{
+    proxy_run* run = (proxy_run*)arg;
+    double start = thread_cpu();
+    while (!run->stop)
+    {
+        run->server->run_once(10);
+    }
+    run->cpu = thread_cpu() - start;
+    return NULL;
+}
+
+/**
+ * @brief: 用一种转发方式跑一轮，打印结果
+ * @param name: 转发方式的名字
+ * @param mode: 转发方式
+ * @param pipes: 管道池，为NULL时每个会话自己创建管道
+ * @param streams: 并发的客户数
+*/
+static void bench(const char* name, RELAY_MODE mode, pipe_pool* pipes, int streams)
+{
+    int sock = listen_any(proxy_addr);
+    relay_server server;
+    if (!server.init(sock, upstream_addr, mode, pipes))
+    {
+        printf("init failure\n");
+        exit(1);
+    }
+    proxy_run run;
+    run.server = &server;
+    run.stop = false;
+    run.cpu = 0;
+    pthread_t proxy;
+    pthread_create(&proxy, NULL, proxy_thread, &run);
+
+    pthread_t* tids = new pthread_t[streams];
+    long long* results = new long long[streams];
+    double start = now();
+    for (int i = 0; i < streams; i++)
+    {
+        pthread_create(&tids[i], NULL, client, &results[i]);
+    }
+    bool ok = true;
+    for (int i = 0; i < streams; i++)
+    {
+        pthread_join(tids[i], NULL);
+        ok = ok && results[i] == stream_bytes;
+    }
+    double elapsed = now() - start;
+    run.stop = true;
+    pthread_join(proxy, NULL);
+    close(sock);
+
+    double gb = (double)stream_bytes * stream_conns * streams / 1e9;
+    if (stream_conns == 1)
+    {
+        printf("%-16s streams %2d  %6.2f Gbit/s  proxy cpu %5.3f s/GB  %s\n", name, streams, gb * 8 / elapsed,
+               run.cpu / gb, ok ? "ok" : "MISMATCH");
+    }
+    else
+    {
+        printf("%-16s clients %2d  %8.0f conn/s  proxy cpu %5.1f us/conn  %s\n", name, streams,
+               stream_conns * streams / elapsed, run.cpu * 1e6 / (stream_conns * streams), ok ? "ok" : "MISMATCH");
+    }
+    delete[] tids;
+    delete[] results;
+}
+
+int main(int argc, char* argv[])
+{
+    long long mb = (argc > 1) ? atoll(argv[1]) : 4096;
+    if (mb <= 0)
+    {
+        printf("usage: %s [megabytes_per_run]\n", basename(argv[0]));
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int sink = listen_any(upstream_addr);
+    pthread_t tid;
+    pthread_create(&tid, NULL, sink_server, (void*)(long)sink);
+
+    /* 大流量：read/write，以及各种管道容量的splice */
+    int max_size = pipe_max_size();
+    int sizes[] = {DEFAULT_PIPE_SIZE, 256 * 1024, max_size};
+    int streams[] = {1, 4, 16};
+    stream_conns = 1;
+    for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); i++)
+    {
+        stream_bytes = mb * 1024 * 1024 / streams[i];
+        bench("read/write", RELAY_COPY, NULL, streams[i]);
+        for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+        {
+            if (j > 0 && sizes[j] <= sizes[j - 1])
+            {
+                continue;
+            }
+            pipe_pool pipes(sizes[j]);
+            char name[32];
+            snprintf(name, sizeof(name), "splice %dK", sizes[j] / 1024);
+            bench(name, RELAY_SPLICE, &pipes, streams[i]);
+        }
+    }
+
+    /* 短连接：每个会话创建两个管道，和从管道池中取 */
+    stream_bytes = SHORT_CONN_BYTES;
+    stream_conns = SHORT_CONN_COUNT;
+    bench("splice pipe()", RELAY_SPLICE, NULL, 4);
+    pipe_pool pipes(max_size);
+    bench("splice pooled", RELAY_SPLICE, &pipes, 4);
+    printf("pool: %lld pipes created, %lld reused\n", pipes.created(), pipes.reused());
+    return 0;
+}
@@ -0,0 +1,167 @@
+#ifndef PIPE_POOL_H
+#define PIPE_POOL_H
+
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <vector>
+
+/* splice用的管道及管道池。6-4testsplice.cpp、6-5testtee.cpp每次使用都调用pipe()，默认容量64KB只有16个槽位，
+    从socket splice进管道时一次最多移动约32KB。管道池在创建管道时用F_SETPIPE_SZ把容量调到/proc/sys/fs/pipe-max-size，
+    用完的管道只有确认已经排空才收回，下次直接交给新的使用者，代理和文件转发不必为每个连接创建、关闭两个管道
+*/
+
+#define DEFAULT_PIPE_SIZE 65536     // 管道的默认容量
+#define MAX_IDLE_PIPES 64           // 池中最多保留的空闲管道数，每个管道占用两个文件描述符
+
+/* 一个管道。splice不告诉我们管道里有多少数据，自己记账：写入时加，读出时减 */
+struct splice_pipe
+{
+    int fd[2];          // fd[0]读，fd[1]写
+    int capacity;       // 管道容量
+    int queued;         // 管道中尚未读出的字节数
+};
+
+/**
+ * @brief: 创建非阻塞的管道，查询它的容量
+ * @param p: 管道
+ * @return: 创建失败时返回false
+*/
+inline bool open_pipe(splice_pipe& p)
+{
+    if (pipe2(p.fd, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        p.fd[0] = p.fd[1] = -1;
+        return false;
+    }
+    p.capacity = fcntl(p.fd[1], F_GETPIPE_SZ);
+    if (p.capacity <= 0)
+    {
+        p.capacity = DEFAULT_PIPE_SIZE;
+    }
+    p.queued = 0;
+    return true;
+}
+
+/* 关闭管道，其中没有读出的数据随之丢弃 */
+inline void close_pipe(splice_pipe& p)
+{
+    if (p.fd[0] >= 0)
+    {
+        close(p.fd[0]);
+        close(p.fd[1]);
+        p.fd[0] = p.fd[1] = -1;
+    }
+    p.queued = 0;
+}
+
+/* 非特权进程可以设置的最大管道容量，读取失败时返回默认容量 */
+inline int pipe_max_size()
+{
+    int size = 0;
+    FILE* fp = fopen("/proc/sys/fs/pipe-max-size", "r");
+    if (fp)
+    {
+        if (fscanf(fp, "%d", &size) != 1)
+        {
+            size = 0;
+        }
+        fclose(fp);
+    }
+    return (size > 0) ? size : DEFAULT_PIPE_SIZE;
+}
+
+class pipe_pool
+{
+public:
+    /**
+     * @brief: 构造函数
+     * @param size: 管道容量，为0时使用pipe-max-size
+     * @param max_idle: 池中最多保留的空闲管道数
+    */
+    pipe_pool(int size = 0, int max_idle = MAX_IDLE_PIPES) : pipe_size(size > 0 ? size : pipe_max_size()),
+        idle_limit(max_idle), create_count(0), reuse_count(0) {}
+
+    ~pipe_pool()
+    {
+        for (size_t i = 0; i < idle.size(); i++)
+        {
+            close_pipe(idle[i]);
+        }
+    }
+
+    /**
+     * @brief: 取得一个空管道，池中没有时创建并调整容量。
+     *        超过pipe-user-pages-soft之后内核拒绝扩大容量，这时使用默认容量，capacity记录实际的容量
+     * @param p: 返回管道
+     * @return: 创建失败时返回false
+    */
+    bool acquire(splice_pipe& p)
+    {
+        if (!idle.empty())
+        {
+            p = idle.back();
+            idle.pop_back();
+            reuse_count++;
+            return true;
+        }
+        if (!open_pipe(p))
+        {
+            return false;
+        }
+        if (pipe_size > p.capacity)
+        {
+            int ret = fcntl(p.fd[1], F_SETPIPE_SZ, pipe_size);
+            if (ret > 0)
+            {
+                p.capacity = ret;
+            }
+        }
+        create_count++;
+        return true;
+    }
+
+    /**
+     * @brief: 归还管道。管道中还有数据（使用者的记账和内核的FIONREAD都要为0）或者池已满时直接关闭，
+     *        否则下一个使用者会读到上一个连接的数据
+     * @param p: 管道，返回时不再有效
+    */
+    void release(splice_pipe& p)
+    {
+        if (p.fd[0] < 0)
+        {
+            return;
+        }
+        int pending = 0;
+        if (p.queued == 0 && (int)idle.size() < idle_limit && ioctl(p.fd[0], FIONREAD, &pending) == 0 && pending == 0)
+        {
+            idle.push_back(p);
+            p.fd[0] = p.fd[1] = -1;
+            p.queued = 0;
+        }
+        else
+        {
+            close_pipe(p);
+        }
+    }
+
+    /* 新建管道时请求的容量 */
+    int size() const { return pipe_size; }
+
+    /* 池中的空闲管道数 */
+    int idle_count() const { return idle.size(); }
+
+    /* 创建和复用管道的次数 */
+    long long created() const { return create_count; }
+    long long reused() const { return reuse_count; }
+
+private:
+    int pipe_size;                  // 新建管道时请求的容量
+    int idle_limit;                 // 池中最多保留的空闲管道数
+    std::vector<splice_pipe> idle;  // 空闲管道
+    long long create_count;
+    long long reuse_count;
+};
+
+#endif  // PIPE_POOL_H
@@ -0,0 +1,306 @@
+#ifndef CHUNKED_WRITER_H
+#define CHUNKED_WRITER_H
+
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define CHUNKED_FLUSH_SIZE 8192		// 缓冲的数据达到这个大小时立即作为一个块发出
+#define CHUNKED_FLUSH_MS 50			// 缓冲的数据最多停留的毫秒数
+#define CHUNKED_MAX_FRAME 65536		// 每个块的最大长度，也是写缓冲区的大小
+
+/* 写操作的结果 */
+enum WRITE_STATUS {
+	WRITE_OK = 0,		// 数据已全部交给内核
+	WRITE_AGAIN,		// socket写缓冲区已满，需要等待EPOLLOUT后调用flush
+	WRITE_ERROR			// 写出错，连接应当关闭
+};
+
+/* 以HTTP/1.1分块传输编码流式发送动态生成的应答体。
+	小的写入先在缓冲区中合并，达到大小阈值或时间阈值后作为一个块发出；大的写入不经过缓冲区，
+	块大小行、数据和结尾的"\r\n"用一次writev直接发出。只有内核没有收下的部分才被复制到缓冲区中，
+	缓冲区不超过CHUNKED_MAX_FRAME字节，写不出去时write返回0，生产者应等到EPOLLOUT再继续，
+	这样无论应答多大，占用的内存都是固定的。
+*/
+class chunked_writer
+{
+public:
+	/**
+	 * @param fd: 非阻塞的连接socket
+	 * @param header: 应答的状态行和头部，必须含有"Transfer-Encoding: chunked"，且在发送完之前保持有效
+	*/
+	chunked_writer(int fd, const char* header)
+		: sockfd(fd), buf_len(0), out_count(0), finishing(false), finished(false), first_ms(0)
+	{
+		buf = (char*)malloc(CHUNKED_MAX_FRAME);
+		prefix = header;
+		prefix_len = header ? strlen(header) : 0;
+	}
+
+	~chunked_writer() { free(buf); }
+
+	/**
+	 * @brief: 写入一段应答体
+	 * @param data: 数据
+	 * @param len: 数据长度
+	 * @return: 被接受的字节数，0表示需要等待EPOLLOUT，-1表示出错
+	*/
+	int write(const char* data, int len)
+	{
+		if (finishing || !buf)
+		{
+			return -1;
+		}
+		WRITE_STATUS status = resume();	// 先发完上一个没写完的块
+		if (status != WRITE_OK)
+		{
+			return (status == WRITE_AGAIN) ? 0 : -1;
+		}
+		if (buf_len + len < CHUNKED_FLUSH_SIZE)	// 合并小的写入
+		{
+			if (buf_len == 0)
+			{
+				first_ms = now_ms();
+			}
+			memcpy(buf + buf_len, data, len);
+			buf_len += len;
+			return len;
+		}
+		/* 缓冲区中的数据和本次写入的数据组成一个块直接发出 */
+		int n = (len < CHUNKED_MAX_FRAME - buf_len) ? len : (CHUNKED_MAX_FRAME - buf_len);
+		status = send_frame(data, n, false);
+		return (status == WRITE_ERROR) ? -1 : n;
+	}
+
+	/**
+	 * @brief: 把缓冲区中的数据作为一个块发出，并继续发送上一个没写完的块。finish之后调用时，发出还没有发出的最后一个块
+	 * @return: WRITE_STATUS
+	*/
+	WRITE_STATUS flush()
+	{
+		WRITE_STATUS status = resume();
+		if ((status != WRITE_OK) || finished)
+		{
+			return status;
+		}
+		if (finishing)	// finish时上一个块还没写完，最后一个块留到了这里
+		{
+			return send_frame(NULL, 0, true);
+		}
+		if (buf_len == 0)
+		{
+			return status;
+		}
+		return send_frame(NULL, 0, false);
+	}
+
+	/**
+	 * @brief: 应答体结束，发出缓冲区中剩余的数据和最后一个大小为0的块。返回WRITE_AGAIN时，等到EPOLLOUT后调用flush直到返回WRITE_OK
+	 * @return: WRITE_STATUS
+	*/
+	WRITE_STATUS finish()
+	{
+		finishing = true;	// 之后不再接受写入，上一个块没写完时由flush发出最后一个块
+		WRITE_STATUS status = resume();
+		if ((status != WRITE_OK) || finished)
+		{
+			return status;
+		}
+		return send_frame(NULL, 0, true);
+	}
+
+	/* 缓冲区中的数据是否已经停留超过了时间阈值，由事件循环定期检查 */
+	bool flush_due() const
+	{
+		return (buf_len > 0) && (out_count == 0) && (now_ms() - first_ms >= CHUNKED_FLUSH_MS);
+	}
+
+	/* 是否还有数据没有交给内核 */
+	bool pending() const { return (out_count > 0) || (buf_len > 0); }
+
+	/* 应答体是否已经完整地交给了内核，包括最后一个大小为0的块 */
+	bool done() const { return finished && (out_count == 0); }
+
+	/* 距离缓冲区中的数据到期还有多少毫秒，没有缓冲数据时返回-1，可直接用作epoll_wait的超时参数 */
+	int flush_timeout() const
+	{
+		if ((buf_len == 0) || (out_count > 0))
+		{
+			return -1;
+		}
+		long long left = first_ms + CHUNKED_FLUSH_MS - now_ms();
+		return (left > 0) ? (int)left : 0;
+	}
+
+private:
+	/* 当前时间，毫秒 */
+	static long long now_ms()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
+
+	/**
+	 * @brief: 发送一个块：[应答头部][块大小行][缓冲区][data]["\r\n"]，last为true时再加上最后一个块
+	 * @param data: 直接发送、不经过缓冲区的数据
+	 * @param len: data的长度
+	 * @param last: 是否结束应答体
+	 * @return: WRITE_STATUS
+	*/
+	WRITE_STATUS send_frame(const char* data, int len, bool last)
+	{
+		int payload = buf_len + len;
+		out_count = 0;
+		if (prefix_len > 0)
+		{
+			add_out((char*)prefix, prefix_len);
+			prefix_len = 0;	// 应答头部只随第一个块发送一次
+		}
+		if (payload > 0)
+		{
+			head_len = snprintf(head, sizeof(head), "%x\r\n", payload);
+			add_out(head, head_len);
+			add_out(buf, buf_len);
+			add_out((char*)data, len);
+			add_out((char*)(last ? "\r\n0\r\n\r\n" : "\r\n"), last ? 7 : 2);
+		}
+		else if (last)
+		{
+			add_out((char*)"0\r\n\r\n", 5);
+		}
+		finished = last;
+		first_ms = 0;
+
+		WRITE_STATUS status = write_out();
+		if (status == WRITE_AGAIN)
+		{
+			/* 内核没有收下的调用者数据必须复制进缓冲区，调用者的内存在返回之后就不再可用 */
+			keep_remainder(data, len);
+		}
+		else
+		{
+			buf_len = 0;
+		}
+		return status;
+	}
+
+	/* 把一块内存加入待发送列表，跳过空块 */
+	void add_out(char* base, int len)
+	{
+		if (len > 0)
+		{
+			out[out_count].iov_base = base;
+			out[out_count].iov_len = len;
+			out_count++;
+		}
+	}
+
+	/**
+	 * @brief: 把待发送列表中剩余的内容写到socket，写了一部分时推进列表
+	 * @return: WRITE_STATUS
+	*/
+	WRITE_STATUS write_out()
+	{
+		struct iovec* iv = out;
+		int count = out_count;
+		while (count > 0)
+		{
+			int ret = writev(sockfd, iv, count);
+			if (ret < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+				{
+					break;
+				}
+				return WRITE_ERROR;
+			}
+			while (count > 0 && ret >= (int)iv->iov_len)
+			{
+				ret -= iv->iov_len;
+				iv++;
+				count--;
+			}
+			if (count > 0)
+			{
+				iv->iov_base = (char*)iv->iov_base + ret;
+				iv->iov_len -= ret;
+			}
+		}
+		memmove(out, iv, count * sizeof(struct iovec));
+		out_count = count;
+		return (count == 0) ? WRITE_OK : WRITE_AGAIN;
+	}
+
+	/**
+	 * @brief: 写了一部分后，把待发送列表中位于buf和data中的剩余数据集中到buf的开头，并让列表指向它
+	 * @param data: 本次直接发送的调用者数据
+	 * @param len: data的长度
+	*/
+	void keep_remainder(const char* data, int len)
+	{
+		int kept = 0;
+		for (int i = 0; i < out_count; i++)
+		{
+			char* base = (char*)out[i].iov_base;
+			int n = out[i].iov_len;
+			bool in_buf = (base >= buf) && (base < buf + buf_len);
+			bool in_data = data && (base >= data) && (base < data + len);
+			if (!in_buf && !in_data)
+			{
+				continue;	// 应答头部、块大小行和结尾都不会失效
+			}
+			memmove(buf + kept, base, n);	// 剩余部分总在原位置或之后，向前移动是安全的
+			out[i].iov_base = buf + kept;
+			kept += n;
+		}
+		/* buf中的数据和data的剩余部分在列表中是相邻的两项，合并成一项 */
+		for (int i = 0; i + 1 < out_count; i++)
+		{
+			if ((char*)out[i].iov_base + out[i].iov_len == (char*)out[i + 1].iov_base)
+			{
+				out[i].iov_len += out[i + 1].iov_len;
+				memmove(&out[i + 1], &out[i + 2], (out_count - i - 2) * sizeof(struct iovec));
+				out_count--;
+				i--;
+			}
+		}
+		buf_len = 0;	// 缓冲区现在只属于发送中的块，不再接受新数据
+	}
+
+	/**
+	 * @brief: 继续发送上一个没写完的块
+	 * @return: WRITE_STATUS
+	*/
+	WRITE_STATUS resume()
+	{
+		if (out_count == 0)
+		{
+			return WRITE_OK;
+		}
+		return write_out();
+	}
+
+private:
+	int sockfd;				// 连接socket
+	const char* prefix;		// 应答的状态行和头部
+	int prefix_len;			// 应答头部中尚未发送的长度
+	char* buf;				// 写缓冲区：合并小的写入，或者保存发送中的块里内核尚未收下的数据
+	int buf_len;			// 缓冲区中尚未组成块的数据长度
+	char head[16];			// 块大小行
+	int head_len;
+	struct iovec out[5];	// 发送中的块：应答头部、块大小行、缓冲区、调用者数据、结尾
+	int out_count;			// 发送中的块还剩几项没写完
+	bool finishing;			// 是否已经调用了finish
+	bool finished;			// 是否已经发出最后一个块
+	long long first_ms;		// 缓冲区中最早的数据写入的时间
+};
+
+#endif  // CHUNKED_WRITER_H
@@ -0,0 +1,173 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "8-10chunked_writer.h"
+
+#define BUFFER_SIZE 4096
+
+/* 分块传输编码的应答头部 */
+static const char* chunked_header =
+	"HTTP/1.1 200 OK\r\n"
+	"Content-Type: text/plain\r\n"
+	"Transfer-Encoding: chunked\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+/**
+ * @brief: 将文件描述符fd设置成非阻塞的
+ * @param fd: 文件描述符fd
+ * @return: 文件描述符fd原来的状态标志
+*/
+int setnonblocking(int fd)
+{
+	int old_option = fcntl(fd, F_GETFL);
+	int new_option = old_option | O_NONBLOCK;
+	fcntl(fd, F_SETFL, new_option);
+	return old_option;
+}
+
+/**
+ * @brief: 等待socket可写或者超时
+ * @param fd: 连接socket
+ * @param timeout: 超时时间（毫秒），-1表示一直等待
+ * @return: poll的返回值
+*/
+int wait_writable(int fd, int timeout)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	return poll(&pfd, 1, timeout);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc <= 2)
+	{
+		printf("usage: %s ip_address port_number [lines] [interval_ms] [send_buffer_size]\n", basename(argv[0]));
+		return 1;
+	}
+	const char* ip = argv[1];
+	int port = atoi(argv[2]);
+	int lines = (argc > 3) ? atoi(argv[3]) : 1000000;		// 动态生成的行数
+	int interval = (argc > 4) ? atoi(argv[4]) : 0;		// 每生成一行之后停顿的毫秒数，模拟慢速的生产者
+	int sndbuf = (argc > 5) ? atoi(argv[5]) : 0;		// 连接socket的发送缓冲区大小，设得很小时finish经常遇到上一个块没写完
+
+	struct sockaddr_in address;
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	inet_pton(AF_INET, ip, &address.sin_addr);
+	address.sin_port = htons(port);
+
+	int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+	assert(listenfd >= 0);
+	int ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
+	assert(ret != -1);
+	ret = listen(listenfd, 5);
+	assert(ret != -1);
+
+	struct sockaddr_in client;
+	socklen_t client_addrlength = sizeof(client);
+	int connfd = accept(listenfd, (struct sockaddr*)&client, &client_addrlength);
+	if (connfd < 0)
+	{
+		printf("errno is: %d\n", errno);
+		close(listenfd);
+		return 1;
+	}
+
+	/* 读完请求头部（直到空行），请求的内容在这里不重要 */
+	char request[BUFFER_SIZE];
+	int read_index = 0;
+	while (read_index < BUFFER_SIZE - 1)
+	{
+		ret = recv(connfd, request + read_index, BUFFER_SIZE - 1 - read_index, 0);
+		if (ret <= 0)
+		{
+			break;
+		}
+		read_index += ret;
+		request[read_index] = '\0';
+		if (strstr(request, "\r\n\r\n"))
+		{
+			break;
+		}
+	}
+
+	if (sndbuf > 0)
+	{
+		setsockopt(connfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	}
+	setnonblocking(connfd);
+	chunked_writer writer(connfd, chunked_header);
+	char line[128];
+	int line_len = 0;	// 当前行的长度
+	int offset = 0;		// 当前行已被接受的字节数
+	int produced = 0;	// 已经生成的行数
+	long long sent = 0;
+	bool ok = true;
+
+	while (ok)
+	{
+		if (offset == line_len)	// 上一行已经全部交给了writer，生成下一行
+		{
+			if (produced == lines)
+			{
+				break;
+			}
+			if (interval > 0 && produced > 0)
+			{
+				/* 生产者停顿期间，缓冲区中的数据到了时间阈值就发出，客户端不必等缓冲区填满 */
+				int timeout = writer.flush_timeout();
+				if (timeout >= 0 && timeout < interval)
+				{
+					usleep(timeout * 1000);
+					ok = (writer.flush() != WRITE_ERROR);
+					usleep((interval - timeout) * 1000);
+				}
+				else
+				{
+					usleep(interval * 1000);
+				}
+			}
+			line_len = snprintf(line, sizeof(line), "line %d: the quick brown fox jumps over the lazy dog\n", produced++);
+			offset = 0;
+		}
+
+		int n = writer.write(line + offset, line_len - offset);
+		if (n < 0)
+		{
+			ok = false;
+		}
+		else if (n == 0)	// socket写缓冲区已满，等它变得可写，期间不再生成新数据
+		{
+			wait_writable(connfd, -1);
+		}
+		offset += (n > 0) ? n : 0;
+		sent += (n > 0) ? n : 0;
+	}
+
+	/* 发出最后一个块，直到全部交给内核 */
+	WRITE_STATUS status = ok ? writer.finish() : WRITE_ERROR;
+	while (status == WRITE_AGAIN)
+	{
+		wait_writable(connfd, -1);
+		status = writer.flush();
+	}
+	/* 检查最后一个块确实交给了内核，否则客户端收到的是被截断的应答体 */
+	bool complete = (status == WRITE_OK) && writer.done();
+	printf("sent %lld bytes of body in %d lines, %s\n", sent, produced, complete ? "done" : "failed");
+
+	close(connfd);
+	close(listenfd);
+	return 0;
+}
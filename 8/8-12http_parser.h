@@ -0,0 +1,852 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include "8-4line_scanner.h"
+#include "8-6header_table.h"
+#include "8-7chunk_buffer.h"
+#include "8-8chunked_decoder.h"
+
+/* HTTP请求分析器：8-3httpparser.cpp中的主、从状态机，以及把它们和分段读缓冲区组合在一起的http_parser。
+	分析函数不做任何输出，服务器、基准测试和模糊测试都通过http_parser使用同一套分析代码
+*/
+
+/* HTTP请求方法 */
+enum METHOD {
+	GET = 0,
+	POST,
+	HEAD,
+	PUT,
+	DELETE,
+	TRACE,
+	OPTIONS,
+	CONNECT,
+	PATCH,
+	METHOD_COUNT,					// 方法的个数
+	METHOD_UNKNOWN = METHOD_COUNT	// 不支持的方法
+};
+
+/* 方法名，下标即METHOD */
+struct method_name
+{
+	const char* name;
+	int len;
+};
+
+static constexpr method_name method_names[METHOD_COUNT] = {
+	{ "GET", 3 }, { "POST", 4 }, { "HEAD", 4 }, { "PUT", 3 }, { "DELETE", 6 },
+	{ "TRACE", 5 }, { "OPTIONS", 7 }, { "CONNECT", 7 }, { "PATCH", 5 }
+};
+
+#define METHOD_HASH_SIZE 16		// 方法散列表大小，必须是2的幂
+
+/**
+ * @brief: 方法名的散列函数，只取长度和前两个字符（忽略大小写），对上面的方法是完美散列
+ * @param name: 方法名
+ * @param len: 方法名长度，必须不小于2
+ * @return: [0, METHOD_HASH_SIZE)中的槽位
+*/
+constexpr int method_hash(const char* name, int len)
+{
+	return (len + 2 * (name[0] | 0x20) + 6 * (name[1] | 0x20)) & (METHOD_HASH_SIZE - 1);
+}
+
+/* 由上面的散列函数离线算出的方法表，取代逐个strcasecmp的比较链 */
+static constexpr METHOD method_slots[METHOD_HASH_SIZE] = {
+	METHOD_UNKNOWN, PUT, HEAD, METHOD_UNKNOWN, METHOD_UNKNOWN, OPTIONS, METHOD_UNKNOWN, CONNECT,
+	METHOD_UNKNOWN, TRACE, METHOD_UNKNOWN, PATCH, DELETE, METHOD_UNKNOWN, POST, GET
+};
+
+/* 编译期检查每个方法都落在方法表中属于它的位置上 */
+constexpr bool check_method_slots(int m)
+{
+	return (m == METHOD_COUNT)
+		|| ((method_slots[method_hash(method_names[m].name, method_names[m].len)] == m) && check_method_slots(m + 1));
+}
+static_assert(check_method_slots(0), "method_slots does not match method_hash");
+
+/**
+ * @brief: 把方法名映射到METHOD，一次查表加一次比较
+ * @param name: 方法名
+ * @param len: 方法名长度
+ * @return: 对应的METHOD，不支持的方法返回METHOD_UNKNOWN
+*/
+inline METHOD lookup_method(const char* name, int len)
+{
+	if (len < 2)
+	{
+		return METHOD_UNKNOWN;
+	}
+	METHOD m = method_slots[method_hash(name, len)];
+	if ((m != METHOD_UNKNOWN) && (method_names[m].len == len) && (strncasecmp(method_names[m].name, name, len) == 0))
+	{
+		return m;
+	}
+	return METHOD_UNKNOWN;
+}
+
+/* 主状态机的三种可能状态 */
+enum CHECK_STATE { 
+	CHECK_STATE_REQUESTLINE = 0,	// 当前正在分析请求行
+	CHECK_STATE_HEADER,				// 当前正在分析头部字段
+	CHECK_STATE_CONTENT				// 当前正在读取请求体
+};
+
+/* 从状态机的三种可能状态，即行的读取状态 */
+enum LINE_STATUS { 
+	LINE_OK = 0,	// 读取到一个完整的行
+	LINE_BAD,		// 行出错
+	LINE_OPEN		// 行数据尚且不完整
+};
+
+#define MAX_HEAD_IOV 32	// 请求头部最多跨越的内存块数
+#define MAX_EMPTY_LINES 4	// 请求行之前最多忽略的空行数，例如客户端在POST请求体之后多发的"\r\n"
+
+/* 分析模式 */
+enum PARSE_MODE {
+	PARSE_IN_PLACE = 0,	// 把行结束符和各部分之后的分隔符改写成'\0'，URL和字段值可以直接当作C字符串使用
+	PARSE_PRESERVE		// 不修改读缓冲区，只记录各部分的位置和长度，请求头部的原始字节可以原样转发给上游
+};
+
+/* 服务器处理HTTP请求的结果 */
+enum HTTP_CODE { 
+	NO_REQUEST, 		// 请求不完整，需要继续读取客户数据
+	GET_REQUEST, 		// 获得了一个完整的客户请求
+	BAD_REQUEST, 		// 客户请求有语法错误
+	FORBIDDEN_REQUEST,	// 客户对资源没有足够的访问权限
+	INTERNAL_ERROR, 	// 服务器内部错误
+	CLOSED_CONNECTION,	// 客户端已经关闭连接
+	HEADER_TOO_LARGE	// 请求头部超过了字节数或字段数的上限
+};
+
+struct http_request;
+
+/* 请求体回调函数：每读到一段请求体就调用一次，data指向读缓冲区，函数返回后这段数据即被丢弃。
+	返回false表示拒绝该请求
+*/
+typedef bool (*body_handler)(http_request* request, const char* data, int len);
+
+/* 头部回调函数：请求行和头部字段分析完毕、开始读取请求体之前调用一次。返回false表示拒绝该请求 */
+typedef bool (*head_handler)(http_request* request);
+
+/* 一个HTTP请求的分析结果，由分析函数填写，由应答逻辑读取 */
+struct http_request
+{
+	METHOD method;			// 请求方法
+	char* url;				// 请求的URL，位于读缓冲区中，只有PARSE_IN_PLACE模式下以'\0'结尾
+	int url_len;			// URL的长度
+	struct iovec head[MAX_HEAD_IOV];	// 请求行、头部字段和空行的原始字节在读缓冲区中的位置，跨越内存块时分成多段
+	int head_count;			// head中完整的段数，头部分析完毕之前head[head_count]是正在增长的一段
+	int head_len;			// 请求头部的原始字节数
+	bool http11;			// 是否为HTTP/1.1请求
+	bool keep_alive;		// 应答之后是否保持连接
+	long long content_length;	// 请求体长度，分块传输时为已解码出的长度
+	long long body_remaining;	// 请求体中尚未读取的字节数
+	bool chunked;			// 请求体是否使用分块传输编码
+	int empty_lines;		// 请求行之前已经忽略的空行数
+	chunked_decoder decoder;	// 分块传输编码的解码状态
+	header_table headers;	// 头部字段表，只保存字段在读缓冲区中的位置
+
+	/* 下面五项由使用者设置，在整个连接上保持不变 */
+	head_handler head_cb;	// 头部回调函数，可以为NULL
+	body_handler body_cb;	// 请求体回调函数，为NULL时请求体被直接丢弃
+	void* user_data;		// 回调函数使用的数据
+	int max_head_bytes;		// 请求头部（含请求行）的字节数上限，0表示只受读缓冲区上限约束
+	int max_fields;			// 头部字段数的上限，0表示只受MAX_HEADERS约束
+
+	http_request() : head_cb(NULL), body_cb(NULL), user_data(NULL), max_head_bytes(0), max_fields(0) { reset(); }
+
+	/* 开始分析一个新请求前复位 */
+	void reset()
+	{
+		method = METHOD_UNKNOWN;
+		url = NULL;
+		url_len = 0;
+		head[0].iov_base = NULL;
+		head_count = 0;
+		head_len = 0;
+		http11 = true;
+		keep_alive = true;
+		content_length = 0;
+		body_remaining = 0;
+		chunked = false;
+		empty_lines = 0;
+		headers.clear();
+	}
+
+	/**
+	 * @brief: 读缓冲区换块时，未完成的行被搬到了新内存块的开头，正在增长的头部段在原来的块中到此为止
+	 * @param line: 未完成的行在原来内存块中的位置
+	 * @param moved: 这一行在新内存块中的位置
+	 * @return: 段数超过MAX_HEAD_IOV时返回false
+	*/
+	bool split_head(const char* line, char* moved)
+	{
+		int len = line - (const char*)head[head_count].iov_base;
+		if (len > 0)
+		{
+			if (head_count + 1 == MAX_HEAD_IOV)
+			{
+				return false;
+			}
+			head[head_count].iov_len = len;
+			head_len += len;
+			head_count++;
+		}
+		head[head_count].iov_base = moved;
+		return true;
+	}
+};
+
+/**
+ * @brief: 从状态机，用于解析出一行内容
+ * @param buffer: 应用程序的读缓冲区
+ * @param checked_index: 指向buffer中当前正在分析的字节
+ * @param read_index: 指向buffer中客户数据尾部的下一字节
+ * @param terminate: 是否把行结束符改写成'\0'
+ * @return: LINE_STATUS类型状态，LINE_OK时checked_index指向下一行，行的内容到checked_index - 2为止
+*/
+inline LINE_STATUS parse_line(char* buffer, int& checked_index, int& read_index, bool terminate)
+{
+	/* 由向量化扫描器一次跳过16/32个普通字节，直接定位到下一个'\r'或'\n'。
+		扫描器不修改buffer，找不到时checked_index停在read_index处，下次读入数据后从这里继续
+	*/
+	checked_index = scan_crlf(buffer, checked_index, read_index);
+	if (checked_index == read_index)	// 如果所有内容都分析完毕也没遇到'\r'字符，表示还需要继续读取客户数据
+	{
+		return LINE_OPEN;
+	}
+
+	char temp = buffer[checked_index];	// 当前要分析的字节
+	if (temp == '\r')	// 如果当前的字节是'\r'，即回车符，则说明可能读取到一个完整的行
+	{
+		if (checked_index + 1 == read_index)	// 如果'\r'字符是目前buffer中的最后一个被读入的数据，说明这次分析没有读入一个完整的行
+		{
+			return LINE_OPEN;
+		}
+		else if (buffer[checked_index + 1] == '\n')	// 如果下一个字符是'\n'，说明这次读取到一个完整的行
+		{
+			if (terminate)
+			{
+				buffer[checked_index] = '\0';
+				buffer[checked_index + 1] = '\0';
+			}
+			checked_index += 2;
+			return LINE_OK;
+		}
+		return LINE_BAD;
+	}
+	/* 当前字节是'\n'。扫描器总是先停在'\r'上，'\r'是最后一个字节时checked_index也停在'\r'处等待下一次读入，
+		所以这里的'\n'前面不会是本行的'\r'：它前面的'\r'（如果有）属于上一个请求的请求体，这是一个非法的空行
+	*/
+	return LINE_BAD;
+}
+
+/**
+ * @brief: 在[begin, end)中查找第一个空格或'\t'
+ * @param begin: 起始位置
+ * @param end: 结束位置（不包含）
+ * @return: 找到的位置，找不到时返回end
+*/
+inline char* find_blank(char* begin, char* end)
+{
+	while (begin < end && *begin != ' ' && *begin != '\t')
+	{
+		begin++;
+	}
+	return begin;
+}
+
+/**
+ * @brief: 跳过[begin, end)开头的空格和'\t'
+ * @param begin: 起始位置
+ * @param end: 结束位置（不包含）
+ * @return: 第一个不是空白的位置，全是空白时返回end
+*/
+inline char* skip_blank(char* begin, char* end)
+{
+	while (begin < end && (*begin == ' ' || *begin == '\t'))
+	{
+		begin++;
+	}
+	return begin;
+}
+
+/**
+ * @brief: 分析请求行。各部分都按长度处理，不依赖'\0'，PARSE_IN_PLACE模式下再在方法和URL之后写入'\0'
+ * @param temp: http请求行
+ * @param len: 请求行的长度，不含行结束符
+ * @param checkstate: 当前主状态机的状态
+ * @param request: 当前请求的分析结果
+ * @param terminate: 是否在方法和URL之后写入'\0'
+ * @return: HTTP_CODE类型状态
+*/
+inline HTTP_CODE parse_requestline(char* temp, int len, CHECK_STATE& checkstate, http_request& request, bool terminate)
+{
+	request.reset();	// 请求行是一个新请求的开始，清除上一个请求留下的分析结果
+
+	char* end = temp + len;
+	if (memchr(temp, '\0', len))	// 请求行中不能有'\0'，否则按C字符串使用时会被截断
+	{
+		return BAD_REQUEST;
+	}
+	char* url = find_blank(temp, end);	// 请求行中第一个空白字符或者'\t'字符
+	if (url == end)	// 如果请求行中没有空白字符或者'\t'字符，则请求必有问题 
+	{
+		return BAD_REQUEST;
+	}
+
+	char* method = temp;
+	request.method = lookup_method(method, url - method);	// 查方法表，忽略大小写
+	if (request.method == METHOD_UNKNOWN)
+	{
+		return BAD_REQUEST;
+	}
+	char* method_end = url;
+	
+	url = skip_blank(url, end);	// 跳过方法和URL之间的空白
+	char* url_end = find_blank(url, end);
+	if (url_end == end)
+	{
+		return BAD_REQUEST;
+	}
+	char* version = skip_blank(url_end, end);
+	int version_len = end - version;
+	if ((version_len == 8) && (strncasecmp(version, "HTTP/1.1", 8) == 0))
+	{
+		request.http11 = true;
+	}
+	else if ((version_len == 8) && (strncasecmp(version, "HTTP/1.0", 8) == 0))	// HTTP/1.0默认不保持连接
+	{
+		request.http11 = false;
+	}
+	else
+	{
+		return BAD_REQUEST;
+	}
+
+	// 忽略大小写，将url前7个字符和 "http://" 比较
+	if ((url_end - url >= 7) && (strncasecmp(url, "http://", 7) == 0))	// 检查url是否合法
+	{
+		url += 7;
+		url = (char*)memchr(url, '/', url_end - url);	// 指向url中字符'/'第一次出现的位置
+	}
+
+	if (!url || url[0] != '/')
+	{
+		return BAD_REQUEST;
+	}
+	if (terminate)
+	{
+		*method_end = '\0';
+		*url_end = '\0';
+	}
+	request.url = url;
+	request.url_len = url_end - url;
+	
+	// HTTP请求行处理完毕，状态转移到头部字段的分析
+	checkstate = CHECK_STATE_HEADER;
+
+	return NO_REQUEST;
+}
+
+/**
+ * @brief: URL中路径部分的长度，即第一个'?'或'#'之前的部分
+ * @param url: URL
+ * @param len: URL的长度
+ * @return: 路径部分的长度
+*/
+inline int url_path_len(const char* url, int len)
+{
+	int i = 0;
+	while (i < len && url[i] != '?' && url[i] != '#')
+	{
+		i++;
+	}
+	return i;
+}
+
+/**
+ * @brief: 判断以逗号分隔的字段值中是否含有指定的选项（忽略大小写），如"Connection: keep-alive, Upgrade"
+ * @param value: 字段值
+ * @param len: 字段值的长度
+ * @param token: 要查找的选项
+ * @return: 含有该选项时返回true
+*/
+inline bool has_token(const char* value, int len, const char* token)
+{
+	int token_len = strlen(token);
+	const char* end = value + len;
+	while (value < end)
+	{
+		while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+		{
+			value++;
+		}
+		const char* item = value;
+		while (value < end && *value != ' ' && *value != '\t' && *value != ',')
+		{
+			value++;
+		}
+		if ((value - item == token_len) && (strncasecmp(item, token, token_len) == 0))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief: 解析Content-Length字段值，只接受十进制数字
+ * @param value: 字段值
+ * @param len: 字段值的长度
+ * @return: 请求体长度，格式错误或溢出时返回-1
+*/
+inline long long parse_content_length(const char* value, int len)
+{
+	if (len == 0)
+	{
+		return -1;
+	}
+	long long length = 0;
+	for (int i = 0; i < len; i++)
+	{
+		if (value[i] < '0' || value[i] > '9' || length > (0x7fffffffffffffffLL - 9) / 10)
+		{
+			return -1;
+		}
+		length = length * 10 + (value[i] - '0');
+	}
+	return length;
+}
+
+/**
+ * @brief: 头部字段分析完毕后确定请求体的长度
+ * @param request: 当前请求的分析结果
+ * @return: 没有请求体时返回GET_REQUEST，需要继续读取请求体时返回NO_REQUEST，否则返回BAD_REQUEST
+*/
+inline HTTP_CODE parse_body_length(http_request& request)
+{
+	const header_entry* encoding = request.headers.get(HEADER_TRANSFER_ENCODING);
+	const header_entry* length = request.headers.get(HEADER_CONTENT_LENGTH);
+	if (encoding)
+	{
+		/* 只支持"chunked"这一种编码。同时带有Content-Length的请求可能被用来走私请求，直接拒绝 */
+		if (length || (encoding->value_len != 7) || (strncasecmp(encoding->value, "chunked", 7) != 0))
+		{
+			return BAD_REQUEST;
+		}
+		/* 头部表只索引第一个Transfer-Encoding，后面的字段可能追加别的编码，使chunked不再是最后一个编码（RFC 7230 3.3.3），
+			和重复的Content-Length一样直接拒绝 */
+		for (int i = 0; i < request.headers.size(); i++)
+		{
+			const header_entry& entry = request.headers.at(i);
+			if ((entry.id == HEADER_TRANSFER_ENCODING) && (&entry != encoding))
+			{
+				return BAD_REQUEST;
+			}
+		}
+		request.chunked = true;
+		request.decoder.reset();
+		return NO_REQUEST;
+	}
+	if (!length)
+	{
+		return GET_REQUEST;
+	}
+	request.content_length = parse_content_length(length->value, length->value_len);
+	if (request.content_length < 0)
+	{
+		return BAD_REQUEST;
+	}
+	/* 多个取值不同的Content-Length可能被用来走私请求，直接拒绝 */
+	for (int i = 0; i < request.headers.size(); i++)
+	{
+		const header_entry& entry = request.headers.at(i);
+		if ((entry.id == HEADER_CONTENT_LENGTH) && (parse_content_length(entry.value, entry.value_len) != request.content_length))
+		{
+			return BAD_REQUEST;
+		}
+	}
+	request.body_remaining = request.content_length;
+	return (request.content_length > 0) ? NO_REQUEST : GET_REQUEST;
+}
+
+/**
+ * @brief: 分析请求体，把buffer中属于请求体的数据（分块传输时为解码后的数据）交给回调函数，不做任何缓存
+ * @param buffer: 应用程序的读缓冲区
+ * @param checked_index: 指向buffer中当前正在分析的字节
+ * @param read_index: 指向buffer中客户数据尾部的下一字节
+ * @param start_line: 行在buffer中的起始位置
+ * @param request: 当前请求的分析结果
+ * @return: 请求体读取完毕时返回GET_REQUEST，还需要更多数据时返回NO_REQUEST，回调函数拒绝时返回BAD_REQUEST
+*/
+inline HTTP_CODE parse_body(char* buffer, int& checked_index, int& read_index, int& start_line, http_request& request)
+{
+	if (request.chunked)
+	{
+		/* 解码器直接在读缓冲区上工作，块数据原地交给回调函数，块大小行和尾部字段被跳过 */
+		while (1)
+		{
+			int consumed = 0;
+			const char* data = NULL;
+			int len = 0;
+			CHUNKED_RESULT ret = request.decoder.decode(buffer + checked_index, read_index - checked_index, consumed, data, len);
+			checked_index += consumed;
+			start_line = checked_index;
+			if (ret == CHUNKED_GOT_DATA)
+			{
+				if (request.body_cb && !request.body_cb(&request, data, len))
+				{
+					return BAD_REQUEST;
+				}
+				continue;
+			}
+			request.content_length = request.decoder.total();
+			if (ret == CHUNKED_DONE)
+			{
+				return GET_REQUEST;
+			}
+			return (ret == CHUNKED_AGAIN) ? NO_REQUEST : BAD_REQUEST;
+		}
+	}
+
+	int len = read_index - checked_index;
+	if (len > request.body_remaining)	// 之后的数据属于下一个流水线请求
+	{
+		len = request.body_remaining;
+	}
+	if (len > 0)
+	{
+		if (request.body_cb && !request.body_cb(&request, buffer + checked_index, len))
+		{
+			return BAD_REQUEST;
+		}
+		checked_index += len;
+		start_line = checked_index;
+		request.body_remaining -= len;
+	}
+	return (request.body_remaining == 0) ? GET_REQUEST : NO_REQUEST;
+}
+
+/**
+ * @brief: 分析头部字段，把字段名和字段值在读缓冲区中的位置记录到字段表中
+ * @param temp: http请求头，位于读缓冲区之中
+ * @param len: 这一行的长度，不含行结束符
+ * @param request: 当前请求的分析结果
+ * @param terminate: 是否在字段值之后写入'\0'
+ * @return: HTTP_CODE
+*/
+inline HTTP_CODE parse_headers(char* temp, int len, http_request& request, bool terminate)
+{
+	header_table& headers = request.headers;
+	// 遇到一个空行，说明得到了一个正确的http请求
+	if (len == 0)
+	{
+		/* HTTP/1.1默认保持连接，除非客户端要求close；HTTP/1.0则相反 */
+		const header_entry* connection = headers.get(HEADER_CONNECTION);
+		if (request.http11)
+		{
+			request.keep_alive = !(connection && has_token(connection->value, connection->value_len, "close"));
+		}
+		else
+		{
+			request.keep_alive = connection && has_token(connection->value, connection->value_len, "keep-alive");
+		}
+		return parse_body_length(request);
+	}
+
+	/* 字段名之前不能有空白（过时的多行折叠格式），字段名和':'之间也不能有空白，整行不能有'\0' */
+	char* end = temp + len;
+	char* colon = (char*)memchr(temp, ':', len);
+	if (!colon || colon == temp || find_blank(temp, colon) != colon || memchr(colon, '\0', end - colon))
+	{
+		return BAD_REQUEST;
+	}
+
+	/* 去掉字段值首尾的空白 */
+	char* value = skip_blank(colon + 1, end);
+	char* value_end = end;
+	while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+	{
+		value_end--;
+	}
+	if (terminate)
+	{
+		*value_end = '\0';
+	}
+
+	if (request.max_fields && headers.size() >= request.max_fields)
+	{
+		return HEADER_TOO_LARGE;
+	}
+	if (!headers.add(temp, colon - temp, value, value_end - value))
+	{
+		return BAD_REQUEST;	// 头部字段太多
+	}
+
+	return NO_REQUEST;
+}
+
+/**
+ * @brief: 头部分析完毕，记下头部的原始长度，检查字节数上限并调用头部回调函数
+ * @param request: 当前请求的分析结果
+ * @param head_end: 头部之后的第一个字节
+ * @return: 成功时返回NO_REQUEST，超过上限时返回HEADER_TOO_LARGE，回调函数拒绝时返回BAD_REQUEST
+*/
+inline HTTP_CODE finish_head(http_request& request, const char* head_end)
+{
+	struct iovec& last = request.head[request.head_count++];
+	last.iov_len = head_end - (const char*)last.iov_base;
+	request.head_len += last.iov_len;
+	if (request.max_head_bytes && request.head_len > request.max_head_bytes)
+	{
+		return HEADER_TOO_LARGE;
+	}
+	return (!request.head_cb || request.head_cb(&request)) ? NO_REQUEST : BAD_REQUEST;
+}
+
+/**
+ * @brief: 分析HTTP请求的入口函数
+ * @param buffer: 应用程序的读缓冲区
+ * @param checked_index: 指向buffer中当前正在分析的字节
+ * @param checkstate: 当前主状态机的状态
+ * @param read_index: 指向buffer中客户数据尾部的下一字节
+ * @param start_line: 行在buffer中的起始位置
+ * @param request: 当前请求的分析结果
+ * @param mode: 分析模式，PARSE_PRESERVE模式下不修改buffer
+ * @return: 返回GET_REQUEST时主状态机已复位，可以继续对buffer中剩余的（流水线）数据调用本函数
+*/
+inline HTTP_CODE parse_content(char* buffer, int& checked_index, CHECK_STATE& checkstate, int& read_index, int& start_line, http_request& request, PARSE_MODE mode)
+{
+	LINE_STATUS linestatus = LINE_OK;	// 记录当前行的读取状态
+	HTTP_CODE retcode = NO_REQUEST;		// 记录http请求的处理结果
+	bool terminate = (mode == PARSE_IN_PLACE);
+
+	// 主状态机，用于从buffer中取出所有完整的行，请求体则不按行分析
+	while (1)
+	{
+		if (checkstate == CHECK_STATE_CONTENT)
+		{
+			retcode = parse_body(buffer, checked_index, read_index, start_line, request);
+			if (retcode == GET_REQUEST)
+			{
+				checkstate = CHECK_STATE_REQUESTLINE;
+			}
+			return retcode;
+		}
+		if ((linestatus = parse_line(buffer, checked_index, read_index, terminate)) != LINE_OK)
+		{
+			break;
+		}
+
+		char* temp = buffer + start_line;
+		int len = checked_index - 2 - start_line;	// 行结束符"\r\n"不计入行的长度
+		start_line = checked_index;	// 记录下一行的起始位置
+
+		switch (checkstate)
+		{
+		case CHECK_STATE_REQUESTLINE:
+			/* RFC 7230 3.5：服务器应当忽略请求行之前至少一个空行，但不能让客户端用无穷的空行占住连接 */
+			if (len == 0 && request.empty_lines < MAX_EMPTY_LINES)
+			{
+				request.empty_lines++;
+				break;
+			}
+			retcode = parse_requestline(temp, len, checkstate, request, terminate);
+			if (retcode == BAD_REQUEST)
+			{
+				return BAD_REQUEST;
+			}
+			request.head[0].iov_base = temp;
+			break;
+		case CHECK_STATE_HEADER:
+			retcode = parse_headers(temp, len, request, terminate);
+			if (retcode == BAD_REQUEST || retcode == HEADER_TOO_LARGE)
+			{
+				return retcode;
+			}
+			else if (retcode == GET_REQUEST)
+			{
+				if ((retcode = finish_head(request, buffer + checked_index)) != NO_REQUEST)
+				{
+					return retcode;
+				}
+				checkstate = CHECK_STATE_REQUESTLINE;	// 复位主状态机，start_line已指向下一个请求的开始
+				return GET_REQUEST;
+			}
+			else if (request.chunked || request.body_remaining > 0)	// 头部之后是请求体，状态转移到请求体的读取
+			{
+				if ((retcode = finish_head(request, buffer + checked_index)) != NO_REQUEST)
+				{
+					return retcode;
+				}
+				checkstate = CHECK_STATE_CONTENT;
+			}
+			break;
+		default:
+			return INTERNAL_ERROR;
+		}
+	}
+
+	if (linestatus == LINE_OPEN)	// 没有读取到一个完整的行，需要进一步读取数据
+	{
+		return NO_REQUEST;
+	}
+	else
+	{
+		return BAD_REQUEST;
+	}
+}
+
+/* 一个连接上的请求分析器：持有读缓冲区和状态机的全部状态。
+	使用者循环调用recv_space取得可以读入数据的位置，读入后调用commit，然后反复调用parse直到它不再返回GET_REQUEST；
+	应答发出之后调用compact丢弃已应答的请求。数据从哪里来（socket或内存中的语料）对分析器没有区别。
+	PARSE_PRESERVE模式下读缓冲区保持原样：代理可以在head_cb中用分析出的方法、URL和头部字段做路由，
+	用writev把request.head中的各段原样写给上游，再在body_cb中转发请求体。和头部字段一样，head在compact之前有效
+*/
+class http_parser
+{
+public:
+	http_parser() : read_index(0), checked_index(0), start_line(0), request_start(0), checkstate(CHECK_STATE_REQUESTLINE),
+		mode(PARSE_IN_PLACE) {}
+
+	/**
+	 * @brief: 申请读缓冲区，复位状态机
+	 * @param max_bytes: 单个请求最多占用的读缓冲区字节数
+	 * @param parse_mode: 分析模式
+	 * @return: 申请失败时返回false
+	*/
+	bool init(int max_bytes, PARSE_MODE parse_mode = PARSE_IN_PLACE)
+	{
+		read_index = checked_index = start_line = request_start = 0;
+		checkstate = CHECK_STATE_REQUESTLINE;
+		mode = parse_mode;
+		request.reset();
+		return buffer.init(max_bytes);
+	}
+
+	/* 把读缓冲区归还给内存池 */
+	void release() { buffer.release(); }
+
+	/**
+	 * @brief: 取得可以读入数据的位置。当前内存块已满时换一个新的内存块，
+	 *		读取请求体时已交出的数据不再需要，内存块可以复用，所以请求体的大小不受上限约束
+	 * @param len: 返回可以读入的字节数
+	 * @return: 读入位置，请求超过上限或申请内存失败时返回NULL
+	*/
+	char* recv_space(int& len)
+	{
+		if (read_index == buffer.capacity())
+		{
+			const char* line = buffer.data() + start_line;	// 未完成的行，换块时被搬走
+			bool ok = (checkstate == CHECK_STATE_CONTENT) ? buffer.recycle(read_index, checked_index, start_line)
+				: buffer.extend(read_index, checked_index, start_line);
+			if (!ok || (checkstate == CHECK_STATE_HEADER && !request.split_head(line, buffer.data())))
+			{
+				return NULL;
+			}
+			request_start = 0;	// 换块之后，tail中不再有已应答的数据
+		}
+		len = buffer.capacity() - read_index;
+		return buffer.data() + read_index;
+	}
+
+	/* 读入了n字节数据 */
+	void commit(int n) { read_index += n; }
+
+	/**
+	 * @brief: 分析已读入的数据，得到一个完整请求后立即返回，可以继续调用以分析后面的流水线请求
+	 * @return: HTTP_CODE，GET_REQUEST时request中是这个请求的分析结果
+	*/
+	HTTP_CODE parse()
+	{
+		HTTP_CODE ret = parse_content(buffer.data(), checked_index, checkstate, read_index, start_line, request, mode);
+		if (ret == GET_REQUEST)
+		{
+			request_start = start_line;
+		}
+		else if (ret == NO_REQUEST && request.max_head_bytes && head_bytes() > request.max_head_bytes)
+		{
+			ret = HEADER_TOO_LARGE;	// 不必等到头部结束，一点一点发来的超长头部在这里就被拒绝
+		}
+		return ret;
+	}
+
+	/* 当前请求头部已经读入的字节数，包括未完成的行，请求体阶段为0 */
+	int head_bytes() const
+	{
+		if (checkstate == CHECK_STATE_REQUESTLINE)
+		{
+			return read_index - start_line;
+		}
+		if (checkstate == CHECK_STATE_HEADER)
+		{
+			return request.head_len + (buffer.data() + read_index - (const char*)request.head[request.head_count].iov_base);
+		}
+		return 0;
+	}
+
+	/* 是否有一个请求头部读了一部分：连接上有数据，但还不是一个完整的头部 */
+	bool in_head() const { return head_bytes() > 0; }
+
+	/* 把已经应答过的请求从缓冲区中移走，归还它们占用的内存块，只保留尚未分析完的请求 */
+	void compact()
+	{
+		if (request_start == 0)
+		{
+			return;
+		}
+		/* 剩余数据可能被移到另一个内存块中，按它实际移动的距离修正未完成的请求已经记录的请求行和头部字段 */
+		char* old_start = buffer.data() + request_start;
+		buffer.compact(request_start, read_index, checked_index, start_line);
+		ptrdiff_t delta = old_start - buffer.data();
+		if (checkstate != CHECK_STATE_REQUESTLINE)
+		{
+			request.headers.rebase(delta);
+			request.url -= delta;
+			/* 当前请求从request_start开始，它的头部各段都在被移动的数据中。头部未分析完时还有一段正在增长 */
+			int segments = request.head_count + ((checkstate == CHECK_STATE_HEADER) ? 1 : 0);
+			for (int i = 0; i < segments; i++)
+			{
+				request.head[i].iov_base = (char*)request.head[i].iov_base - delta;
+			}
+		}
+		request_start = 0;
+	}
+
+	/**
+	 * @brief: 请求体中有n个字节没有经过读缓冲区，由使用者直接从socket读走（例如splice进文件）。
+	 *		只能在读取长度已知的请求体、并且缓冲区中的数据都已分析完时调用；请求体读完之后parse返回GET_REQUEST
+	 * @param n: 字节数，不超过request.body_remaining
+	*/
+	void skip_body(long long n)
+	{
+		request.body_remaining -= n;
+	}
+
+	/* 缓冲区中的数据是否都已分析完，此时请求体的剩余部分可以不经过缓冲区 */
+	bool drained() const { return checked_index == read_index; }
+
+	/* 当前主状态机的状态 */
+	CHECK_STATE state() const { return checkstate; }
+
+	/* 读缓冲区当前占用的内存块数 */
+	int chunks() const { return buffer.size(); }
+
+public:
+	http_request request;	// 最近一个请求的分析结果，body_cb和user_data由使用者设置
+
+private:
+	read_buffer buffer;		// 由内存池中的内存块组成的读缓冲区，下面的下标都相对于它当前的内存块
+	int read_index;			// 当前已经读取了多少字节的客户数据
+	int checked_index;		// 当前已经分析了多少字节的客户数据
+	int start_line;			// 行在buffer中的起始位置
+	int request_start;		// 第一个尚未应答的请求在buffer中的起始位置
+	CHECK_STATE checkstate;	// 主状态机的状态
+	PARSE_MODE mode;		// 分析模式
+};
+
+#endif  // HTTP_PARSER_H
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "8-12http_parser.h"
+
+#define BENCH_MAX_REQUEST (1024 * 1024)	// 分析器的请求上限，保证语料中的请求都不会被拒绝
+#define BENCH_BYTES_PER_ROUND (2 * 1024 * 1024)	// 每轮至少分析的数据量
+#define BENCH_ROUNDS 5						// 每种分片方式重复的轮数，取最好的一轮
+#define BENCH_MSS 1460						// 随机分片的最大长度，相当于一个TCP报文段
+#define BENCH_SEED 20240601					// 随机分片的种子，保证每次运行的分片方式相同
+
+/* 一个语料文件：录制下来的原始请求字节流，可能含有多个流水线请求 */
+struct corpus_file
+{
+	std::string name;
+	std::string data;
+};
+
+/* 分片方式：每次“recv”读到的字节数依次取自pieces，循环使用 */
+struct split_pattern
+{
+	const char* name;
+	std::vector<int> pieces;
+};
+
+/**
+ * @brief: 读取时间戳计数器，在非x86平台上退化为纳秒计数
+ * @return: 当前的周期数（或纳秒数）
+*/
+static inline unsigned long long read_cycles()
+{
+#ifdef LINE_SCANNER_X86
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief: 获取单调时钟的当前时间
+ * @return: 纳秒数
+*/
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief: 读入一个语料文件
+ * @param path: 文件路径
+ * @param file: 返回文件内容
+ * @return: 读取失败或文件为空时返回false
+*/
+static bool load_file(const char* path, corpus_file& file)
+{
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+	{
+		return false;
+	}
+	char buf[4096];
+	size_t n = 0;
+	file.data.clear();
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+	{
+		file.data.append(buf, n);
+	}
+	fclose(fp);
+	const char* base = strrchr(path, '/');
+	file.name = base ? base + 1 : path;
+	return !file.data.empty();
+}
+
+/**
+ * @brief: 读入目录中的所有语料文件，按文件名排序
+ * @param dir: 语料目录
+ * @param files: 读入的文件追加到这里
+*/
+static void load_dir(const char* dir, std::vector<corpus_file>& files)
+{
+	DIR* dp = opendir(dir);
+	if (!dp)
+	{
+		return;
+	}
+	std::vector<std::string> paths;
+	struct dirent* entry = NULL;
+	while ((entry = readdir(dp)) != NULL)
+	{
+		if (entry->d_name[0] != '.')
+		{
+			paths.push_back(std::string(dir) + "/" + entry->d_name);
+		}
+	}
+	closedir(dp);
+	std::sort(paths.begin(), paths.end());
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		corpus_file file;
+		if (load_file(paths[i].c_str(), file))
+		{
+			files.push_back(file);
+		}
+	}
+}
+
+/* 基准测试用的请求体回调，只累加长度，相当于把请求体交给应用 */
+static bool sink_body(http_request* request, const char* data, int len)
+{
+	(void)data;
+	*(long long*)request->user_data += len;
+	return true;
+}
+
+/**
+ * @brief: 像服务器的读循环那样把数据按分片方式喂给分析器：每读入一片就分析出其中所有完整的请求，然后整理缓冲区
+ * @param parser: 已经init的分析器
+ * @param data: 原始请求字节流
+ * @param len: 字节流长度
+ * @param split: 分片方式
+ * @return: 分析出的请求数，出错时返回-1
+*/
+static int feed(http_parser& parser, const char* data, int len, const split_pattern& split)
+{
+	int requests = 0;
+	size_t next = 0;
+	for (int offset = 0; offset < len; )
+	{
+		int space = 0;
+		char* dest = parser.recv_space(space);
+		if (!dest)
+		{
+			return -1;
+		}
+		int n = split.pieces[next];
+		next = (next + 1 == split.pieces.size()) ? 0 : next + 1;
+		n = std::min(n, std::min(space, len - offset));
+		memcpy(dest, data + offset, n);	// 相当于recv把数据从内核复制到读缓冲区
+		parser.commit(n);
+		offset += n;
+
+		HTTP_CODE ret = NO_REQUEST;
+		while ((ret = parser.parse()) == GET_REQUEST)
+		{
+			requests++;
+		}
+		if (ret != NO_REQUEST)
+		{
+			return -1;
+		}
+		parser.compact();
+	}
+	return requests;
+}
+
+/**
+ * @brief: 用一种分片方式反复分析一个语料文件，输出每个请求的耗时
+ * @param file: 语料文件
+ * @param split: 分片方式
+ * @param mode: 分析模式
+ * @return: 分析出错时返回false
+*/
+static bool bench(const corpus_file& file, const split_pattern& split, PARSE_MODE mode)
+{
+	const char* data = file.data.data();
+	int len = file.data.size();
+	int repeat = std::max(1, BENCH_BYTES_PER_ROUND / len);
+	long long body_bytes = 0;
+	http_parser parser;
+	parser.request.body_cb = sink_body;
+	parser.request.user_data = &body_bytes;
+
+	long long best_ns = 0x7fffffffffffffffLL;
+	unsigned long long best_cycles = ~0ULL;
+	int requests = 0;
+	for (int round = 0; round < BENCH_ROUNDS; round++)
+	{
+		long long start = now_ns();
+		unsigned long long cycles = read_cycles();
+		for (int i = 0; i < repeat; i++)
+		{
+			/* 每次重复都是一个新连接，语料中的流水线请求在同一个连接上分析 */
+			parser.init(BENCH_MAX_REQUEST, mode);
+			requests = feed(parser, data, len, split);
+			parser.release();
+			if (requests <= 0)
+			{
+				printf("%s: parse failed with %s split\n", file.name.c_str(), split.name);
+				return false;
+			}
+		}
+		cycles = read_cycles() - cycles;
+		long long cost = now_ns() - start;
+		best_ns = std::min(best_ns, cost);
+		best_cycles = std::min(best_cycles, cycles);
+	}
+
+	long long total_requests = (long long)requests * repeat;
+	double ns = (double)best_ns / total_requests;
+	printf("%-18s %-8s %-9s %6d %12.1f %14.0f %12.3f\n", file.name.c_str(), split.name,
+		(mode == PARSE_PRESERVE) ? "preserve" : "in-place", requests, ns, 1e9 / ns, (double)len * repeat / best_cycles);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	/* 参数是语料文件或目录，默认使用当前目录下的corpus目录 */
+	std::vector<corpus_file> files;
+	for (int i = 1; i < argc; i++)
+	{
+		corpus_file file;
+		if (load_file(argv[i], file))
+		{
+			files.push_back(file);
+		}
+		else
+		{
+			load_dir(argv[i], files);
+		}
+	}
+	if (argc <= 1)
+	{
+		load_dir("corpus", files);
+	}
+	if (files.empty())
+	{
+		printf("usage: %s [corpus_file_or_dir ...]\n", basename(argv[0]));
+		return 1;
+	}
+
+	/* 三种分片方式：一次读完、每次只读1字节、按固定种子随机分片 */
+	split_pattern splits[3];
+	splits[0].name = "whole";
+	splits[0].pieces.push_back(0x7fffffff);
+	splits[1].name = "1-byte";
+	splits[1].pieces.push_back(1);
+	splits[2].name = "random";
+	srand(BENCH_SEED);
+	for (int i = 0; i < 4096; i++)
+	{
+		splits[2].pieces.push_back(1 + rand() % BENCH_MSS);
+	}
+
+	printf("%-18s %-8s %-9s %6s %12s %14s %12s\n", "corpus", "split", "mode", "reqs", "ns/request", "requests/s", "bytes/cycle");
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			if (!bench(files[i], splits[k], PARSE_IN_PLACE))
+			{
+				return 1;
+			}
+		}
+		/* 不修改缓冲区的模式，供代理转发原始请求时使用 */
+		if (!bench(files[i], splits[0], PARSE_PRESERVE) || !bench(files[i], splits[2], PARSE_PRESERVE))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "8-12http_parser.h"
+
+/* 请求分析器的模糊测试，入口函数与libFuzzer的约定相同。
+	独立运行（默认）：g++ -std=gnu++11 -g -O1 -fsanitize=address,undefined 8-14parser_fuzz.cpp，
+		参数是语料文件或目录，先检查一组结果已知的请求（主要是请求走私的写法），再逐个检查语料，最后对语料做随机变异；
+	接入libFuzzer：clang++ -std=gnu++11 -g -O1 -fsanitize=fuzzer,address -DPARSER_FUZZ_LIBFUZZER 8-14parser_fuzz.cpp。
+	同一段输入分别一次读完、每次读1字节、按输入决定的随机方式分片喂给分析器，三次分析出的所有结果必须完全相同，
+	不修改读缓冲区的PARSE_PRESERVE模式也要分析出同样的结果，并且它报告的请求头部必须是输入中原样的字节。
+	同时各个向量化行扫描器必须和标量版本给出同样的位置。任何不一致都调用abort()，由libFuzzer或使用者保存输入
+*/
+
+#define FUZZ_MAX_INPUT (64 * 1024)		// 更长的输入被忽略，避免1字节分片过慢
+#define FUZZ_MAX_REQUEST (1024 * 1024)	// 分析器的请求上限，大于任何输入，不会因为分片方式不同而触发
+#define FUZZ_MUTATIONS 200000			// 独立运行时默认的变异次数
+#define FUZZ_SEED 20240601				// 独立运行时的随机种子
+
+/* 64位FNV-1a散列，用来把一次分析的全部结果压缩成一个摘要 */
+struct digest
+{
+	uint64_t value;
+
+	digest() : value(14695981039346656037ULL) {}
+
+	void add(const void* data, int len)
+	{
+		const unsigned char* p = (const unsigned char*)data;
+		for (int i = 0; i < len; i++)
+		{
+			value = (value ^ p[i]) * 1099511628211ULL;
+		}
+	}
+	void add_int(long long v) { add(&v, sizeof(v)); }
+	void add_str(const char* s) { add(s, strlen(s) + 1); }
+};
+
+/* 一次分析的结果 */
+struct parse_trace
+{
+	digest summary;			// 每个请求的方法、URL、头部字段、请求体等的摘要
+	int requests;			// 分析出的完整请求数
+	int result;				// 最后的分析结果：NO_REQUEST、BAD_REQUEST等，-1表示超出请求上限
+	digest body;			// 当前请求的请求体，按字节流计算，与回调被调用的次数无关
+	int heads;				// 头部回调函数被调用的次数
+	const char* input;		// 输入，PARSE_PRESERVE模式下用来核对请求头部的原始字节，否则为NULL
+	int input_len;
+};
+
+/* 把请求体计入摘要 */
+static bool hash_body(http_request* request, const char* data, int len)
+{
+	((parse_trace*)request->user_data)->body.add(data, len);
+	return true;
+}
+
+/* 头部分析完毕，每个请求只能调用一次，并且在请求体之前 */
+static bool count_head(http_request* request)
+{
+	parse_trace* trace = (parse_trace*)request->user_data;
+	if (trace->heads != trace->requests || trace->body.value != digest().value)
+	{
+		abort();
+	}
+	trace->heads++;
+	return true;
+}
+
+/**
+ * @brief: 把一个完整请求的分析结果计入摘要。头部字段都指向读缓冲区，缓冲区整理得不对时这里会读到错误的内容
+ * @param trace: 分析结果
+ * @param request: 刚分析完的请求
+*/
+static void record_request(parse_trace& trace, const http_request& request)
+{
+	digest& d = trace.summary;
+	if (trace.heads != trace.requests + 1)
+	{
+		abort();
+	}
+	/* 不修改缓冲区时，把各段拼起来的请求头部必须原样出现在输入中 */
+	if (trace.input)
+	{
+		std::string head;
+		for (int i = 0; i < request.head_count; i++)
+		{
+			head.append((const char*)request.head[i].iov_base, request.head[i].iov_len);
+		}
+		if ((int)head.size() != request.head_len || !memmem(trace.input, trace.input_len, head.data(), head.size()))
+		{
+			abort();
+		}
+	}
+	d.add_int(request.method);
+	d.add(request.url, request.url_len);
+	d.add_int(request.head_len);
+	d.add_int(request.http11);
+	d.add_int(request.keep_alive);
+	d.add_int(request.chunked);
+	d.add_int(request.content_length);
+	d.add_int(request.headers.size());
+	for (int i = 0; i < request.headers.size(); i++)
+	{
+		const header_entry& entry = request.headers.at(i);
+		d.add(entry.name, entry.name_len);
+		d.add(entry.value, entry.value_len);
+		d.add_int(entry.id);
+		if (entry.id != HEADER_UNKNOWN && request.headers.get(entry.id) == NULL)
+		{
+			abort();
+		}
+	}
+	d.add_int(trace.body.value);
+	trace.body = digest();
+	trace.requests++;
+}
+
+/**
+ * @brief: 像服务器的读循环那样分片喂给分析器，遇到错误或Connection: close时停止
+ * @param data: 输入
+ * @param len: 输入长度
+ * @param pieces: 每次读入的字节数，循环使用
+ * @param mode: 分析模式
+ * @param trace: 返回分析结果
+*/
+static void run_parser(const char* data, int len, const std::vector<int>& pieces, PARSE_MODE mode, parse_trace& trace)
+{
+	http_parser parser;
+	parser.request.head_cb = count_head;
+	parser.request.body_cb = hash_body;
+	parser.request.user_data = &trace;
+	trace.summary = digest();
+	trace.body = digest();
+	trace.requests = 0;
+	trace.heads = 0;
+	trace.result = NO_REQUEST;
+	trace.input = (mode == PARSE_PRESERVE) ? data : NULL;
+	trace.input_len = len;
+	if (!parser.init(FUZZ_MAX_REQUEST, mode))
+	{
+		abort();
+	}
+
+	size_t next = 0;
+	bool open = true;
+	for (int offset = 0; open && offset < len; )
+	{
+		int space = 0;
+		char* dest = parser.recv_space(space);
+		if (!dest)
+		{
+			trace.result = -1;
+			break;
+		}
+		int n = std::min(pieces[next], std::min(space, len - offset));
+		next = (next + 1 == pieces.size()) ? 0 : next + 1;
+		memcpy(dest, data + offset, n);
+		parser.commit(n);
+		offset += n;
+
+		HTTP_CODE ret = NO_REQUEST;
+		while ((ret = parser.parse()) == GET_REQUEST)
+		{
+			record_request(trace, parser.request);
+			if (!parser.request.keep_alive)
+			{
+				open = false;
+				break;
+			}
+		}
+		if (ret != NO_REQUEST && ret != GET_REQUEST)
+		{
+			trace.result = ret;
+			break;
+		}
+		parser.compact();
+	}
+	parser.release();
+}
+
+/**
+ * @brief: 检查一个向量化扫描器在各种起止位置上都和标量版本一致
+ * @param scanner: 被测的扫描函数
+ * @param data: 输入
+ * @param len: 输入长度
+*/
+static void check_scanner(crlf_scanner scanner, const char* data, int len)
+{
+	/* 从头到尾逐行扫描 */
+	for (int begin = 0; begin <= len; )
+	{
+		int expect = scan_crlf_scalar(data, begin, len);
+		if (scanner(data, begin, len) != expect)
+		{
+			abort();
+		}
+		begin = expect + 1;
+	}
+	/* 起止位置不对齐的短区间，覆盖向量版本处理头尾的代码 */
+	for (int begin = 0; begin < std::min(len, 40); begin++)
+	{
+		for (int end = std::max(begin, len - 40); end <= len; end++)
+		{
+			if (scanner(data, begin, end) != scan_crlf_scalar(data, begin, end))
+			{
+				abort();
+			}
+		}
+	}
+}
+
+/**
+ * @brief: 用另一种分片方式或分析模式再分析一次，结果必须和一次读完时相同
+ * @param name: 这次运行的名字，用于报告
+ * @param data: 输入
+ * @param len: 输入长度
+ * @param pieces: 每次读入的字节数，循环使用
+ * @param mode: 分析模式
+ * @param expect: 一次读完、PARSE_IN_PLACE模式下的分析结果
+*/
+static void compare_run(const char* name, const char* data, int len, const std::vector<int>& pieces, PARSE_MODE mode, const parse_trace& expect)
+{
+	parse_trace trace;
+	run_parser(data, len, pieces, mode, trace);
+	if (trace.summary.value != expect.summary.value || trace.requests != expect.requests || trace.result != expect.result)
+	{
+		fprintf(stderr, "%s: %d requests, result %d; whole: %d requests, result %d\n",
+			name, trace.requests, trace.result, expect.requests, expect.result);
+		abort();
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* input, size_t size)
+{
+	if (size == 0 || size > FUZZ_MAX_INPUT)
+	{
+		return 0;
+	}
+	const char* data = (const char*)input;
+	int len = size;
+
+#ifdef LINE_SCANNER_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		check_scanner(scan_crlf_sse2, data, len);
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		check_scanner(scan_crlf_avx2, data, len);
+	}
+#endif
+
+	/* 随机分片由输入本身决定，同一个输入每次运行的分片方式都相同，libFuzzer才能复现 */
+	std::vector<int> whole(1, len);
+	std::vector<int> one_byte(1, 1);
+	std::vector<int> random;
+	uint64_t seed = len;
+	for (int i = 0; i < len && i < 64; i++)
+	{
+		seed = seed * 31 + input[i];
+	}
+	for (int i = 0; i < 64; i++)
+	{
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		random.push_back(1 + (int)((seed >> 33) % 64));
+	}
+
+	parse_trace expect;
+	run_parser(data, len, whole, PARSE_IN_PLACE, expect);
+	compare_run("1-byte split", data, len, one_byte, PARSE_IN_PLACE, expect);
+	compare_run("random split", data, len, random, PARSE_IN_PLACE, expect);
+	compare_run("preserve", data, len, whole, PARSE_PRESERVE, expect);
+	compare_run("preserve random split", data, len, random, PARSE_PRESERVE, expect);
+	return 0;
+}
+
+#ifndef PARSER_FUZZ_LIBFUZZER
+
+/**
+ * @brief: 读入一个文件
+ * @param path: 文件路径
+ * @param data: 返回文件内容
+ * @return: 读取失败时返回false
+*/
+static bool load_file(const char* path, std::string& data)
+{
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+	{
+		return false;
+	}
+	char buf[4096];
+	size_t n = 0;
+	data.clear();
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+	{
+		data.append(buf, n);
+	}
+	fclose(fp);
+	return true;
+}
+
+/**
+ * @brief: 读入目录中的所有文件作为种子
+ * @param dir: 目录
+ * @param seeds: 读入的文件追加到这里
+ * @return: 不是目录时返回false
+*/
+static bool load_dir(const char* dir, std::vector<std::string>& seeds)
+{
+	DIR* dp = opendir(dir);
+	if (!dp)
+	{
+		return false;
+	}
+	struct dirent* entry = NULL;
+	while ((entry = readdir(dp)) != NULL)
+	{
+		std::string data;
+		if (entry->d_name[0] != '.' && load_file((std::string(dir) + "/" + entry->d_name).c_str(), data))
+		{
+			seeds.push_back(data);
+		}
+	}
+	closedir(dp);
+	return true;
+}
+
+/**
+ * @brief: 对种子做一次随机变异，偏向于HTTP中有意义的字节
+ * @param seeds: 全部种子，用于拼接
+ * @param data: 被变异的数据
+*/
+static void mutate(const std::vector<std::string>& seeds, std::string& data)
+{
+	static const char interesting[] = "\r\n:; \t,0123456789abcdefABCDEF%/?-";
+	int pos = data.empty() ? 0 : rand() % data.size();
+	switch (rand() % 6)
+	{
+	case 0:		// 改写一个字节
+		if (!data.empty())
+		{
+			data[pos] = interesting[rand() % (sizeof(interesting) - 1)];
+		}
+		break;
+	case 1:		// 插入一个字节
+		data.insert(data.begin() + pos, interesting[rand() % (sizeof(interesting) - 1)]);
+		break;
+	case 2:		// 删除一段
+		data.erase(pos, 1 + rand() % 16);
+		break;
+	case 3:		// 复制一段，制造流水线请求和超长的行
+		data.insert(pos, data.substr(rand() % (data.size() + 1), 1 + rand() % 512));
+		break;
+	case 4:		// 接上另一个种子
+		data += seeds[rand() % seeds.size()];
+		break;
+	default:	// 随机字节
+		if (!data.empty())
+		{
+			data[pos] = (char)rand();
+		}
+		break;
+	}
+}
+
+/* 结果已知的请求，主要是请求走私的各种写法 */
+struct known_case
+{
+	const char* name;
+	const char* input;
+	int requests;	// 分析出的完整请求数
+	int result;		// 最后的分析结果
+};
+
+static const known_case known_cases[] = {
+	{"chunked", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n", 1, NO_REQUEST},
+	{"repeated transfer-encoding", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: gzip\r\n\r\n"
+		"3\r\nabc\r\n0\r\n\r\n", 0, BAD_REQUEST},
+	{"repeated chunked", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n",
+		0, BAD_REQUEST},
+	{"chunked not last", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n0\r\n\r\n", 0, BAD_REQUEST},
+	{"transfer-encoding with content-length", "POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n"
+		"0\r\n\r\n", 0, BAD_REQUEST},
+	{"conflicting content-length", "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\nabcd", 0, BAD_REQUEST},
+	{"repeated content-length", "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n\r\nabc", 1, NO_REQUEST},
+	{"empty line between pipelined requests", "POST / HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc\r\n"
+		"GET / HTTP/1.1\r\n\r\n", 2, NO_REQUEST},
+	{"too many empty lines", "\r\n\r\n\r\n\r\n\r\nGET / HTTP/1.1\r\n\r\n", 0, BAD_REQUEST},
+};
+
+/* 检查结果已知的请求，每种分片方式和分析模式都要得到预期的结果 */
+static bool check_known_cases()
+{
+	bool passed = true;
+	for (size_t i = 0; i < sizeof(known_cases) / sizeof(known_cases[0]); i++)
+	{
+		const known_case& c = known_cases[i];
+		int len = strlen(c.input);
+		std::vector<int> whole(1, len);
+		std::vector<int> one_byte(1, 1);
+		for (int k = 0; k < 3; k++)
+		{
+			parse_trace trace;
+			run_parser(c.input, len, (k == 1) ? one_byte : whole, (k == 2) ? PARSE_PRESERVE : PARSE_IN_PLACE, trace);
+			if (trace.requests != c.requests || trace.result != c.result)
+			{
+				printf("%s: %d requests, result %d; expected %d requests, result %d\n",
+					c.name, trace.requests, trace.result, c.requests, c.result);
+				passed = false;
+				break;
+			}
+		}
+	}
+	return passed;
+}
+
+int main(int argc, char* argv[])
+{
+	if (!check_known_cases())
+	{
+		return 1;
+	}
+
+	/* 参数是语料文件或目录，默认使用当前目录下的corpus目录；-n指定变异次数 */
+	std::vector<std::string> seeds;
+	long mutations = FUZZ_MUTATIONS;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+		{
+			mutations = atol(argv[++i]);
+			continue;
+		}
+		std::string data;
+		if (!load_dir(argv[i], seeds) && load_file(argv[i], data))
+		{
+			seeds.push_back(data);
+		}
+	}
+	if (seeds.empty())
+	{
+		load_dir("corpus", seeds);
+	}
+	if (seeds.empty())
+	{
+		printf("usage: %s [-n mutations] [corpus_file_or_dir ...]\n", basename(argv[0]));
+		return 1;
+	}
+
+	for (size_t i = 0; i < seeds.size(); i++)
+	{
+		LLVMFuzzerTestOneInput((const uint8_t*)seeds[i].data(), seeds[i].size());
+	}
+	srand(FUZZ_SEED);
+	for (long i = 0; i < mutations; i++)
+	{
+		std::string data = seeds[rand() % seeds.size()];
+		int rounds = 1 + rand() % 8;
+		for (int k = 0; k < rounds; k++)
+		{
+			mutate(seeds, data);
+		}
+		LLVMFuzzerTestOneInput((const uint8_t*)data.data(), data.size());
+	}
+	printf("%zu seeds and %ld mutations passed\n", seeds.size(), mutations);
+	return 0;
+}
+
+#endif  // PARSER_FUZZ_LIBFUZZER
@@ -0,0 +1,137 @@
+#ifndef IDLE_TIMER_H
+#define IDLE_TIMER_H
+
+#include <stdio.h>
+#include <time.h>
+
+/* 空闲连接的定时器，结构与11-2lst_timer.h中的util_timer相同 */
+class idle_timer
+{
+public:
+	idle_timer() : expire(0), cb_func(NULL), user_data(NULL), prev(NULL), next(NULL) {}
+
+public:
+	time_t expire;				// 任务的超时时间，这里使用绝对时间
+	void (*cb_func)(void*);		// 任务回调函数
+	void* user_data;			// 回调函数处理的连接
+	idle_timer* prev;			// 指向前一个定时器
+	idle_timer* next;			// 指向后一个定时器
+};
+
+/* 空闲连接定时器链表。它和sort_timer_lst一样是一个升序、双向链表，tick的逻辑也相同。
+	不同的是所有连接的空闲超时时间都一样长，新加入或刚刚活跃过的定时器的超时时间总是最晚的，
+	所以add_timer和adjust_timer直接把它放到链表尾部，不需要从头遍历寻找位置：
+	sort_timer_lst在上万个连接上每次收到数据都要走一遍链表，这里都是O(1)
+*/
+class idle_timer_lst
+{
+public:
+	idle_timer_lst() : head(NULL), tail(NULL), count(0) {}
+
+	/* 析构函数，链表被销毁时，删除其中所有的定时器 */
+	~idle_timer_lst()
+	{
+		idle_timer* tmp = head;
+		while (tmp)
+		{
+			head = tmp->next;
+			delete tmp;
+			tmp = head;
+		}
+	}
+
+	/* 将目标定时器timer添加到链表尾部，它的超时时间必须不早于链表中的任何定时器 */
+	void add_timer(idle_timer* timer)
+	{
+		if (!timer)
+		{
+			return;
+		}
+		timer->prev = tail;
+		timer->next = NULL;
+		if (tail)
+		{
+			tail->next = timer;
+		}
+		else
+		{
+			head = timer;
+		}
+		tail = timer;
+		count++;
+	}
+
+	/* 连接有了新的活动，把定时器的超时时间延长到expire并移到链表尾部 */
+	void adjust_timer(idle_timer* timer, time_t expire)
+	{
+		if (!timer)
+		{
+			return;
+		}
+		timer->expire = expire;
+		if (timer == tail)
+		{
+			return;
+		}
+		unlink(timer);
+		add_timer(timer);
+	}
+
+	/* 将目标定时器timer从链表中删除 */
+	void del_timer(idle_timer* timer)
+	{
+		if (!timer)
+		{
+			return;
+		}
+		unlink(timer);
+		delete timer;
+	}
+
+	/* 每隔一段时间执行一次，处理链表上到期的任务。回调函数负责关闭连接，但不能删除定时器 */
+	void tick()
+	{
+		time_t cur = time(NULL);
+		while (head && head->expire <= cur)
+		{
+			idle_timer* tmp = head;
+			unlink(tmp);
+			tmp->cb_func(tmp->user_data);
+			delete tmp;
+		}
+	}
+
+	/* 链表中的定时器个数，即当前的连接数 */
+	int size() const { return count; }
+
+private:
+	/* 把定时器从链表中取下，但不删除它 */
+	void unlink(idle_timer* timer)
+	{
+		if (timer->prev)
+		{
+			timer->prev->next = timer->next;
+		}
+		else
+		{
+			head = timer->next;
+		}
+		if (timer->next)
+		{
+			timer->next->prev = timer->prev;
+		}
+		else
+		{
+			tail = timer->prev;
+		}
+		timer->prev = timer->next = NULL;
+		count--;
+	}
+
+private:
+	idle_timer* head;
+	idle_timer* tail;
+	int count;
+};
+
+#endif  // IDLE_TIMER_H
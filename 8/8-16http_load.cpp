@@ -0,0 +1,299 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define MAX_EVENT_NUMBER 1024
+#define RESPONSE_BUFFER 4096	// 每个连接的应答头部缓冲区，报文不保存
+#define CONNECT_TIMEOUT 10		// 建立全部连接的最长时间（秒）
+
+/* 一个客户连接：按流水线深度发送请求，逐个解析应答 */
+struct load_conn
+{
+	int sockfd;
+	bool connected;
+	int inflight;				// 已发送但还没有收到应答的请求数
+	int send_offset;			// 当前请求已发送的字节数，0表示没有发送中的请求
+	char buf[RESPONSE_BUFFER];	// 尚未解析完的应答头部
+	int buf_len;
+	long long body_remaining;	// 当前应答中尚未收到的报文字节数，-1表示正在读取头部
+};
+
+static const char* request_fmt = "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n";
+static char request[1024];
+static int request_len = 0;
+static long long completed = 0;	// 收到的完整应答数
+static long long errors = 0;	// 出错而关闭的连接数
+
+/**
+ * @brief: 将文件描述符fd设置成非阻塞的
+ * @param fd: 文件描述符fd
+ * @return: 文件描述符fd原来的状态标志
+*/
+int setnonblocking(int fd)
+{
+	int old_option = fcntl(fd, F_GETFL);
+	int new_option = old_option | O_NONBLOCK;
+	fcntl(fd, F_SETFL, new_option);
+	return old_option;
+}
+
+/**
+ * @brief: 获取单调时钟的当前时间
+ * @return: 毫秒数
+*/
+static long long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief: 尽量多地发送请求，直到在途请求数达到流水线深度或者socket写缓冲区已满
+ * @param conn: 连接
+ * @param depth: 流水线深度
+ * @return: 出错时返回false
+*/
+static bool send_requests(load_conn* conn, int depth)
+{
+	while (conn->send_offset > 0 || conn->inflight < depth)
+	{
+		int ret = send(conn->sockfd, request + conn->send_offset, request_len - conn->send_offset, 0);
+		if (ret < 0)
+		{
+			return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+		}
+		if (conn->send_offset == 0)
+		{
+			conn->inflight++;
+		}
+		conn->send_offset += ret;
+		if (conn->send_offset == request_len)
+		{
+			conn->send_offset = 0;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief: 解析缓冲区中的应答头部，取出Content-Length
+ * @param conn: 连接
+ * @return: 头部不完整时返回0，完整时返回头部长度，格式错误时返回-1
+*/
+static int parse_response_head(load_conn* conn)
+{
+	conn->buf[conn->buf_len] = '\0';
+	char* end = strstr(conn->buf, "\r\n\r\n");
+	if (!end)
+	{
+		return (conn->buf_len >= RESPONSE_BUFFER - 1) ? -1 : 0;
+	}
+	if (strncmp(conn->buf, "HTTP/1.1 200", 12) != 0)
+	{
+		return -1;
+	}
+	conn->body_remaining = 0;
+	for (char* line = strstr(conn->buf, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n"))
+	{
+		if (strncasecmp(line + 2, "Content-Length:", 15) == 0)
+		{
+			conn->body_remaining = atoll(line + 17);
+		}
+	}
+	return end + 4 - conn->buf;
+}
+
+/**
+ * @brief: 读取并解析应答，报文只计数不保存
+ * @param conn: 连接
+ * @return: 出错或服务器关闭连接时返回false
+*/
+static bool read_responses(load_conn* conn)
+{
+	while (1)
+	{
+		int ret = recv(conn->sockfd, conn->buf + conn->buf_len, RESPONSE_BUFFER - 1 - conn->buf_len, 0);
+		if (ret < 0)
+		{
+			return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+		}
+		if (ret == 0)
+		{
+			return false;
+		}
+		conn->buf_len += ret;
+		int pos = 0;
+		while (pos < conn->buf_len)
+		{
+			if (conn->body_remaining < 0)	// 读取头部
+			{
+				memmove(conn->buf, conn->buf + pos, conn->buf_len - pos);
+				conn->buf_len -= pos;
+				pos = 0;
+				int head = parse_response_head(conn);
+				if (head < 0)
+				{
+					return false;
+				}
+				if (head == 0)
+				{
+					break;
+				}
+				pos = head;
+			}
+			long long n = conn->buf_len - pos;
+			if (n > conn->body_remaining)
+			{
+				n = conn->body_remaining;
+			}
+			pos += n;
+			conn->body_remaining -= n;
+			if (conn->body_remaining == 0)	// 一个完整的应答
+			{
+				conn->body_remaining = -1;
+				conn->inflight--;
+				completed++;
+			}
+		}
+		if (pos == conn->buf_len)
+		{
+			conn->buf_len = 0;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc <= 4)
+	{
+		printf("usage: %s ip_address port_number connections seconds [pipeline_depth] [url]\n", basename(argv[0]));
+		return 1;
+	}
+	const char* ip = argv[1];
+	int port = atoi(argv[2]);
+	int connections = atoi(argv[3]);
+	int seconds = atoi(argv[4]);
+	int depth = (argc > 5) ? atoi(argv[5]) : 1;
+	const char* url = (argc > 6) ? argv[6] : "/";
+	request_len = snprintf(request, sizeof(request), request_fmt, url, ip);
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sockaddr_in address;
+	bzero(&address, sizeof(address));
+	address.sin_family = AF_INET;
+	inet_pton(AF_INET, ip, &address.sin_addr);
+	address.sin_port = htons(port);
+
+	int epollfd = epoll_create(5);
+	assert(epollfd != -1);
+	load_conn* conns = new load_conn[connections];
+	int opened = 0;
+	for (int i = 0; i < connections; i++)
+	{
+		load_conn* conn = &conns[i];
+		memset(conn, 0, sizeof(*conn));
+		conn->body_remaining = -1;
+		conn->sockfd = socket(PF_INET, SOCK_STREAM, 0);
+		if (conn->sockfd < 0)
+		{
+			printf("socket failed after %d connections, errno is: %d\n", i, errno);
+			break;
+		}
+		setnonblocking(conn->sockfd);
+		int ret = connect(conn->sockfd, (struct sockaddr*)&address, sizeof(address));
+		if (ret < 0 && errno != EINPROGRESS)
+		{
+			printf("connect failed, errno is: %d\n", errno);
+			close(conn->sockfd);
+			break;
+		}
+		epoll_event event;
+		event.data.ptr = conn;
+		event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		epoll_ctl(epollfd, EPOLL_CTL_ADD, conn->sockfd, &event);
+		opened++;
+	}
+
+	/* 先等所有连接建立起来，再开始计时发送请求 */
+	epoll_event events[MAX_EVENT_NUMBER];
+	int established = 0;
+	long long deadline = now_ms() + CONNECT_TIMEOUT * 1000;
+	while (established < opened && now_ms() < deadline)
+	{
+		int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, 100);
+		for (int i = 0; i < number; i++)
+		{
+			load_conn* conn = (load_conn*)events[i].data.ptr;
+			if (!conn->connected && (events[i].events & EPOLLOUT) && !(events[i].events & EPOLLERR))
+			{
+				conn->connected = true;
+				established++;
+			}
+		}
+	}
+	printf("%d of %d connections established\n", established, connections);
+
+	long long start = now_ms();
+	for (int i = 0; i < opened; i++)
+	{
+		if (conns[i].connected && !send_requests(&conns[i], depth))
+		{
+			errors++;
+		}
+	}
+	long long end = start + seconds * 1000LL;
+	while (now_ms() < end)
+	{
+		int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, 100);
+		for (int i = 0; i < number; i++)
+		{
+			load_conn* conn = (load_conn*)events[i].data.ptr;
+			if (!conn->connected || conn->sockfd < 0)
+			{
+				continue;
+			}
+			/* 收到应答后立即补发请求，保持每个连接上有depth个在途请求 */
+			if (!read_responses(conn) || !send_requests(conn, depth))
+			{
+				epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->sockfd, 0);
+				close(conn->sockfd);
+				conn->sockfd = -1;
+				errors++;
+			}
+		}
+	}
+	double elapsed = (now_ms() - start) / 1000.0;
+	printf("%lld requests in %.1fs, %.0f requests/s, %lld failed connections\n",
+		completed, elapsed, completed / elapsed, errors);
+
+	for (int i = 0; i < opened; i++)
+	{
+		if (conns[i].sockfd >= 0)
+		{
+			close(conns[i].sockfd);
+		}
+	}
+	delete[] conns;
+	close(epollfd);
+	return 0;
+}
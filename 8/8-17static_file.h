@@ -0,0 +1,963 @@
+#ifndef STATIC_FILE_H
+#define STATIC_FILE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits>
+#include "8-12http_parser.h"
+#include "8-18response_header.h"
+#include "8-22file_cache.h"
+#include "8-24mmap_cache.h"
+#include "8-25file_transfer.h"
+
+#define MMAP_FILE_SIZE (256 * 1024)	// 不超过这个大小的文件使用缓存的映射，与头部一起用一次writev发出；更大的文件用sendfile发送
+#define SMALL_FILE_SIZE (16 * 1024)	// 不能映射时，不超过这个大小的文件（或范围）读入内存
+#define RESPONSE_HEADER_SIZE 512	// 应答头部缓冲区的大小
+#define FILENAME_LEN 1024			// 文件路径的最大长度
+#define MAX_RESPONSE_IOV 64			// 一次writev最多合并的内存块数
+#define FLUSH_BUDGET (1024 * 1024)	// 一个连接每次被调度时最多写出的字节数
+
+/* 发送的结果 */
+enum SEND_STATUS {
+	SEND_DONE = 0,		// 所有应答都已交给内核
+	SEND_AGAIN,			// socket写缓冲区已满，需要等待EPOLLOUT后继续
+	SEND_YIELD,			// 本次的额度已经用完，socket仍然可写，应当让其他连接先运行，之后再继续
+	SEND_ERROR			// 写出错，连接应当关闭
+};
+
+/* 应答状态码、事先序列化好的状态行，以及出错时发给客户的报文 */
+struct http_status
+{
+	int code;
+	header_literal line;
+	const char* form;
+};
+
+#define STATUS_LINE(code, title) HEADER_LITERAL("HTTP/1.1 " #code " " title "\r\n")
+
+static const http_status http_statuses[] = {
+	{ 200, STATUS_LINE(200, "OK"), NULL },
+	{ 201, STATUS_LINE(201, "Created"), NULL },
+	{ 206, STATUS_LINE(206, "Partial Content"), NULL },
+	{ 304, STATUS_LINE(304, "Not Modified"), NULL },
+	{ 400, STATUS_LINE(400, "Bad Request"), "Your request has bad syntax or is inherently impossible to satisfy.\n" },
+	{ 403, STATUS_LINE(403, "Forbidden"), "You do not have permission to get file from this server.\n" },
+	{ 404, STATUS_LINE(404, "Not Found"), "The requested file was not found on this server.\n" },
+	{ 405, STATUS_LINE(405, "Method Not Allowed"), "The requested method is not allowed for this resource.\n" },
+	{ 408, STATUS_LINE(408, "Request Timeout"), "The request header was not received in time.\n" },
+	{ 416, STATUS_LINE(416, "Range Not Satisfiable"), "The requested range is not satisfiable.\n" },
+	{ 431, STATUS_LINE(431, "Request Header Fields Too Large"), "The request header is too large.\n" },
+	{ 507, STATUS_LINE(507, "Insufficient Storage"), "There is not enough space to store the uploaded file.\n" },
+	{ 500, STATUS_LINE(500, "Internal Error"), "There was an unusual problem serving the requested file.\n" }
+};
+
+/**
+ * @brief: 查找状态码对应的描述，未知的状态码按500处理
+ * @param code: 状态码
+ * @return: 状态码描述
+*/
+inline const http_status& find_status(int code)
+{
+	int count = sizeof(http_statuses) / sizeof(http_statuses[0]);
+	for (int i = 0; i < count; i++)
+	{
+		if (http_statuses[i].code == code)
+		{
+			return http_statuses[i];
+		}
+	}
+	return http_statuses[count - 1];
+}
+
+/* 文件扩展名与Content-Type头部的对应关系，头部整行事先序列化好 */
+struct mime_type
+{
+	const char* ext;
+	header_literal content_type;
+};
+
+#define CONTENT_TYPE(type) HEADER_LITERAL("Content-Type: " type "\r\n")
+
+static const mime_type mime_types[] = {
+	{ "html", CONTENT_TYPE("text/html; charset=utf-8") }, { "htm", CONTENT_TYPE("text/html; charset=utf-8") },
+	{ "css", CONTENT_TYPE("text/css") }, { "js", CONTENT_TYPE("application/javascript") }, { "json", CONTENT_TYPE("application/json") },
+	{ "txt", CONTENT_TYPE("text/plain; charset=utf-8") }, { "xml", CONTENT_TYPE("application/xml") }, { "svg", CONTENT_TYPE("image/svg+xml") },
+	{ "png", CONTENT_TYPE("image/png") }, { "jpg", CONTENT_TYPE("image/jpeg") }, { "jpeg", CONTENT_TYPE("image/jpeg") }, { "gif", CONTENT_TYPE("image/gif") },
+	{ "ico", CONTENT_TYPE("image/x-icon") }, { "webp", CONTENT_TYPE("image/webp") }, { "woff2", CONTENT_TYPE("font/woff2") },
+	{ "pdf", CONTENT_TYPE("application/pdf") }, { "mp4", CONTENT_TYPE("video/mp4") }
+};
+
+static const header_literal CONTENT_TYPE_DEFAULT = CONTENT_TYPE("application/octet-stream");
+static const header_literal CONTENT_TYPE_TEXT = CONTENT_TYPE("text/plain; charset=utf-8");
+static const header_literal ACCEPT_RANGES = HEADER_LITERAL("Accept-Ranges: bytes\r\n");
+static const header_literal VARY_ACCEPT_ENCODING = HEADER_LITERAL("Vary: Accept-Encoding\r\n");
+
+/* 预先压缩好的兄弟文件：Accept-Encoding中的编码名、文件名后缀和Content-Encoding头部。按优先顺序排列，br通常比gzip更小 */
+struct content_coding
+{
+	const char* token;
+	const char* suffix;
+	header_literal header;
+};
+
+static const content_coding content_codings[] = {
+	{ "br", ".br", HEADER_LITERAL("Content-Encoding: br\r\n") },
+	{ "gzip", ".gz", HEADER_LITERAL("Content-Encoding: gzip\r\n") }
+};
+
+/**
+ * @brief: 根据文件扩展名确定Content-Type头部
+ * @param path: 文件路径
+ * @return: Content-Type头部，未知的扩展名返回application/octet-stream
+*/
+inline const header_literal& find_mime_type(const char* path)
+{
+	const char* dot = strrchr(path, '.');
+	if (dot && !strchr(dot, '/'))
+	{
+		for (unsigned int i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++)
+		{
+			if (strcasecmp(dot + 1, mime_types[i].ext) == 0)
+			{
+				return mime_types[i].content_type;
+			}
+		}
+	}
+	return CONTENT_TYPE_DEFAULT;
+}
+
+/* 一个待发送的应答：头部和内存中的报文用writev发送，文件报文随后由file用sendfile发送。
+	sent和file记录已经发出的位置，任何一次写只写出一部分，下次都从这里继续
+*/
+struct http_response
+{
+	http_response* next;		// 同一连接上的下一个流水线应答
+	char header[RESPONSE_HEADER_SIZE];	// 状态行、头部字段和空行
+	int header_len;
+	const char* body;			// 内存中的报文：小文件的内容或出错信息
+	int body_len;
+	bool body_owned;			// body是否由本应答申请，需要释放
+	mapped_file* mapping;		// body所在的文件映射，应答删除时释放引用
+	sendfile_transfer file;		// 用sendfile发送的文件报文
+	int sent;					// 头部和内存报文中已经发出的字节数
+	bool keep_alive;			// 发完之后是否保持连接
+	bool header_overflow;		// 头部超出了缓冲区，已经被截断，不能发送
+
+	http_response() : next(NULL), header_len(0), body(NULL), body_len(0), body_owned(false), mapping(NULL),
+		sent(0), keep_alive(true), header_overflow(false) {}
+
+	~http_response()
+	{
+		if (body_owned)
+		{
+			free((void*)body);
+		}
+		if (mapping)
+		{
+			mapping->owner->release(mapping);
+		}
+	}
+
+	/* 头部和内存报文的总长度 */
+	int memory_len() const { return header_len + body_len; }
+};
+
+/**
+ * @brief: 把生成器写入的头部计入应答，空间不够时记下溢出，由response_queue::push检查
+ * @param response: 应答
+ * @param builder: 在应答头部缓冲区上工作的生成器
+*/
+inline void commit_headers(http_response* response, const header_builder& builder)
+{
+	response->header_len += builder.length();
+	if (!builder.ok())
+	{
+		response->header_overflow = true;
+	}
+}
+
+/**
+ * @brief: 生成状态行、Date和Connection，它们都是事先序列化好的整行，Date由事件循环每秒更新
+ * @param response: 应答
+ * @param code: 状态码
+*/
+inline void begin_headers(http_response* response, int code)
+{
+	header_builder builder(response->header + response->header_len, RESPONSE_HEADER_SIZE - response->header_len);
+	builder.append(find_status(code).line);
+	builder.append_date();
+	builder.append(response->keep_alive ? CONNECTION_KEEP_ALIVE : CONNECTION_CLOSE);
+	commit_headers(response, builder);
+}
+
+/**
+ * @brief: 生成状态行和公共头部字段，之后还可以追加其他头部，最后由end_headers结束
+ * @param response: 应答
+ * @param code: 状态码
+ * @param content_type: Content-Type头部
+ * @param content_length: 报文长度
+*/
+inline void add_status_headers(http_response* response, int code, const header_literal& content_type, long long content_length)
+{
+	begin_headers(response, code);
+	header_builder builder(response->header + response->header_len, RESPONSE_HEADER_SIZE - response->header_len);
+	builder.append(content_type);
+	builder.append("Content-Length: ", 16);
+	builder.append_uint(content_length);
+	builder.append(CRLF);
+	commit_headers(response, builder);
+}
+
+/* 追加结束头部的空行 */
+inline void end_headers(http_response* response)
+{
+	header_builder builder(response->header + response->header_len, RESPONSE_HEADER_SIZE - response->header_len);
+	builder.append(CRLF);
+	commit_headers(response, builder);
+}
+
+/**
+ * @brief: 生成出错应答，报文是内置的出错信息
+ * @param code: 状态码
+ * @param keep_alive: 发完之后是否保持连接
+ * @param head_only: 是否只发送头部（HEAD请求）
+ * @return: 应答
+*/
+inline http_response* make_error_response(int code, bool keep_alive, bool head_only)
+{
+	http_response* response = new http_response;
+	const http_status& status = find_status(code);
+	response->keep_alive = keep_alive;
+	add_status_headers(response, status.code, CONTENT_TYPE_TEXT, strlen(status.form));
+	end_headers(response);
+	if (!head_only)
+	{
+		response->body = status.form;
+		response->body_len = strlen(status.form);
+	}
+	return response;
+}
+
+/**
+ * @brief: 生成报文在内存中的应答，供路由处理函数使用
+ * @param code: 状态码
+ * @param content_type: Content-Type头部
+ * @param body: 用malloc申请的报文，由应答负责释放；为NULL时表示生成报文失败，返回500
+ * @param len: 报文长度
+ * @param keep_alive: 发完之后是否保持连接
+ * @param head_only: 是否只发送头部（HEAD请求）
+ * @return: 应答
+*/
+inline http_response* make_memory_response(int code, const header_literal& content_type, char* body, int len, bool keep_alive, bool head_only)
+{
+	if (!body)
+	{
+		return make_error_response(500, keep_alive, head_only);
+	}
+	http_response* response = new http_response;
+	response->keep_alive = keep_alive;
+	add_status_headers(response, code, content_type, len);
+	end_headers(response);
+	response->body = body;
+	response->body_len = head_only ? 0 : len;
+	response->body_owned = true;
+	return response;
+}
+
+/**
+ * @brief: 把URL映射到文档根目录下的文件路径。只取URL的路径部分，逐段复制时去掉空段和"."段，
+ *		使同一个文件只有一种写法（文件元数据缓存以路径为键），拒绝含有".."段的路径，以'/'结尾时补上index.html
+ * @param doc_root: 文档根目录
+ * @param url: 请求的URL，以'/'开头，不必以'\0'结尾
+ * @param url_len: URL的长度
+ * @param path: 返回文件路径
+ * @return: 映射失败时返回false
+*/
+inline bool map_url(const char* doc_root, const char* url, int url_len, char* path)
+{
+	int len = strlen(doc_root);
+	while (len > 0 && doc_root[len - 1] == '/')
+	{
+		len--;
+	}
+	if (len >= FILENAME_LEN)
+	{
+		return false;
+	}
+	memcpy(path, doc_root, len);
+
+	const char* end = url + url_path_len(url, url_len);
+	for (const char* p = url; p < end;)
+	{
+		const char* segment = p + 1;	// p指向'/'
+		const char* segment_end = (const char*)memchr(segment, '/', end - segment);
+		if (!segment_end)
+		{
+			segment_end = end;
+		}
+		int n = segment_end - segment;
+		if (n == 2 && segment[0] == '.' && segment[1] == '.')
+		{
+			return false;
+		}
+		if (n > 0 && !(n == 1 && segment[0] == '.'))
+		{
+			if (len + 1 + n >= FILENAME_LEN)
+			{
+				return false;
+			}
+			path[len++] = '/';
+			memcpy(path + len, segment, n);
+			len += n;
+		}
+		p = segment_end;
+	}
+	int n = snprintf(path + len, FILENAME_LEN - len, "%s", (end[-1] == '/') ? "/index.html" : "");
+	return n < FILENAME_LEN - len;
+}
+
+/**
+ * @brief: 读入小文件中的一段
+ * @param fd: 文件
+ * @param offset: 起始位置
+ * @param size: 长度
+ * @return: 文件内容，由调用者free，读取失败时返回NULL
+*/
+inline char* read_small_file(int fd, off_t offset, int size)
+{
+	char* buf = (char*)malloc(size > 0 ? size : 1);
+	int done = 0;
+	while (buf && done < size)
+	{
+		ssize_t ret = pread(fd, buf + done, size - done, offset + done);
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (ret <= 0)	// 出错，或者文件在stat之后被截短了
+		{
+			free(buf);
+			return NULL;
+		}
+		done += ret;
+	}
+	return buf;
+}
+
+/**
+ * @brief: 检查Accept-Encoding中一项的参数里有没有q=0
+ * @param p: 编码名之后的位置
+ * @param end: 这一项的结尾
+ * @return: 没有q参数，或者q大于0时返回true
+*/
+inline bool qvalue_positive(const char* p, const char* end)
+{
+	while (p < end)
+	{
+		if (*p++ != ';')
+		{
+			continue;
+		}
+		while (p < end && (*p == ' ' || *p == '\t'))
+		{
+			p++;
+		}
+		if (end - p >= 2 && (*p == 'q' || *p == 'Q') && p[1] == '=')
+		{
+			for (p += 2; p < end && (*p == '0' || *p == '.'); p++)
+			{
+			}
+			return p < end && *p >= '1' && *p <= '9';
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief: 检查客户端是否接受一种内容编码。编码名不区分大小写，明确列出的编码优先于"*"
+ * @param value: Accept-Encoding的值
+ * @param len: 值的长度
+ * @param token: 编码名
+ * @return: 接受时返回true
+*/
+inline bool accepts_coding(const char* value, int len, const char* token)
+{
+	int token_len = strlen(token);
+	const char* end = value + len;
+	bool any = false;	// "*"是否接受其他编码
+	for (const char* p = value; p < end;)
+	{
+		const char* item_end = (const char*)memchr(p, ',', end - p);
+		if (!item_end)
+		{
+			item_end = end;
+		}
+		while (p < item_end && (*p == ' ' || *p == '\t'))
+		{
+			p++;
+		}
+		const char* name_end = p;
+		while (name_end < item_end && *name_end != ';' && *name_end != ' ' && *name_end != '\t')
+		{
+			name_end++;
+		}
+		if (name_end - p == token_len && strncasecmp(p, token, token_len) == 0)
+		{
+			return qvalue_positive(name_end, item_end);
+		}
+		if (name_end - p == 1 && *p == '*')
+		{
+			any = qvalue_positive(name_end, item_end);
+		}
+		p = item_end + 1;
+	}
+	return any;
+}
+
+/**
+ * @brief: 查找文件的预先压缩好的兄弟文件（file.br、file.gz），运行时不做任何压缩。
+ *		兄弟文件必须是所有人可读的普通文件，并且不比原文件旧，以免发出部署时忘了重新压缩的旧内容
+ * @param request: 请求
+ * @param files: 文件元数据缓存，不存在的兄弟文件也在缓存之中，大部分请求不需要额外的stat
+ * @param path: 原文件的路径，选中兄弟文件时改为兄弟文件的路径
+ * @param meta: 原文件的元数据，选中兄弟文件时改为兄弟文件的元数据，ETag带上编码，此后ETag、范围等都针对压缩后的内容
+ * @param vary: 返回是否存在可用的兄弟文件，存在时应答随Accept-Encoding变化，要发送Vary头部
+ * @return: 选中的编码，客户端不接受任何可用的编码时返回NULL
+*/
+inline const content_coding* select_precompressed(const http_request& request, file_meta_cache& files, char* path, file_meta& meta, bool& vary)
+{
+	vary = false;
+	int len = strlen(path);
+	const header_entry* accept = request.headers.get(HEADER_ACCEPT_ENCODING);
+	for (unsigned int i = 0; i < sizeof(content_codings) / sizeof(content_codings[0]); i++)
+	{
+		const content_coding& coding = content_codings[i];
+		if (len + 3 >= FILENAME_LEN)
+		{
+			break;
+		}
+		memcpy(path + len, coding.suffix, 4);
+		file_meta sibling;
+		if (files.lookup(path, sibling) != 0 || !S_ISREG(sibling.mode) || !(sibling.mode & S_IROTH) || sibling.mtime_ns < meta.mtime_ns)
+		{
+			continue;
+		}
+		vary = true;
+		if (accept && accepts_coding(accept->value, accept->value_len, coding.token))
+		{
+			/* gzip -k等工具保留原文件的修改时间，大小也可能碰巧相同，ETag中加上编码（"…-gz"），
+				压缩后的内容不会和原文件有相同的强ETag，条件请求不会用304确认另一种表示 */
+			meta = sibling;
+			meta.etag_len = snprintf(meta.etag + meta.etag_len - 1, ETAG_LEN - meta.etag_len + 1, "-%s\"", coding.suffix + 1) + meta.etag_len - 1;
+			return &coding;
+		}
+	}
+	path[len] = '\0';
+	return NULL;
+}
+
+/**
+ * @brief: 检查一个实体标签列表（If-None-Match或If-Range的值）中有没有与ETag相同的标签
+ * @param value: 字段值
+ * @param len: 字段值的长度
+ * @param etag: 文件的强ETag，带引号
+ * @param etag_len: ETag的长度
+ * @param weak: 是否用弱比较，即忽略标签的"W/"前缀；强比较时弱标签总是不相同
+ * @return: 有相同的标签，或者值为"*"时返回true；格式错误时返回false
+*/
+inline bool match_etag(const char* value, int len, const char* etag, int etag_len, bool weak)
+{
+	const char* end = value + len;
+	if (len == 1 && value[0] == '*')
+	{
+		return true;
+	}
+	for (const char* p = value; p < end;)
+	{
+		if (*p == ' ' || *p == '\t' || *p == ',')
+		{
+			p++;
+			continue;
+		}
+		bool is_weak = (end - p >= 2) && p[0] == 'W' && p[1] == '/';
+		if (is_weak)
+		{
+			p += 2;
+		}
+		const char* close = (p < end && *p == '"') ? (const char*)memchr(p + 1, '"', end - p - 1) : NULL;
+		if (!close)
+		{
+			return false;
+		}
+		close++;
+		if ((weak || !is_weak) && close - p == etag_len && memcmp(p, etag, etag_len) == 0)
+		{
+			return true;
+		}
+		p = close;
+	}
+	return false;
+}
+
+/**
+ * @brief: 按RFC 7232的顺序检查条件请求：有If-None-Match时只看它，否则看If-Modified-Since
+ * @param request: GET或HEAD请求
+ * @param meta: 文件的元数据
+ * @return: 客户端缓存的副本仍然有效，应当返回304时返回true
+*/
+inline bool not_modified(const http_request& request, const file_meta& meta)
+{
+	const header_entry* none_match = request.headers.get(HEADER_IF_NONE_MATCH);
+	if (none_match)
+	{
+		return match_etag(none_match->value, none_match->value_len, meta.etag, meta.etag_len, true);
+	}
+	const header_entry* since = request.headers.get(HEADER_IF_MODIFIED_SINCE);
+	time_t t;
+	return since && parse_http_date(since->value, since->value_len, t) && meta.mtime <= t;
+}
+
+/* Range头部的分析结果 */
+enum RANGE_STATUS {
+	RANGE_NONE = 0,		// 没有Range头部，或者它不适用（格式错误、多个范围、If-Range不满足），发送整个文件
+	RANGE_OK,			// 一个可以满足的范围
+	RANGE_UNSATISFIABLE	// 范围在文件之外，返回416
+};
+
+/**
+ * @brief: 解析十进制的字节位置
+ * @param p: 数字的起始位置，返回数字之后的位置
+ * @param end: 字段值的结尾
+ * @param value: 返回数值
+ * @return: 没有数字或者溢出时返回false
+*/
+inline bool parse_byte_pos(const char*& p, const char* end, off_t& value)
+{
+	const char* start = p;
+	value = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		if (value > (std::numeric_limits<off_t>::max() - 9) / 10)	// 这么大的位置不会在文件之内，按格式错误忽略
+		{
+			return false;
+		}
+		value = value * 10 + (*p - '0');
+	}
+	return p > start;
+}
+
+/**
+ * @brief: 分析GET请求的Range和If-Range头部。只支持一个字节范围，多个范围时发送整个文件，这是RFC 7233允许的
+ * @param request: GET请求
+ * @param meta: 文件的元数据
+ * @param first: 返回范围的第一个字节
+ * @param last: 返回范围的最后一个字节
+ * @return: RANGE_STATUS
+*/
+inline RANGE_STATUS parse_range(const http_request& request, const file_meta& meta, off_t& first, off_t& last)
+{
+	const header_entry* range = request.headers.get(HEADER_RANGE);
+	if (!range || range->value_len < 6 || strncasecmp(range->value, "bytes=", 6) != 0)
+	{
+		return RANGE_NONE;
+	}
+	/* If-Range是一个强ETag或者Last-Modified的日期，文件已经变了时忽略Range，发送整个新文件 */
+	const header_entry* if_range = request.headers.get(HEADER_IF_RANGE);
+	if (if_range && !((if_range->value_len == HTTP_DATE_LEN && memcmp(if_range->value, meta.last_modified, HTTP_DATE_LEN) == 0)
+		|| (if_range->value[0] == '"' && match_etag(if_range->value, if_range->value_len, meta.etag, meta.etag_len, false))))
+	{
+		return RANGE_NONE;
+	}
+
+	const char* p = range->value + 6;
+	const char* end = range->value + range->value_len;
+	off_t start = -1;
+	off_t stop = -1;
+	if (p < end && *p != '-' && !parse_byte_pos(p, end, start))
+	{
+		return RANGE_NONE;
+	}
+	if (p == end || *p++ != '-')
+	{
+		return RANGE_NONE;
+	}
+	if (p < end && !parse_byte_pos(p, end, stop))
+	{
+		return RANGE_NONE;
+	}
+	if (p != end || (start < 0 && stop < 0) || (start >= 0 && stop >= 0 && stop < start))
+	{
+		return RANGE_NONE;	// 格式错误或者多个范围
+	}
+
+	if (start < 0)	// "-n"：最后n个字节
+	{
+		if (stop == 0 || meta.size == 0)
+		{
+			return RANGE_UNSATISFIABLE;
+		}
+		first = (stop < meta.size) ? meta.size - stop : 0;
+		last = meta.size - 1;
+		return RANGE_OK;
+	}
+	if (start >= meta.size)
+	{
+		return RANGE_UNSATISFIABLE;
+	}
+	first = start;
+	last = (stop >= 0 && stop < meta.size) ? stop : meta.size - 1;
+	return RANGE_OK;
+}
+
+/**
+ * @brief: 追加内容协商、验证器和Accept-Ranges头部
+ * @param response: 应答
+ * @param meta: 所发送文件的元数据
+ * @param coding: 预先压缩的编码，没有时为NULL
+ * @param vary: 是否发送Vary: Accept-Encoding
+*/
+inline void add_file_headers(http_response* response, const file_meta& meta, const content_coding* coding, bool vary)
+{
+	header_builder builder(response->header + response->header_len, RESPONSE_HEADER_SIZE - response->header_len);
+	if (coding)
+	{
+		builder.append(coding->header);
+	}
+	if (vary)
+	{
+		builder.append(VARY_ACCEPT_ENCODING);
+	}
+	builder.append("ETag: ", 6);
+	builder.append(meta.etag, meta.etag_len);
+	builder.append(CRLF);
+	builder.append("Last-Modified: ", 15);
+	builder.append(meta.last_modified, HTTP_DATE_LEN);
+	builder.append(CRLF);
+	builder.append(ACCEPT_RANGES);
+	commit_headers(response, builder);
+}
+
+/**
+ * @brief: 追加Content-Range头部
+ * @param response: 应答
+ * @param first: 范围的第一个字节，为-1时表示范围无法满足，这时范围部分写成"*"
+ * @param last: 范围的最后一个字节
+ * @param size: 文件大小
+*/
+inline void add_content_range(http_response* response, off_t first, off_t last, off_t size)
+{
+	header_builder builder(response->header + response->header_len, RESPONSE_HEADER_SIZE - response->header_len);
+	builder.append("Content-Range: bytes ", 21);
+	if (first < 0)
+	{
+		builder.append("*", 1);
+	}
+	else
+	{
+		builder.append_uint(first);
+		builder.append("-", 1);
+		builder.append_uint(last);
+	}
+	builder.append("/", 1);
+	builder.append_uint(size);
+	builder.append(CRLF);
+	commit_headers(response, builder);
+}
+
+/**
+ * @brief: 为一个分析完毕的请求生成应答：GET和HEAD请求映射到文档根目录下的文件，其他方法返回405。
+ *		文件的元数据来自缓存，客户端接受压缩时改为发送预先压缩好的兄弟文件，
+ *		客户端的副本仍然有效时返回304，GET请求带有Range时返回206，只发送其中一段
+ * @param doc_root: 文档根目录
+ * @param request: 请求的分析结果
+ * @param files: 文件元数据缓存
+ * @param mappings: 文件映射缓存
+ * @return: 应答
+*/
+inline http_response* make_file_response(const char* doc_root, const http_request& request, file_meta_cache& files, mmap_cache& mappings)
+{
+	bool head_only = (request.method == HEAD);
+	if (request.method != GET && !head_only)
+	{
+		return make_error_response(405, request.keep_alive, false);
+	}
+	char path[FILENAME_LEN];
+	if (!map_url(doc_root, request.url, request.url_len, path))
+	{
+		return make_error_response(403, request.keep_alive, head_only);
+	}
+
+	file_meta meta;
+	int err = files.lookup(path, meta);
+	if (err == 0 && S_ISDIR(meta.mode))
+	{
+		/* 目录名之后没有'/'，改为目录下的index.html */
+		int len = strlen(path);
+		if (len + 11 >= FILENAME_LEN)
+		{
+			return make_error_response(404, request.keep_alive, head_only);
+		}
+		memcpy(path + len, "/index.html", 12);
+		err = files.lookup(path, meta);
+	}
+	if (err != 0)
+	{
+		return make_error_response((err == EACCES) ? 403 : 404, request.keep_alive, head_only);
+	}
+	if (!S_ISREG(meta.mode) || !(meta.mode & S_IROTH))	// 只发送所有人都可以读的普通文件
+	{
+		return make_error_response(403, request.keep_alive, head_only);
+	}
+
+	const header_literal& content_type = find_mime_type(path);	// 压缩文件的Content-Type仍然是原文件的类型
+	bool vary = false;
+	const content_coding* coding = select_precompressed(request, files, path, meta, vary);
+
+	http_response* response = new http_response;
+	response->keep_alive = request.keep_alive;
+	if (not_modified(request, meta))	// 不必打开文件
+	{
+		begin_headers(response, 304);
+		add_file_headers(response, meta, NULL, vary);
+		end_headers(response);
+		return response;
+	}
+
+	off_t first = 0;
+	off_t last = meta.size - 1;
+	RANGE_STATUS range = head_only ? RANGE_NONE : parse_range(request, meta, first, last);
+	if (range == RANGE_UNSATISFIABLE)
+	{
+		const char* form = find_status(416).form;
+		add_status_headers(response, 416, CONTENT_TYPE_TEXT, strlen(form));
+		add_content_range(response, -1, 0, meta.size);
+		end_headers(response);
+		response->body = form;
+		response->body_len = strlen(form);
+		return response;
+	}
+	off_t length = last - first + 1;
+	add_status_headers(response, (range == RANGE_OK) ? 206 : 200, content_type, length);
+	if (range == RANGE_OK)
+	{
+		add_content_range(response, first, last, meta.size);
+	}
+	add_file_headers(response, meta, coding, vary);
+	end_headers(response);
+	if (head_only || length == 0)
+	{
+		return response;
+	}
+
+	/* 热点小文件直接发送缓存的映射，范围请求取映射中的一段 */
+	if (meta.size <= MMAP_FILE_SIZE && (response->mapping = mappings.acquire(path, meta)))
+	{
+		response->body = response->mapping->data + first;
+		response->body_len = length;
+		return response;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)	// 文件在缓存之后被删除了，inotify事件还没有处理
+	{
+		delete response;
+		return make_error_response((errno == EACCES) ? 403 : 404, request.keep_alive, head_only);
+	}
+	if (length <= SMALL_FILE_SIZE)
+	{
+		/* 映射失败时小文件读入内存，和头部一起发送，避免再为它调用一次sendfile */
+		char* buf = read_small_file(fd, first, length);
+		close(fd);
+		if (!buf)
+		{
+			delete response;
+			return make_error_response(500, request.keep_alive, head_only);
+		}
+		response->body = buf;
+		response->body_len = length;
+		response->body_owned = true;
+	}
+	else
+	{
+		response->file.start(fd, first, length);
+	}
+	return response;
+}
+
+/* 一个连接上待发送的应答队列。
+	队列前部连续的内存部分（头部和小文件）合并成一次writev；遇到带有文件的应答时，先写完它的头部，
+	再用sendfile发送文件，之后才轮到后面的应答。writev和sendfile只写出一部分时，已写的位置都记录在应答中，
+	等EPOLLOUT之后从原处继续。每次flush最多写出一定的额度，剩下的等事件循环下一轮再写
+*/
+
+/* 应答完成回调函数：一个应答的全部字节都交给内核之后、删除之前调用 */
+typedef void (*response_done_handler)(const http_response* response, void* arg);
+
+class response_queue
+{
+public:
+	response_queue() : head(NULL), tail(NULL), count(0), done_cb(NULL), done_arg(NULL) {}
+	~response_queue() { clear(); }
+
+	/**
+	 * @brief: 把应答加到队尾。头部溢出的应答不能发送被截断的头部，换成固定的500应答，它带有Connection: close
+	 * @param response: 应答
+	 * @param head_only: 请求是否为HEAD，替换的500应答同样不带应答体
+	 * @return: 实际排入队列的应答，它的keep_alive为false时调用者应当在发完之后关闭连接
+	*/
+	const http_response* push(http_response* response, bool head_only = false)
+	{
+		if (response->header_overflow)
+		{
+			delete response;
+			response = make_error_response(500, false, head_only);
+		}
+		response->next = NULL;
+		if (tail)
+		{
+			tail->next = response;
+		}
+		else
+		{
+			head = response;
+		}
+		tail = response;
+		count++;
+		return response;
+	}
+
+	/* 删除所有应答，关闭它们打开的文件 */
+	void clear()
+	{
+		while (head)
+		{
+			http_response* next = head->next;
+			delete head;
+			head = next;
+		}
+		tail = NULL;
+		count = 0;
+	}
+
+	/* 队列中的应答数 */
+	int size() const { return count; }
+
+	/* 设置应答完成回调函数 */
+	void set_done_handler(response_done_handler handler, void* arg)
+	{
+		done_cb = handler;
+		done_arg = arg;
+	}
+
+	/**
+	 * @brief: 把队列中的应答写到socket，写完的应答从队列中删除
+	 * @param sockfd: 非阻塞的连接socket
+	 * @param budget: 本次最多写出的字节数，用完时返回SEND_YIELD
+	 * @return: SEND_STATUS
+	*/
+	SEND_STATUS flush(int sockfd, long long budget = FLUSH_BUDGET)
+	{
+		while (head)
+		{
+			if (budget <= 0)
+			{
+				return SEND_YIELD;
+			}
+			/* 收集队列前部所有尚未写出的内存部分，直到第一个带有文件的应答为止 */
+			struct iovec iv[MAX_RESPONSE_IOV];
+			int n = 0;
+			for (http_response* r = head; r && n + 2 <= MAX_RESPONSE_IOV; r = r->next)
+			{
+				if (r->sent < r->header_len)
+				{
+					iv[n].iov_base = r->header + r->sent;
+					iv[n].iov_len = r->header_len - r->sent;
+					n++;
+				}
+				int body_sent = (r->sent > r->header_len) ? (r->sent - r->header_len) : 0;
+				if (body_sent < r->body_len)
+				{
+					iv[n].iov_base = (char*)r->body + body_sent;
+					iv[n].iov_len = r->body_len - body_sent;
+					n++;
+				}
+				if (r->file.active())	// 文件必须在后面的应答之前发出
+				{
+					break;
+				}
+			}
+
+			if (n > 0)
+			{
+				ssize_t ret = writev(sockfd, iv, n);
+				if (ret < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					return (errno == EAGAIN || errno == EWOULDBLOCK) ? SEND_AGAIN : SEND_ERROR;
+				}
+				budget -= ret;
+				/* 把写出的字节数依次记到各个应答上，写了一部分的应答记下写到了哪里 */
+				for (http_response* r = head; r && ret > 0; r = r->next)
+				{
+					int left = r->memory_len() - r->sent;
+					int done = (ret < left) ? ret : left;
+					r->sent += done;
+					ret -= done;
+				}
+			}
+
+			/* 发送文件，删除已经写完的应答 */
+			while (head && head->sent == head->memory_len())
+			{
+				if (head->file.active())
+				{
+					TRANSFER_STATUS status = head->file.run(sockfd, budget);
+					if (status != TRANSFER_DONE)
+					{
+						return (status == TRANSFER_AGAIN) ? SEND_AGAIN : (status == TRANSFER_YIELD) ? SEND_YIELD : SEND_ERROR;
+					}
+				}
+				if (done_cb)
+				{
+					done_cb(head, done_arg);
+				}
+				pop();
+			}
+		}
+		return SEND_DONE;
+	}
+
+private:
+	/* 删除队首的应答 */
+	void pop()
+	{
+		http_response* next = head->next;
+		delete head;
+		head = next;
+		if (!head)
+		{
+			tail = NULL;
+		}
+		count--;
+	}
+
+private:
+	http_response* head;	// 最早的应答，正在发送
+	http_response* tail;
+	int count;				// 队列中的应答数
+	response_done_handler done_cb;	// 应答完成回调函数，可以为NULL
+	void* done_arg;
+};
+
+#endif  // STATIC_FILE_H
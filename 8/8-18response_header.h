@@ -0,0 +1,237 @@
+#ifndef RESPONSE_HEADER_H
+#define RESPONSE_HEADER_H
+
+#include <time.h>
+#include <string.h>
+
+/* 应答头部生成器。应答头部中大部分内容是固定的：状态行、Content-Type、Connection等都事先序列化成完整的一行，
+	生成头部时直接memcpy；Date每秒才变一次，由事件循环每秒格式化一次；只有Content-Length这样的数字
+	需要现场转换，用按两位查表的整数转换代替snprintf
+*/
+
+/* 事先序列化好的一段头部，长度在编译期确定 */
+struct header_literal
+{
+	const char* data;
+	int len;
+};
+
+#define HEADER_LITERAL(s) { s, sizeof(s) - 1 }
+
+static const header_literal CRLF = HEADER_LITERAL("\r\n");
+static const header_literal CONNECTION_KEEP_ALIVE = HEADER_LITERAL("Connection: keep-alive\r\n");
+static const header_literal CONNECTION_CLOSE = HEADER_LITERAL("Connection: close\r\n");
+
+#define HTTP_DATE_LEN 29	// "Sun, 06 Nov 1994 08:49:37 GMT"的长度
+#define DATE_HEADER_LEN 37	// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"的长度
+#define UINT_MAX_DIGITS 20	// 64位无符号整数的最大位数
+
+/* 00到99的两位十进制表示 */
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+/**
+ * @brief: 把无符号整数转换成十进制字符串，每次除以100产生两位数字
+ * @param buf: 输出缓冲区，至少UINT_MAX_DIGITS字节，不追加'\0'
+ * @param value: 整数
+ * @return: 写入的字节数
+*/
+inline int format_uint(char* buf, unsigned long long value)
+{
+	char temp[UINT_MAX_DIGITS];
+	char* p = temp + UINT_MAX_DIGITS;
+	while (value >= 100)
+	{
+		int i = (value % 100) * 2;
+		value /= 100;
+		p -= 2;
+		p[0] = digit_pairs[i];
+		p[1] = digit_pairs[i + 1];
+	}
+	if (value >= 10)
+	{
+		p -= 2;
+		p[0] = digit_pairs[value * 2];
+		p[1] = digit_pairs[value * 2 + 1];
+	}
+	else
+	{
+		*--p = '0' + value;
+	}
+	int len = temp + UINT_MAX_DIGITS - p;
+	memcpy(buf, p, len);
+	return len;
+}
+
+static const char* const http_weekdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char* const http_months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+/* 写两位十进制数字 */
+inline void put_2digits(char* p, int value)
+{
+	p[0] = digit_pairs[value * 2];
+	p[1] = digit_pairs[value * 2 + 1];
+}
+
+/**
+ * @brief: 按RFC 7231的IMF-fixdate格式格式化时间。strftime的%a和%b受locale影响，这里自己拼
+ * @param buf: 输出缓冲区，至少HTTP_DATE_LEN字节，不追加'\0'
+ * @param t: 时间
+*/
+inline void format_http_date(char* buf, time_t t)
+{
+	struct tm tm;
+	gmtime_r(&t, &tm);
+	memcpy(buf, http_weekdays[tm.tm_wday], 3);
+	memcpy(buf + 3, ", ", 2);
+	put_2digits(buf + 5, tm.tm_mday);
+	buf[7] = ' ';
+	memcpy(buf + 8, http_months[tm.tm_mon], 3);
+	buf[11] = ' ';
+	put_2digits(buf + 12, (tm.tm_year + 1900) / 100);
+	put_2digits(buf + 14, (tm.tm_year + 1900) % 100);
+	buf[16] = ' ';
+	put_2digits(buf + 17, tm.tm_hour);
+	buf[19] = ':';
+	put_2digits(buf + 20, tm.tm_min);
+	buf[22] = ':';
+	put_2digits(buf + 23, tm.tm_sec);
+	memcpy(buf + 25, " GMT", 4);
+}
+
+/**
+ * @brief: 解析IMF-fixdate格式的时间，用于If-Modified-Since等请求头部。RFC 7231要求接受的另外两种过时格式不支持，
+ *		解析失败的头部按没有出现处理，最多只是少回一个304
+ * @param value: 字段值
+ * @param len: 字段值的长度
+ * @param t: 返回时间
+ * @return: 格式不对时返回false
+*/
+inline bool parse_http_date(const char* value, int len, time_t& t)
+{
+	if (len != HTTP_DATE_LEN || memcmp(value + 3, ", ", 2) != 0 || value[7] != ' ' || value[11] != ' '
+		|| value[16] != ' ' || value[19] != ':' || value[22] != ':' || memcmp(value + 25, " GMT", 4) != 0)
+	{
+		return false;
+	}
+	static const int digits[] = { 5, 6, 12, 13, 14, 15, 17, 18, 20, 21, 23, 24 };
+	for (unsigned int i = 0; i < sizeof(digits) / sizeof(digits[0]); i++)
+	{
+		if (value[digits[i]] < '0' || value[digits[i]] > '9')
+		{
+			return false;
+		}
+	}
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_mon = -1;
+	for (int i = 0; i < 12; i++)
+	{
+		if (memcmp(value + 8, http_months[i], 3) == 0)
+		{
+			tm.tm_mon = i;
+		}
+	}
+	if (tm.tm_mon < 0)
+	{
+		return false;
+	}
+#define DIGITS2(p) (((p)[0] - '0') * 10 + ((p)[1] - '0'))
+	tm.tm_mday = DIGITS2(value + 5);
+	tm.tm_year = DIGITS2(value + 12) * 100 + DIGITS2(value + 14) - 1900;
+	tm.tm_hour = DIGITS2(value + 17);
+	tm.tm_min = DIGITS2(value + 20);
+	tm.tm_sec = DIGITS2(value + 23);
+#undef DIGITS2
+	t = timegm(&tm);
+	return t != (time_t)-1;
+}
+
+/* Date头部，同一秒内的所有应答共用 */
+class http_date
+{
+public:
+	http_date() : last(-1) { update(time(NULL)); }
+
+	/**
+	 * @brief: 时间变化时重新格式化Date头部。事件循环每次醒来调用一次，同一秒内的调用直接返回
+	 * @param now: 当前时间
+	*/
+	void update(time_t now)
+	{
+		if (now == last)
+		{
+			return;
+		}
+		memcpy(line, "Date: ", 6);
+		format_http_date(line + 6, now);
+		memcpy(line + 6 + HTTP_DATE_LEN, "\r\n", 3);
+		last = now;
+	}
+
+	/* 完整的Date头部行，包括结尾的"\r\n" */
+	const char* header() const { return line; }
+
+private:
+	char line[DATE_HEADER_LEN + 1];
+	time_t last;
+};
+
+/**
+ * @brief: 所有应答共用的Date头部。各个翻译单元看到的是同一个对象
+ * @return: Date头部
+*/
+inline http_date& current_date()
+{
+	static http_date date;
+	return date;
+}
+
+/* 往固定大小的缓冲区中追加头部，空间不够时记下溢出并停止写入，写完之后由调用者用ok()检查 */
+class header_builder
+{
+public:
+	header_builder(char* buffer, int capacity) : buf(buffer), cap(capacity), len(0), overflow(false) {}
+
+	/* 追加任意字节 */
+	void append(const char* data, int n)
+	{
+		if (overflow || n > cap - len)
+		{
+			overflow = true;
+			return;
+		}
+		memcpy(buf + len, data, n);
+		len += n;
+	}
+
+	/* 追加事先序列化好的一段头部 */
+	void append(const header_literal& literal) { append(literal.data, literal.len); }
+
+	/* 追加以'\0'结尾的字符串 */
+	void append(const char* str) { append(str, strlen(str)); }
+
+	/* 追加一个十进制整数 */
+	void append_uint(unsigned long long value)
+	{
+		char temp[UINT_MAX_DIGITS];
+		append(temp, format_uint(temp, value));
+	}
+
+	/* 追加当前的Date头部 */
+	void append_date() { append(current_date().header(), DATE_HEADER_LEN); }
+
+	/* 已写入的字节数 */
+	int length() const { return len; }
+
+	/* 是否所有内容都写进去了 */
+	bool ok() const { return !overflow; }
+
+private:
+	char* buf;
+	int cap;
+	int len;
+	bool overflow;
+};
+
+#endif  // RESPONSE_HEADER_H
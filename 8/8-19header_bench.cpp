@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "8-18response_header.h"
+
+#define BENCH_HEADERS 1000000	// 每轮生成的应答头部数
+#define BENCH_ROUNDS 5			// 重复的轮数，取最好的一轮
+#define HEADER_BUFFER_SIZE 512
+
+/**
+ * @brief: 获取单调时钟的当前时间
+ * @return: 纳秒数
+*/
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief: 原来的做法：每个头部一次snprintf，每次都格式化Date
+ * @param buf: 头部缓冲区
+ * @param content_length: 报文长度
+ * @param keep_alive: 是否保持连接
+ * @return: 头部长度
+*/
+static int build_snprintf(char* buf, long long content_length, bool keep_alive)
+{
+	int len = snprintf(buf, HEADER_BUFFER_SIZE, "%s %d %s\r\n", "HTTP/1.1", 200, "OK");
+	char date[64];
+	time_t now = time(NULL);
+	struct tm tm;
+	gmtime_r(&now, &tm);
+	strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	len += snprintf(buf + len, HEADER_BUFFER_SIZE - len, "Date: %s\r\n", date);
+	len += snprintf(buf + len, HEADER_BUFFER_SIZE - len, "Content-Type: %s\r\n", "text/html; charset=utf-8");
+	len += snprintf(buf + len, HEADER_BUFFER_SIZE - len, "Content-Length: %lld\r\n", content_length);
+	len += snprintf(buf + len, HEADER_BUFFER_SIZE - len, "Connection: %s\r\n\r\n", keep_alive ? "keep-alive" : "close");
+	return len;
+}
+
+/**
+ * @brief: 新的做法：复制事先序列化好的行，只转换Content-Length
+ * @param buf: 头部缓冲区
+ * @param content_length: 报文长度
+ * @param keep_alive: 是否保持连接
+ * @return: 头部长度
+*/
+static int build_cached(char* buf, long long content_length, bool keep_alive)
+{
+	static const header_literal status = HEADER_LITERAL("HTTP/1.1 200 OK\r\n");
+	static const header_literal type = HEADER_LITERAL("Content-Type: text/html; charset=utf-8\r\n");
+	header_builder builder(buf, HEADER_BUFFER_SIZE);
+	builder.append(status);
+	builder.append_date();
+	builder.append(type);
+	builder.append("Content-Length: ", 16);
+	builder.append_uint(content_length);
+	builder.append(CRLF);
+	builder.append(keep_alive ? CONNECTION_KEEP_ALIVE : CONNECTION_CLOSE);
+	builder.append(CRLF);
+	return builder.length();
+}
+
+/**
+ * @brief: 测量一种头部生成方式
+ * @param name: 名称
+ * @param build: 生成函数
+ * @return: 每个头部的纳秒数
+*/
+static double bench(const char* name, int (*build)(char*, long long, bool))
+{
+	char buf[HEADER_BUFFER_SIZE];
+	long long best = -1;
+	long long checksum = 0;
+	for (int round = 0; round < BENCH_ROUNDS; round++)
+	{
+		long long start = now_ns();
+		for (int i = 0; i < BENCH_HEADERS; i++)
+		{
+			/* 模拟事件循环：每1000个应答检查一次时间，同一秒内不重新格式化Date */
+			if (i % 1000 == 0)
+			{
+				current_date().update(time(NULL));
+			}
+			checksum += build(buf, (long long)i * 37, i & 1);
+		}
+		long long cost = now_ns() - start;
+		if (best < 0 || cost < best)
+		{
+			best = cost;
+		}
+	}
+	double ns = (double)best / BENCH_HEADERS;
+	printf("%-9s %7.1f ns/header  (checksum %lld)\n", name, ns, checksum);
+	return ns;
+}
+
+int main()
+{
+	/* 先确认两种方式生成的头部逐字节相同 */
+	srand(time(NULL));
+	char expect[HEADER_BUFFER_SIZE];
+	char actual[HEADER_BUFFER_SIZE];
+	for (int i = 0; i < 100000; i++)
+	{
+		long long content_length = (i < 1000) ? i : ((long long)rand() << (rand() % 32));
+		if (i == 1000)
+		{
+			content_length = 9223372036854775807LL;
+		}
+		current_date().update(time(NULL));
+		int expect_len = build_snprintf(expect, content_length, i & 1);
+		int actual_len = build_cached(actual, content_length, i & 1);
+		if (expect_len != actual_len || memcmp(expect, actual, expect_len) != 0)
+		{
+			/* 两次调用之间恰好跨过了一秒时Date会不同，再比一次 */
+			current_date().update(time(NULL));
+			expect_len = build_snprintf(expect, content_length, i & 1);
+			actual_len = build_cached(actual, content_length, i & 1);
+			if (expect_len != actual_len || memcmp(expect, actual, expect_len) != 0)
+			{
+				printf("header mismatch for Content-Length %lld:\n%.*s\n%.*s\n", content_length, expect_len, expect, actual_len, actual);
+				return 1;
+			}
+		}
+	}
+
+	double baseline = bench("snprintf", build_snprintf);
+	double cached = bench("cached", build_cached);
+	printf("x%.1f\n", baseline / cached);
+	return 0;
+}
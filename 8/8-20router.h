@@ -0,0 +1,437 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include "8-7chunk_buffer.h"
+#include "8-8chunked_decoder.h"
+#include "8-12http_parser.h"
+
+#define MAX_ROUTE_PARAMS 8	// 一条路由最多的路径参数个数
+
+/* 每个请求一个的内存区，从内存池中取块，按顺序切分，请求处理完后整体归还。
+	百分号解码的结果放在这里，不需要逐个释放；大多数请求不解码任何参数，也就不会申请内存块
+*/
+class request_arena
+{
+public:
+	request_arena() : head(NULL), used(0) {}
+	~request_arena() { reset(); }
+
+	/**
+	 * @brief: 分配一段内存，在reset之前一直有效
+	 * @param size: 字节数
+	 * @return: 内存地址，申请失败时返回NULL
+	*/
+	char* alloc(int size)
+	{
+		if (!head || head->size - used < size)
+		{
+			buf_chunk* chunk = chunk_alloc((size > CHUNK_SIZE) ? size : CHUNK_SIZE);
+			if (!chunk)
+			{
+				return NULL;
+			}
+			chunk->next = head;
+			head = chunk;
+			used = 0;
+		}
+		char* p = head->data + used;
+		used += size;
+		return p;
+	}
+
+	/* 归还所有内存块，之前分配的内存全部失效 */
+	void reset()
+	{
+		chunk_free(head);
+		head = NULL;
+		used = 0;
+	}
+
+private:
+	buf_chunk* head;	// 最近申请的内存块，之前的块挂在它后面
+	int used;			// head中已经分配出去的字节数
+};
+
+/**
+ * @brief: 对一段URL做百分号解码，结果以'\0'结尾，放在arena中
+ * @param src: 原始数据，不必以'\0'结尾
+ * @param len: 原始数据的长度
+ * @param arena: 存放结果的内存区
+ * @return: 解码结果，%后面不是两个十六进制数字、解码出'\0'或者内存不足时返回NULL
+*/
+inline const char* percent_decode(const char* src, int len, request_arena& arena)
+{
+	char* dest = arena.alloc(len + 1);	// 解码结果不会比原始数据长
+	if (!dest)
+	{
+		return NULL;
+	}
+	int n = 0;
+	for (int i = 0; i < len; i++)
+	{
+		if (src[i] != '%')
+		{
+			dest[n++] = src[i];
+			continue;
+		}
+		int high = (i + 2 < len) ? hex_value(src[i + 1]) : -1;
+		int low = (high >= 0) ? hex_value(src[i + 2]) : -1;
+		if (low < 0 || (high == 0 && low == 0))
+		{
+			return NULL;
+		}
+		dest[n++] = (char)((high << 4) | low);
+		i += 2;
+	}
+	dest[n] = '\0';
+	return dest;
+}
+
+class route_match;
+struct http_response;
+
+/* 路由处理函数：根据请求和路径参数生成应答 */
+typedef http_response* (*route_handler)(const http_request& request, route_match& match);
+
+/* 一次路由查找的结果。参数值直接指向读缓冲区中的URL，只有处理函数调用param时才解码 */
+class route_match
+{
+public:
+	explicit route_match(request_arena* memory) : count(0), arena(memory) {}
+
+	/* 路径参数个数 */
+	int size() const { return count; }
+
+	/* 第index个参数的名字 */
+	const char* name(int index) const { return params[index].name; }
+
+	/**
+	 * @brief: 未解码的参数值，位于读缓冲区中，不以'\0'结尾
+	 * @param index: 参数下标
+	 * @param len: 返回参数值的长度
+	 * @return: 参数值
+	*/
+	const char* raw(int index, int& len) const
+	{
+		len = params[index].len;
+		return params[index].value;
+	}
+
+	/**
+	 * @brief: 读缓冲区中的请求被整体移动之后，修正仍指向它的参数值。已经解码的值在内存区中，不受影响
+	 * @param delta: 请求原来的位置减去新的位置，与http_parser::compact修正请求时使用的相同
+	*/
+	void rebase(ptrdiff_t delta)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			params[i].value -= delta;
+		}
+	}
+
+	/**
+	 * @brief: 按名字取得解码后的参数值。第一次调用时解码到请求的内存区，之后直接返回
+	 * @param name: 参数名，不带':'或'*'
+	 * @return: 以'\0'结尾的参数值，没有这个参数或者参数编码错误时返回NULL
+	*/
+	const char* param(const char* name)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (strcmp(params[i].name, name) == 0)
+			{
+				if (!params[i].decoded)
+				{
+					params[i].decoded = percent_decode(params[i].value, params[i].len, *arena);
+				}
+				return params[i].decoded;
+			}
+		}
+		return NULL;
+	}
+
+private:
+	friend class router;
+
+	struct route_param
+	{
+		const char* name;		// 参数名，位于路由树中
+		const char* value;		// 参数值，位于读缓冲区中
+		int len;
+		const char* decoded;	// 解码后的值，NULL表示还没有解码
+	};
+
+	route_param params[MAX_ROUTE_PARAMS];
+	int count;
+	request_arena* arena;
+};
+
+/* 压缩前缀树（radix tree）的节点。静态节点保存一段公共前缀，子节点按首字节查找；
+	":name"参数节点匹配一个路径段（到下一个'/'为止），"*name"通配节点匹配剩下的全部路径
+*/
+struct route_node
+{
+	std::string prefix;					// 静态节点的路径片段，参数节点为空
+	std::string indices;				// 各个静态子节点prefix的首字节，与children一一对应
+	std::vector<route_node*> children;	// 静态子节点
+	route_node* param_child;			// ":name"子节点
+	route_node* wildcard_child;			// "*name"子节点，它没有子节点
+	std::string param_name;				// 参数节点和通配节点的参数名
+	route_handler handler;				// 在此结束的路由的处理函数
+
+	route_node() : param_child(NULL), wildcard_child(NULL), handler(NULL) {}
+
+	~route_node()
+	{
+		for (size_t i = 0; i < children.size(); i++)
+		{
+			delete children[i];
+		}
+		delete param_child;
+		delete wildcard_child;
+	}
+};
+
+/* URL路由器，每种方法一棵压缩前缀树。查找时沿树逐段比较路径，耗时取决于路径长度而不是路由条数。
+	静态路径优先于参数，参数优先于通配：同一位置上静态子树匹配失败时才回退去试参数和通配节点。
+	匹配使用原始的（未解码的）路径，参数值在处理函数需要时才解码
+*/
+class router
+{
+public:
+	router()
+	{
+		for (int i = 0; i < METHOD_COUNT; i++)
+		{
+			roots[i] = NULL;
+		}
+	}
+
+	~router()
+	{
+		for (int i = 0; i < METHOD_COUNT; i++)
+		{
+			delete roots[i];
+		}
+	}
+
+	/**
+	 * @brief: 添加一条路由，例如"/users/:id"，以"*name"结尾的模式匹配剩下的全部路径
+	 * @param method: 请求方法
+	 * @param pattern: 路径模式，以'/'开头。参数占据整个路径段，通配只能出现在末尾
+	 * @param handler: 处理函数
+	 * @return: 模式不合法或者与已有路由冲突时返回false
+	*/
+	bool add(METHOD method, const char* pattern, route_handler handler)
+	{
+		if (method >= METHOD_COUNT || !pattern || pattern[0] != '/' || !handler)
+		{
+			return false;
+		}
+		int params = 0;
+		for (const char* p = pattern; *p; p++)
+		{
+			if (*p == ':' || *p == '*')
+			{
+				/* 参数必须紧跟在'/'之后并且有名字，通配之后不能再有内容 */
+				int name_len = strcspn(p + 1, "/");
+				if (p[-1] != '/' || name_len == 0 || strcspn(p + 1, ":*") < (size_t)name_len
+					|| (*p == '*' && p[1 + name_len] != '\0') || ++params > MAX_ROUTE_PARAMS)
+				{
+					return false;
+				}
+			}
+		}
+		if (!roots[method])
+		{
+			roots[method] = new route_node;
+		}
+		return insert_children(roots[method], pattern, handler);
+	}
+
+	/**
+	 * @brief: 为请求查找路由。只比较URL的路径部分；HEAD请求没有专门的路由时使用GET路由
+	 * @param request: 分析完毕的请求
+	 * @param match: 返回路径参数
+	 * @return: 处理函数，没有匹配的路由时返回NULL
+	*/
+	route_handler find(const http_request& request, route_match& match) const
+	{
+		if (request.method >= METHOD_COUNT || !request.url)
+		{
+			return NULL;
+		}
+		const char* path = request.url;
+		const char* end = path + url_path_len(path, request.url_len);
+		match.count = 0;
+		route_handler handler = NULL;
+		if (roots[request.method] && match_children(roots[request.method], path, end, match, handler))
+		{
+			return handler;
+		}
+		match.count = 0;
+		if (request.method == HEAD && roots[GET] && match_children(roots[GET], path, end, match, handler))
+		{
+			return handler;
+		}
+		return NULL;
+	}
+
+private:
+	/**
+	 * @brief: 把模式的剩余部分插入到node的子树中，node本身已经完全匹配
+	 * @param node: 当前节点
+	 * @param pattern: 模式的剩余部分
+	 * @param handler: 处理函数
+	 * @return: 与已有路由冲突时返回false
+	*/
+	static bool insert_children(route_node* node, const char* pattern, route_handler handler)
+	{
+		if (*pattern == '\0')
+		{
+			if (node->handler)
+			{
+				return false;
+			}
+			node->handler = handler;
+			return true;
+		}
+		if (*pattern == ':' || *pattern == '*')
+		{
+			int name_len = strcspn(pattern + 1, "/");
+			std::string name(pattern + 1, name_len);
+			route_node*& child = (*pattern == ':') ? node->param_child : node->wildcard_child;
+			if (!child)
+			{
+				child = new route_node;
+				child->param_name = name;
+			}
+			else if (child->param_name != name)	// 同一位置上的参数必须同名
+			{
+				return false;
+			}
+			return insert_children(child, pattern + 1 + name_len, handler);
+		}
+		size_t pos = node->indices.find(*pattern);
+		if (pos != std::string::npos)
+		{
+			return insert_static(node->children[pos], pattern, handler);
+		}
+		/* 新建静态子节点，它的前缀到下一个参数为止 */
+		route_node* child = new route_node;
+		int len = strcspn(pattern, ":*");
+		child->prefix.assign(pattern, len);
+		node->indices.push_back(*pattern);
+		node->children.push_back(child);
+		return insert_children(child, pattern + len, handler);
+	}
+
+	/**
+	 * @brief: 把模式插入到静态节点node所在的子树中，模式和node的前缀至少有一个字节相同
+	 * @param node: 静态节点
+	 * @param pattern: 模式的剩余部分
+	 * @param handler: 处理函数
+	 * @return: 与已有路由冲突时返回false
+	*/
+	static bool insert_static(route_node* node, const char* pattern, route_handler handler)
+	{
+		size_t common = 0;
+		while (common < node->prefix.size() && pattern[common] == node->prefix[common])
+		{
+			common++;
+		}
+		if (common < node->prefix.size())
+		{
+			/* 模式只和前缀的一部分相同，把节点从这里分成两段，原来的内容都移到后一段 */
+			route_node* child = new route_node;
+			child->prefix = node->prefix.substr(common);
+			child->indices.swap(node->indices);
+			child->children.swap(node->children);
+			child->param_child = node->param_child;
+			child->wildcard_child = node->wildcard_child;
+			child->handler = node->handler;
+			node->prefix.resize(common);
+			node->indices.assign(1, child->prefix[0]);
+			node->children.assign(1, child);
+			node->param_child = NULL;
+			node->wildcard_child = NULL;
+			node->handler = NULL;
+		}
+		return insert_children(node, pattern + common, handler);
+	}
+
+	/**
+	 * @brief: 在node的子树中匹配路径的剩余部分，node本身已经完全匹配
+	 * @param node: 当前节点
+	 * @param path: 路径的剩余部分
+	 * @param end: 路径的结尾
+	 * @param match: 记录路径参数
+	 * @param handler: 返回处理函数
+	 * @return: 是否匹配
+	*/
+	static bool match_children(const route_node* node, const char* path, const char* end, route_match& match, route_handler& handler)
+	{
+		if (path == end && node->handler)
+		{
+			handler = node->handler;
+			return true;
+		}
+		if (path < end)
+		{
+			/* 静态子节点优先 */
+			size_t pos = node->indices.find(*path);
+			if (pos != std::string::npos)
+			{
+				const route_node* child = node->children[pos];
+				size_t len = child->prefix.size();
+				if ((size_t)(end - path) >= len && memcmp(path, child->prefix.data(), len) == 0
+					&& match_children(child, path + len, end, match, handler))
+				{
+					return true;
+				}
+			}
+			/* 参数匹配一个非空的路径段 */
+			if (node->param_child && *path != '/')
+			{
+				const char* segment_end = (const char*)memchr(path, '/', end - path);
+				if (!segment_end)
+				{
+					segment_end = end;
+				}
+				int saved = match.count;
+				push_param(match, node->param_child, path, segment_end);
+				if (match_children(node->param_child, segment_end, end, match, handler))
+				{
+					return true;
+				}
+				match.count = saved;
+			}
+		}
+		/* 通配匹配剩下的全部路径，可以为空 */
+		if (node->wildcard_child)
+		{
+			push_param(match, node->wildcard_child, path, end);
+			handler = node->wildcard_child->handler;
+			return true;
+		}
+		return false;
+	}
+
+	/* 记录一个路径参数，add已经保证参数个数不超过MAX_ROUTE_PARAMS */
+	static void push_param(route_match& match, const route_node* node, const char* begin, const char* end)
+	{
+		route_match::route_param& param = match.params[match.count++];
+		param.name = node->param_name.c_str();
+		param.value = begin;
+		param.len = end - begin;
+		param.decoded = NULL;
+	}
+
+private:
+	route_node* roots[METHOD_COUNT];	// 每种方法的路由树
+};
+
+#endif  // ROUTER_H
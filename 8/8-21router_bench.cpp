@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "8-20router.h"
+
+#define BENCH_LOOKUPS 1000000	// 每种规模查找的次数
+
+/* 基准程序不调用处理函数，只用它来核对查到的路由：第i条路由登记dummy_handlers[i % 4] */
+static const route_handler dummy_handlers[4] = {
+	(route_handler)1, (route_handler)2, (route_handler)3, (route_handler)4
+};
+
+/**
+ * @brief: 获取单调时钟的当前时间
+ * @return: 纳秒数
+*/
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief: 逐条比较的线性路由表，作为对照。模式和路径都按'/'分段比较，":"段匹配任意非空段
+ * @param patterns: 全部模式
+ * @param path: 请求路径
+ * @return: 第一条匹配的模式下标，没有匹配时返回-1
+*/
+static int linear_find(const std::vector<std::string>& patterns, const char* path)
+{
+	for (size_t i = 0; i < patterns.size(); i++)
+	{
+		const char* p = patterns[i].c_str();
+		const char* u = path;
+		while (*p && *u)
+		{
+			if (*p == ':')
+			{
+				p += strcspn(p, "/");
+				if (*u == '/')
+				{
+					break;
+				}
+				u += strcspn(u, "/");
+			}
+			else if (*p++ != *u++)
+			{
+				break;
+			}
+		}
+		if (*p == '\0' && *u == '\0')
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* 生成一条类似REST API的路由模式，约四分之一带有参数 */
+static std::string make_pattern(int i)
+{
+	static const char* resources[] = { "users", "orders", "items", "carts", "reviews", "shipments", "invoices", "coupons" };
+	char buf[128];
+	if (i % 4 == 0)
+	{
+		snprintf(buf, sizeof(buf), "/api/v%d/%s%d/:id/detail", i % 3 + 1, resources[i % 8], i);
+	}
+	else
+	{
+		snprintf(buf, sizeof(buf), "/api/v%d/%s%d/list/page%d", i % 3 + 1, resources[i % 8], i, i % 10);
+	}
+	return buf;
+}
+
+/* 把模式变成一条会命中它的请求路径，参数替换成带百分号编码的值 */
+static std::string make_path(const std::string& pattern)
+{
+	std::string path = pattern;
+	size_t pos = path.find(':');
+	if (pos != std::string::npos)
+	{
+		path.replace(pos, path.find('/', pos) - pos, "42%20x");
+	}
+	return path;
+}
+
+/**
+ * @brief: 建立routes条路由，分别测量压缩前缀树和线性表的查找时间
+ * @param routes: 路由条数
+*/
+static void bench(int routes)
+{
+	router tree;
+	std::vector<std::string> patterns;
+	for (int i = 0; i < routes; i++)
+	{
+		patterns.push_back(make_pattern(i));
+		if (!tree.add(GET, patterns.back().c_str(), dummy_handlers[i % 4]))
+		{
+			printf("failed to add %s\n", patterns.back().c_str());
+			exit(1);
+		}
+	}
+
+	/* 请求路径随机选取，先检查两种查找方式得到同样的结果 */
+	std::vector<std::string> paths;
+	for (int i = 0; i < 1024; i++)
+	{
+		int k = rand() % routes;
+		paths.push_back(make_path(patterns[k]));
+		http_request request;
+		request.method = GET;
+		request.url = (char*)paths.back().c_str();
+		request.url_len = paths.back().size();
+		request_arena arena;
+		route_match match(&arena);
+		route_handler handler = tree.find(request, match);
+		int expect = linear_find(patterns, request.url);
+		if (handler != dummy_handlers[expect % 4] || (patterns[k].find(':') != std::string::npos
+			&& (match.param("id") == NULL || strcmp(match.param("id"), "42 x") != 0)))
+		{
+			printf("lookup mismatch for %s\n", request.url);
+			exit(1);
+		}
+	}
+
+	http_request request;
+	request.method = GET;
+	request_arena arena;
+	long long hits = 0;
+	long long start = now_ns();
+	for (int i = 0; i < BENCH_LOOKUPS; i++)
+	{
+		request.url = (char*)paths[i & 1023].c_str();
+		request.url_len = paths[i & 1023].size();
+		route_match match(&arena);
+		hits += (tree.find(request, match) != NULL);
+	}
+	double tree_ns = (double)(now_ns() - start) / BENCH_LOOKUPS;
+
+	/* 线性表在路由很多时太慢，按比例减少查找次数 */
+	int lookups = BENCH_LOOKUPS / (routes / 10 + 1);
+	start = now_ns();
+	for (int i = 0; i < lookups; i++)
+	{
+		hits += (linear_find(patterns, paths[i & 1023].c_str()) >= 0);
+	}
+	double linear_ns = (double)(now_ns() - start) / lookups;
+	printf("%6d routes  radix %7.1f ns/lookup  linear %10.1f ns/lookup  (%lld hits)\n", routes, tree_ns, linear_ns, hits);
+}
+
+int main()
+{
+	srand(20240601);
+	int sizes[] = { 10, 100, 1000, 10000 };
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		bench(sizes[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,302 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "8-18response_header.h"
+
+/* 文件元数据缓存。条件请求和范围请求只需要文件的大小、修改时间和ETag，命中缓存时304应答连open都不用调用。
+	缓存以map_url生成的路径为键，登记一个文件之前先用inotify监视它所在的目录，目录中的文件被修改、删除、改名时
+	删除对应的条目。不存在的文件也缓存下来，因为查找预先压缩的兄弟文件时大部分都不存在。
+	inotify事件由事件循环读取，所以文件被修改之后最多还有一轮事件循环看到的是旧的元数据
+*/
+
+#define MAX_FILE_META 4096			// 缓存的条目数上限，满了之后随便淘汰一条
+#define ETAG_LEN 40					// 带引号的ETag的最大长度
+#define INOTIFY_BUFFER_SIZE 4096	// 一次read读取的inotify事件缓冲区大小
+#define WATCH_MASK (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* 一个文件的stat结果，以及由它生成的验证器 */
+struct file_meta
+{
+	int error;							// stat失败时的errno，只缓存ENOENT和ENOTDIR，其他字段无效
+	mode_t mode;
+	off_t size;
+	time_t mtime;
+	long long mtime_ns;					// 精确到纳秒的修改时间
+	char etag[ETAG_LEN];				// 强ETag，形如"修改时间-大小"，都是十六进制，修改时间精确到纳秒；预先压缩的文件发送时再加上编码，见select_precompressed
+	int etag_len;
+	char last_modified[HTTP_DATE_LEN];	// IMF-fixdate格式的修改时间
+};
+
+/* 作废回调函数：path的元数据因inotify事件作废时调用，path为NULL表示全部作废。其他按路径缓存文件内容的缓存用它同步作废 */
+typedef void (*invalidate_handler)(const char* path, void* arg);
+
+class file_meta_cache
+{
+public:
+	file_meta_cache() : inotify_fd(-1), invalidate_cb(NULL), invalidate_arg(NULL), hit_count(0), miss_count(0) {}
+	~file_meta_cache()
+	{
+		if (inotify_fd >= 0)
+		{
+			close(inotify_fd);
+		}
+	}
+
+	/**
+	 * @brief: 创建非阻塞的inotify实例。失败时缓存照常工作，只是不保存任何条目，每次都重新stat
+	 * @return: 失败时返回false
+	*/
+	bool init()
+	{
+		inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		return inotify_fd >= 0;
+	}
+
+	/* 设置作废回调函数 */
+	void set_invalidate_handler(invalidate_handler handler, void* arg)
+	{
+		invalidate_cb = handler;
+		invalidate_arg = arg;
+	}
+
+	/* inotify文件描述符，可读时调用process_events */
+	int fd() const { return inotify_fd; }
+
+	/* 缓存的条目数 */
+	int size() const { return entries.size(); }
+
+	/* 命中和未命中的次数 */
+	long long hits() const { return hit_count; }
+	long long misses() const { return miss_count; }
+
+	/**
+	 * @brief: 取得文件的元数据，缓存中没有时stat并登记
+	 * @param path: 文件路径，同一个文件只有一种写法（见map_url）
+	 * @param meta: 返回元数据
+	 * @return: 成功时返回0，失败时返回stat的errno
+	*/
+	int lookup(const char* path, file_meta& meta)
+	{
+		std::string key(path);
+		std::unordered_map<std::string, file_meta>::iterator it = entries.find(key);
+		if (it != entries.end())
+		{
+			hit_count++;
+			meta = it->second;
+			return meta.error;
+		}
+		miss_count++;
+
+		/* 先监视目录再stat，这样stat之后发生的修改一定会产生事件 */
+		bool watched = watch_dir(key);
+		struct stat st;
+		if (stat(path, &st) < 0)
+		{
+			meta.error = errno;
+			if (meta.error != ENOENT && meta.error != ENOTDIR)	// 其他错误（例如EACCES）可能是暂时的
+			{
+				return meta.error;
+			}
+		}
+		else
+		{
+			fill_meta(st, meta);
+		}
+		if (watched)
+		{
+			if (entries.size() >= MAX_FILE_META)
+			{
+				entries.erase(entries.begin());
+			}
+			entries[key] = meta;
+		}
+		return meta.error;
+	}
+
+	/* 读出所有inotify事件，删除受影响的条目，直到EAGAIN */
+	void process_events()
+	{
+		char buf[INOTIFY_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+		while (1)
+		{
+			ssize_t len = read(inotify_fd, buf, sizeof(buf));
+			if (len < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (len <= 0)
+			{
+				return;
+			}
+			for (char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len)
+			{
+				handle_event((const struct inotify_event*)p);
+			}
+		}
+	}
+
+private:
+	/* 根据stat的结果生成元数据 */
+	static void fill_meta(const struct stat& st, file_meta& meta)
+	{
+		meta.error = 0;
+		meta.mode = st.st_mode;
+		meta.size = st.st_size;
+		meta.mtime = st.st_mtime;
+		meta.mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+		meta.etag_len = snprintf(meta.etag, ETAG_LEN, "\"%llx-%llx\"", (unsigned long long)meta.mtime_ns, (unsigned long long)st.st_size);
+		format_http_date(meta.last_modified, st.st_mtime);
+	}
+
+	/* 目录下一项的路径 */
+	static std::string child(const std::string& dir, const char* name)
+	{
+		return (dir == "/") ? "/" + std::string(name) : dir + "/" + name;
+	}
+
+	/**
+	 * @brief: 监视path所在的目录
+	 * @param path: 文件路径
+	 * @return: 没有inotify或者监视失败（例如超过了max_user_watches）时返回false
+	*/
+	bool watch_dir(const std::string& path)
+	{
+		if (inotify_fd < 0)
+		{
+			return false;
+		}
+		size_t slash = path.rfind('/');
+		std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+		if (watches.count(dir))
+		{
+			return true;
+		}
+		/* 经过符号链接的两个目录名指向同一个目录时，inotify返回同一个wd，所以一个wd可能对应多个目录名 */
+		int wd = inotify_add_watch(inotify_fd, dir.c_str(), WATCH_MASK);
+		if (wd < 0)
+		{
+			return false;
+		}
+		watches[dir] = wd;
+		watch_dirs[wd].push_back(dir);
+		return true;
+	}
+
+	/* 删除以prefix开头的所有条目 */
+	void erase_prefix(const std::string& prefix)
+	{
+		for (std::unordered_map<std::string, file_meta>::iterator it = entries.begin(); it != entries.end();)
+		{
+			if (it->first.compare(0, prefix.size(), prefix) == 0)
+			{
+				it = entries.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	/* 不再监视wd，删除它下面的所有条目 */
+	void remove_watch(int wd)
+	{
+		std::unordered_map<int, std::vector<std::string> >::iterator it = watch_dirs.find(wd);
+		if (it == watch_dirs.end())
+		{
+			return;
+		}
+		for (size_t i = 0; i < it->second.size(); i++)
+		{
+			watches.erase(it->second[i]);
+			erase_prefix(child(it->second[i], ""));
+		}
+		watch_dirs.erase(it);
+		inotify_rm_watch(inotify_fd, wd);	// 内核已经删除了监视时返回EINVAL，不要紧
+	}
+
+	/**
+	 * @brief: 目录被删除或者改名之后，它和它下面各级子目录的监视都指向了错误的路径，全部删除
+	 * @param dir: 目录原来的路径
+	*/
+	void forget_dir(const std::string& dir)
+	{
+		std::string prefix = child(dir, "");
+		erase_prefix(prefix);
+		std::vector<int> stale;
+		for (std::unordered_map<std::string, int>::iterator it = watches.begin(); it != watches.end(); ++it)
+		{
+			if (it->first == dir || it->first.compare(0, prefix.size(), prefix) == 0)
+			{
+				stale.push_back(it->second);
+			}
+		}
+		for (size_t i = 0; i < stale.size(); i++)
+		{
+			remove_watch(stale[i]);
+		}
+	}
+
+	/* 处理一个inotify事件 */
+	void handle_event(const struct inotify_event* event)
+	{
+		if (event->mask & IN_Q_OVERFLOW)	// 丢失了事件，不知道哪些条目过时了
+		{
+			entries.clear();
+			if (invalidate_cb)
+			{
+				invalidate_cb(NULL, invalidate_arg);
+			}
+			return;
+		}
+		std::unordered_map<int, std::vector<std::string> >::iterator it = watch_dirs.find(event->wd);
+		if (it == watch_dirs.end())
+		{
+			return;
+		}
+		if (event->len == 0)	// 被监视的目录本身被删除、改名，或者监视已被内核删除
+		{
+			if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+			{
+				remove_watch(event->wd);
+			}
+			return;
+		}
+		std::vector<std::string> dirs = it->second;	// forget_dir可能删除这个wd
+		for (size_t i = 0; i < dirs.size(); i++)
+		{
+			std::string path = child(dirs[i], event->name);
+			entries.erase(path);
+			if (invalidate_cb)
+			{
+				invalidate_cb(path.c_str(), invalidate_arg);
+			}
+			if ((event->mask & IN_ISDIR) && (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)))
+			{
+				forget_dir(path);
+			}
+		}
+	}
+
+private:
+	int inotify_fd;
+	invalidate_handler invalidate_cb;	// 作废回调函数，可以为NULL
+	void* invalidate_arg;
+	std::unordered_map<std::string, file_meta> entries;				// 路径到元数据
+	std::unordered_map<std::string, int> watches;					// 被监视的目录到wd
+	std::unordered_map<int, std::vector<std::string> > watch_dirs;	// wd到目录名
+	long long hit_count;
+	long long miss_count;
+};
+
+#endif  // FILE_CACHE_H
@@ -0,0 +1,157 @@
+#ifndef DEADLINE_HEAP_H
+#define DEADLINE_HEAP_H
+
+#include <stdlib.h>
+#include <time.h>
+
+/* 截止时间定时器。和11-6time_heap.h中的heap_timer一样由最小堆管理，多了heap_index记住自己在堆数组中的位置 */
+class deadline_timer
+{
+public:
+	deadline_timer() : expire(0), cb_func(NULL), user_data(NULL), heap_index(-1) {}
+
+	/* 是否在堆中等待到期 */
+	bool armed() const { return heap_index >= 0; }
+
+public:
+	time_t expire;				// 截止时间，绝对时间
+	void (*cb_func)(void*);		// 到期时调用的回调函数
+	void* user_data;			// 回调函数处理的连接
+	int heap_index;				// 在堆数组中的下标，不在堆中时为-1
+};
+
+/* 截止时间堆。time_heap删除定时器时只把回调函数置空（延迟销毁），适合很少删除的场合；
+	请求头部的截止时间在绝大多数连接上都会在到期之前撤销，延迟销毁会让堆数组随请求数膨胀，
+	所以这里按下标直接删除，add_timer和del_timer都是O(log n)。定时器由使用者持有（通常嵌在连接对象中），堆不负责释放
+*/
+class deadline_heap
+{
+public:
+	deadline_heap() : array(NULL), capacity(0), cur_size(0) {}
+	~deadline_heap() { free(array); }
+
+	/**
+	 * @brief: 添加定时器，已经在堆中时按新的截止时间调整位置
+	 * @param timer: 定时器，expire已经设置好
+	 * @return: 扩大堆数组失败时返回false
+	*/
+	bool add_timer(deadline_timer* timer)
+	{
+		if (timer->armed())
+		{
+			percolate_up(timer->heap_index);
+			percolate_down(timer->heap_index);
+			return true;
+		}
+		if (cur_size == capacity)	// 堆数组容量不够，扩大1倍
+		{
+			int new_capacity = capacity ? capacity * 2 : 64;
+			deadline_timer** temp = (deadline_timer**)realloc(array, new_capacity * sizeof(deadline_timer*));
+			if (!temp)
+			{
+				return false;
+			}
+			array = temp;
+			capacity = new_capacity;
+		}
+		place(timer, cur_size++);
+		percolate_up(timer->heap_index);
+		return true;
+	}
+
+	/* 把定时器从堆中删除，不在堆中时什么也不做 */
+	void del_timer(deadline_timer* timer)
+	{
+		int hole = timer->heap_index;
+		if (hole < 0)
+		{
+			return;
+		}
+		timer->heap_index = -1;
+		deadline_timer* last = array[--cur_size];
+		if (hole == cur_size)
+		{
+			return;
+		}
+		/* 用最后一个定时器填补空穴，它可能比空穴的父节点早，也可能比子节点晚 */
+		place(last, hole);
+		percolate_up(hole);
+		percolate_down(last->heap_index);
+	}
+
+	/**
+	 * @brief: 心搏函数，依次执行所有到期的定时器。定时器在调用回调函数之前已经离开堆，回调函数可以释放它或者重新添加它
+	 * @param cur: 当前时间
+	*/
+	void tick(time_t cur)
+	{
+		while (cur_size > 0 && array[0]->expire <= cur)
+		{
+			deadline_timer* timer = array[0];
+			del_timer(timer);
+			if (timer->cb_func)
+			{
+				timer->cb_func(timer->user_data);
+			}
+		}
+	}
+
+	/* 堆中的定时器数 */
+	int size() const { return cur_size; }
+
+private:
+	/* 把定时器放到堆数组的第i个位置 */
+	void place(deadline_timer* timer, int i)
+	{
+		array[i] = timer;
+		timer->heap_index = i;
+	}
+
+	/* 上虑操作：比父节点早时与之交换，直到根节点 */
+	void percolate_up(int hole)
+	{
+		deadline_timer* temp = array[hole];
+		while (hole > 0)
+		{
+			int parent = (hole - 1) / 2;
+			if (array[parent]->expire <= temp->expire)
+			{
+				break;
+			}
+			place(array[parent], hole);
+			hole = parent;
+		}
+		place(temp, hole);
+	}
+
+	/* 下虑操作，与11-6time_heap.h相同，另外维护heap_index */
+	void percolate_down(int hole)
+	{
+		deadline_timer* temp = array[hole];
+		int child = 0;
+		for (; (hole * 2 + 1) <= (cur_size - 1); hole = child)
+		{
+			child = hole * 2 + 1;
+			if ((child < (cur_size - 1)) && (array[child + 1]->expire < array[child]->expire))
+			{
+				++child;
+			}
+			if (array[child]->expire < temp->expire)
+			{
+				place(array[child], hole);
+			}
+			else
+			{
+				break;
+			}
+		}
+		place(temp, hole);
+	}
+
+private:
+	deadline_timer** array;	// 堆数组
+	int capacity;			// 堆数组的容量
+	int cur_size;			// 堆数组当前包含元素的个数
+};
+
+#endif  // DEADLINE_HEAP_H
@@ -0,0 +1,246 @@
+#ifndef MMAP_CACHE_H
+#define MMAP_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <unordered_map>
+#include "8-22file_cache.h"
+
+/* 热点小文件的只读映射缓存。应答直接用writev发送映射中的数据，文件内容留在页缓存里，不再复制到用户空间的缓冲区。
+	一个映射可能同时被多个尚未发完的应答引用，用引用计数管理：从缓存中淘汰或者因文件变化而作废的映射，
+	等最后一个应答释放之后才解除映射。映射按最近使用的顺序排成链表，总字节数超过预算时从链表尾部淘汰没有被引用的映射。
+	文件被修改时由file_meta_cache的inotify事件通知作废；取映射时还会核对修改时间和大小，事件尚未处理时也不会发出旧内容
+*/
+
+#define MAX_MAPPED_BYTES (64 * 1024 * 1024)	// 映射的总字节数预算
+#define MAX_MAPPED_FILES 4096				// 映射的文件数上限，每个映射占用一个VMA
+
+class mmap_cache;
+
+/* 一个文件的只读映射 */
+struct mapped_file
+{
+	mmap_cache* owner;		// 所属的缓存，应答释放映射时使用
+	std::string path;
+	char* data;				// 映射的起始地址
+	off_t size;				// 映射的长度，即映射时的文件大小
+	long long mtime_ns;		// 映射时文件的修改时间，和元数据不一致时说明文件已经变了
+	int refs;				// 正在引用它的应答数
+	bool stale;				// 已经离开缓存，最后一个引用释放时解除映射
+	mapped_file* prev;		// LRU链表，表头是最近使用的映射
+	mapped_file* next;
+};
+
+class mmap_cache
+{
+public:
+	mmap_cache(long long budget = MAX_MAPPED_BYTES) : max_bytes(budget), bytes(0), head(NULL), tail(NULL),
+		hit_count(0), miss_count(0) {}
+
+	~mmap_cache()
+	{
+		while (head)
+		{
+			detach(head);
+		}
+	}
+
+	/**
+	 * @brief: 取得文件的映射并增加引用计数，缓存中没有或者已经过时的时候重新映射
+	 * @param path: 文件路径
+	 * @param meta: 文件当前的元数据，来自file_meta_cache
+	 * @return: 映射，由调用者release；映射失败（包括文件在取得元数据之后又变了）时返回NULL，调用者改用read
+	*/
+	mapped_file* acquire(const char* path, const file_meta& meta)
+	{
+		std::string key(path);
+		std::unordered_map<std::string, mapped_file*>::iterator it = files.find(key);
+		if (it != files.end())
+		{
+			mapped_file* file = it->second;
+			if (file->mtime_ns == meta.mtime_ns && file->size == meta.size)
+			{
+				hit_count++;
+				unlink(file);
+				push_front(file);
+				file->refs++;
+				return file;
+			}
+			detach(file);
+		}
+		miss_count++;
+
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			return NULL;
+		}
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size != meta.size || st.st_size == 0
+			|| (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec != meta.mtime_ns)
+		{
+			close(fd);
+			return NULL;
+		}
+		void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);	// 映射不依赖文件描述符
+		if (data == MAP_FAILED)
+		{
+			return NULL;
+		}
+
+		mapped_file* file = new mapped_file;
+		file->owner = this;
+		file->path = key;
+		file->data = (char*)data;
+		file->size = st.st_size;
+		file->mtime_ns = meta.mtime_ns;
+		file->refs = 1;
+		file->stale = false;
+		push_front(file);
+		files[key] = file;
+		bytes += file->size;
+		evict();
+		return file;
+	}
+
+	/* 应答发完之后释放映射 */
+	void release(mapped_file* file)
+	{
+		if (--file->refs > 0)
+		{
+			return;
+		}
+		if (file->stale)
+		{
+			destroy(file);
+		}
+		else
+		{
+			evict();	// 超出预算时，刚刚被占用的映射现在可以淘汰了
+		}
+	}
+
+	/**
+	 * @brief: 文件有变化，让它的映射作废。作为file_meta_cache的作废回调函数
+	 * @param path: 文件路径，为NULL时所有映射都作废
+	*/
+	void invalidate(const char* path)
+	{
+		if (!path)
+		{
+			while (head)
+			{
+				detach(head);
+			}
+			return;
+		}
+		std::unordered_map<std::string, mapped_file*>::iterator it = files.find(path);
+		if (it != files.end())
+		{
+			detach(it->second);
+		}
+	}
+
+	/* 可以注册给file_meta_cache的作废回调函数，arg是mmap_cache */
+	static void on_invalidate(const char* path, void* arg) { ((mmap_cache*)arg)->invalidate(path); }
+
+	/* 映射的总字节数，包括已经作废但仍被引用的映射 */
+	long long mapped_bytes() const { return bytes; }
+
+	/* 缓存中的映射数 */
+	int size() const { return files.size(); }
+
+	/* 命中和未命中的次数 */
+	long long hits() const { return hit_count; }
+	long long misses() const { return miss_count; }
+
+private:
+	/* 把映射放到LRU链表头部 */
+	void push_front(mapped_file* file)
+	{
+		file->prev = NULL;
+		file->next = head;
+		if (head)
+		{
+			head->prev = file;
+		}
+		else
+		{
+			tail = file;
+		}
+		head = file;
+	}
+
+	/* 把映射从LRU链表中取下 */
+	void unlink(mapped_file* file)
+	{
+		if (file->prev)
+		{
+			file->prev->next = file->next;
+		}
+		else
+		{
+			head = file->next;
+		}
+		if (file->next)
+		{
+			file->next->prev = file->prev;
+		}
+		else
+		{
+			tail = file->prev;
+		}
+		file->prev = file->next = NULL;
+	}
+
+	/* 让映射离开缓存，没有引用时立即解除映射，否则等最后一个引用释放 */
+	void detach(mapped_file* file)
+	{
+		files.erase(file->path);
+		unlink(file);
+		file->stale = true;
+		if (file->refs == 0)
+		{
+			destroy(file);
+		}
+	}
+
+	/* 解除映射 */
+	void destroy(mapped_file* file)
+	{
+		munmap(file->data, file->size);
+		bytes -= file->size;
+		delete file;
+	}
+
+	/* 从LRU链表尾部淘汰没有被引用的映射，直到回到预算之内 */
+	void evict()
+	{
+		mapped_file* file = tail;
+		while (file && (bytes > max_bytes || (int)files.size() > MAX_MAPPED_FILES))
+		{
+			mapped_file* prev = file->prev;
+			if (file->refs == 0)
+			{
+				detach(file);
+			}
+			file = prev;
+		}
+	}
+
+private:
+	long long max_bytes;	// 映射的总字节数预算
+	long long bytes;		// 当前映射的总字节数
+	std::unordered_map<std::string, mapped_file*> files;	// 路径到映射
+	mapped_file* head;		// 最近使用的映射
+	mapped_file* tail;		// 最久没有使用的映射
+	long long hit_count;
+	long long miss_count;
+};
+
+#endif  // MMAP_CACHE_H
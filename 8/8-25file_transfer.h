@@ -0,0 +1,108 @@
+#ifndef FILE_TRANSFER_H
+#define FILE_TRANSFER_H
+
+#include <sys/types.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* 6-3testsendfile.cpp用一次阻塞的sendfile发送整个文件，不检查返回值；非阻塞socket上一次只能写出写缓冲区那么多。
+	这里的传输对象记住文件中下一个要发送的位置和剩余的长度，每次sendfile最多发送一片，
+	一次调用发送的总量受调用者给出的额度限制：额度用完时让出事件循环，一个高速的大文件下载不会饿死其他连接
+*/
+
+#define SENDFILE_SLICE (256 * 1024)	// 一次sendfile最多发送的字节数
+
+/* 传输的结果 */
+enum TRANSFER_STATUS {
+	TRANSFER_DONE = 0,	// 文件已经全部交给内核，文件已关闭
+	TRANSFER_AGAIN,		// socket写缓冲区已满，等待EPOLLOUT后继续
+	TRANSFER_YIELD,		// 本次的额度已经用完，socket仍然可写，应当让其他连接先运行
+	TRANSFER_ERROR		// 写出错，或者文件被截短了，连接应当关闭
+};
+
+class sendfile_transfer
+{
+public:
+	sendfile_transfer() : fd(-1), offset(0), remaining(0), sent(0) {}
+	~sendfile_transfer() { close_file(); }
+
+	/**
+	 * @brief: 开始一次传输，传输对象接管文件描述符
+	 * @param file_fd: 打开的文件
+	 * @param first: 第一个要发送的字节
+	 * @param length: 要发送的字节数
+	*/
+	void start(int file_fd, off_t first, off_t length)
+	{
+		close_file();
+		fd = file_fd;
+		offset = first;
+		remaining = length;
+		sent = 0;
+	}
+
+	/* 是否还有数据没有发送 */
+	bool active() const { return remaining > 0; }
+
+	/* 已经发送的字节数 */
+	off_t transferred() const { return sent; }
+
+	/**
+	 * @brief: 从上次停下的位置继续发送
+	 * @param sockfd: 非阻塞的socket
+	 * @param budget: 本次最多发送的字节数，返回时减去实际发送的字节数
+	 * @return: TRANSFER_STATUS
+	*/
+	TRANSFER_STATUS run(int sockfd, long long& budget)
+	{
+		while (remaining > 0)
+		{
+			if (budget <= 0)
+			{
+				return TRANSFER_YIELD;
+			}
+			off_t n = (remaining < SENDFILE_SLICE) ? remaining : SENDFILE_SLICE;
+			if (n > budget)
+			{
+				n = budget;
+			}
+			ssize_t ret = sendfile(sockfd, fd, &offset, n);
+			if (ret < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				return (errno == EAGAIN || errno == EWOULDBLOCK) ? TRANSFER_AGAIN : TRANSFER_ERROR;
+			}
+			if (ret == 0)	// 文件在stat之后被截短了，已经发出的Content-Length无法兑现
+			{
+				return TRANSFER_ERROR;
+			}
+			remaining -= ret;	// sendfile已经推进了offset
+			sent += ret;
+			budget -= ret;
+		}
+		close_file();
+		return TRANSFER_DONE;
+	}
+
+private:
+	void close_file()
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+
+private:
+	int fd;				// 要发送的文件，-1表示没有
+	off_t offset;		// 文件中下一个要发送的字节
+	off_t remaining;	// 尚未发送的字节数
+	off_t sent;			// 已经发送的字节数
+};
+
+#endif  // FILE_TRANSFER_H
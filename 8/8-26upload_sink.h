@@ -0,0 +1,359 @@
+#ifndef UPLOAD_SINK_H
+#define UPLOAD_SINK_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string>
+#include "8-25file_transfer.h"
+
+/* 上传的接收端。6-4testsplice.cpp把socket的数据splice进管道再splice回socket，这里反过来：socket -> 管道 -> 文件，
+	请求体不经过用户空间的缓冲区。Content-Length已知时先用fallocate为文件分配好空间，磁盘满在开始时就能发现，
+	文件也不会因为一点一点地增长而产生碎片。数据写进同一目录下的临时文件，收齐之后改名为目标文件，
+	传了一半的上传不会留下残缺的目标文件。上传的文件保持mkostemp创建时的0600，静态文件服务只发送所有人都可以读的文件，
+	所以未经认证的上传不会被当作网站内容发布出去，需要发布时由管理员检查之后再修改权限。和sendfile_transfer一样，一次调用最多接收额度那么多，socket没有数据时等待EPOLLIN。
+	分块传输的请求体需要解码，和随头部一起读进读缓冲区的那部分请求体一样，由请求体回调函数用write写入
+*/
+
+#define UPLOAD_PIPE_SIZE (1024 * 1024)	// 上传管道的容量，超过pipe-max-size时使用内核允许的大小
+
+/* 所有上传公用的管道。每次从socket splice进来的数据都立即全部写进文件，所以两次调用之间管道总是空的 */
+class upload_pipe
+{
+public:
+	upload_pipe() : capacity(0) { fd[0] = fd[1] = -1; }
+	~upload_pipe() { close_pipe(); }
+
+	/**
+	 * @brief: 创建管道并尽量扩大它的容量
+	 * @return: 创建失败时返回false
+	*/
+	bool init()
+	{
+		if (pipe2(fd, O_NONBLOCK | O_CLOEXEC) < 0)
+		{
+			fd[0] = fd[1] = -1;
+			capacity = 0;	// 之后的上传改用recv+write
+			return false;
+		}
+		fcntl(fd[1], F_SETPIPE_SZ, UPLOAD_PIPE_SIZE);	// 失败时保持默认容量
+		capacity = fcntl(fd[1], F_GETPIPE_SZ);
+		if (capacity <= 0)
+		{
+			capacity = 65536;
+		}
+		return true;
+	}
+
+	/* 写文件出错时管道中可能残留数据，丢弃它重新创建 */
+	bool reset()
+	{
+		close_pipe();
+		return init();
+	}
+
+	/* 管道的读端、写端和容量，管道创建失败时容量为0 */
+	int out() const { return fd[0]; }
+	int in() const { return fd[1]; }
+	int size() const { return capacity; }
+
+private:
+	void close_pipe()
+	{
+		if (fd[0] >= 0)
+		{
+			close(fd[0]);
+			close(fd[1]);
+			fd[0] = fd[1] = -1;
+		}
+	}
+
+private:
+	int fd[2];
+	int capacity;
+};
+
+/* 从socket接收请求体的方式 */
+enum UPLOAD_MODE {
+	UPLOAD_SPLICE = 0,	// socket -> 管道 -> 文件
+	UPLOAD_COPY			// recv到用户态缓冲区，再write进文件，作为对照
+};
+
+/**
+ * @brief: 上传失败时应答的状态码
+ * @param err: 失败的errno
+ * @return: 状态码
+*/
+inline int upload_status(int err)
+{
+	switch (err)
+	{
+	case ENOENT:
+	case ENOTDIR:
+		return 404;
+	case EACCES:
+	case EPERM:
+	case EROFS:
+	case EISDIR:
+		return 403;
+	case ENOSPC:
+	case EDQUOT:
+	case EFBIG:
+		return 507;
+	default:
+		return 500;
+	}
+}
+
+class upload_sink
+{
+public:
+	upload_sink() : fd(-1), mode(UPLOAD_SPLICE), length(-1), got(0), err(0), buf(NULL) {}
+	~upload_sink()
+	{
+		discard();
+		free(buf);
+	}
+
+	/**
+	 * @brief: 开始一次上传：在目标文件所在目录创建临时文件，长度已知时为它分配空间
+	 * @param target: 目标文件路径
+	 * @param content_length: 请求体长度，分块传输时为-1
+	 * @param upload_mode: 从socket接收请求体的方式
+	 * @return: 成功时返回0，失败时返回errno，之后failed()为true
+	*/
+	int start(const char* target, long long content_length, UPLOAD_MODE upload_mode = UPLOAD_SPLICE)
+	{
+		discard();
+		path = target;
+		temp = path + ".XXXXXX";
+		mode = upload_mode;
+		length = content_length;
+		got = 0;
+		err = 0;
+		fd = mkostemp(&temp[0], O_CLOEXEC);
+		if (fd < 0)
+		{
+			err = errno;
+			return err;
+		}
+		if (length > 0 && fallocate(fd, 0, 0, length) < 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+		{
+			fail(errno);
+			return err;
+		}
+		return 0;
+	}
+
+	/* 是否有一个上传正在进行 */
+	bool active() const { return fd >= 0; }
+
+	/* 上传是否已经失败，失败之后临时文件已删除，剩下的请求体应当丢弃 */
+	bool failed() const { return err != 0; }
+
+	/* 失败的errno */
+	int error() const { return err; }
+
+	/* 是否还有请求体要直接从socket接收：长度已知，而且还没有收齐 */
+	bool pending() const { return fd >= 0 && length >= 0 && got < length; }
+
+	/* 已经写进文件的字节数和请求体长度 */
+	long long received() const { return got; }
+	long long expected() const { return length; }
+
+	/**
+	 * @brief: 写入一段已经在内存中的请求体，请求体回调函数使用
+	 * @param data: 数据
+	 * @param len: 长度
+	 * @return: 出错时返回false，上传已经失败
+	*/
+	bool write(const char* data, int len)
+	{
+		while (len > 0 && fd >= 0)
+		{
+			ssize_t n = ::write(fd, data, len);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				fail(errno);
+				return false;
+			}
+			data += n;
+			len -= n;
+			got += n;
+		}
+		return fd >= 0;
+	}
+
+	/**
+	 * @brief: 从socket接收剩下的请求体，直到收齐、socket没有数据或者额度用完
+	 * @param sockfd: 非阻塞的socket
+	 * @param pipe: 公用的管道，UPLOAD_COPY方式不使用
+	 * @param budget: 本次最多接收的字节数，返回时减去实际接收的字节数
+	 * @return: TRANSFER_STATUS。TRANSFER_ERROR时如果failed()为true是写文件出错，否则是客户端在请求体收齐之前关闭了连接
+	*/
+	TRANSFER_STATUS run(int sockfd, upload_pipe& pipe, long long& budget)
+	{
+		while (pending())
+		{
+			if (budget <= 0)
+			{
+				return TRANSFER_YIELD;
+			}
+			if (mode == UPLOAD_SPLICE && pipe.size() == 0)	// 公用管道重建失败，剩下的请求体改用recv+write
+			{
+				mode = UPLOAD_COPY;
+			}
+			long long n = length - got;
+			int limit = (mode == UPLOAD_SPLICE) ? pipe.size() : UPLOAD_PIPE_SIZE;
+			if (n > limit)
+			{
+				n = limit;
+			}
+			if (n > budget)
+			{
+				n = budget;
+			}
+			ssize_t ret = (mode == UPLOAD_SPLICE) ? splice(sockfd, NULL, pipe.in(), NULL, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+				: recv_copy(sockfd, n);
+			if (ret < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				return (errno == EAGAIN || errno == EWOULDBLOCK) ? TRANSFER_AGAIN : TRANSFER_ERROR;
+			}
+			if (ret == 0)	// 客户端关闭了连接，请求体不完整
+			{
+				return TRANSFER_ERROR;
+			}
+			if (mode == UPLOAD_SPLICE && !drain(pipe, ret))
+			{
+				return TRANSFER_ERROR;
+			}
+			if (mode == UPLOAD_COPY && !write(buf, ret))	// write自己累计got
+			{
+				return TRANSFER_ERROR;
+			}
+			if (mode == UPLOAD_SPLICE)
+			{
+				got += ret;
+			}
+			budget -= ret;
+		}
+		return failed() ? TRANSFER_ERROR : TRANSFER_DONE;
+	}
+
+	/**
+	 * @brief: 请求体收齐之后，把临时文件改名为目标文件
+	 * @param replaced: 返回目标文件原来是否存在
+	 * @return: 成功时返回0，失败时返回errno
+	*/
+	int finish(bool& replaced)
+	{
+		if (fd < 0)
+		{
+			return err ? err : EBADF;
+		}
+		if (length >= 0 && got != length)
+		{
+			fail(EIO);
+			return err;
+		}
+		int ret = close(fd);	// 有的文件系统（例如NFS）在close时才报告写入错误
+		fd = -1;
+		replaced = (access(path.c_str(), F_OK) == 0);
+		if (ret < 0 || rename(temp.c_str(), path.c_str()) < 0)
+		{
+			err = errno;
+			unlink(temp.c_str());
+			return err;
+		}
+		return 0;
+	}
+
+	/* 放弃上传并清除失败状态，开始分析下一个请求之前调用 */
+	void reset()
+	{
+		discard();
+		err = 0;
+		length = -1;
+		got = 0;
+	}
+
+	/* 放弃上传，删除临时文件 */
+	void discard()
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			fd = -1;
+			unlink(temp.c_str());
+		}
+	}
+
+private:
+	/* 上传失败：记录errno，删除临时文件 */
+	void fail(int error)
+	{
+		err = error ? error : EIO;
+		discard();
+	}
+
+	/**
+	 * @brief: 把管道中刚刚splice进来的n个字节全部写进文件。写文件会阻塞到完成，管道的读端非阻塞不影响它
+	 * @param pipe: 管道
+	 * @param n: 管道中的字节数
+	 * @return: 出错时返回false，上传已经失败，管道已经重建
+	*/
+	bool drain(upload_pipe& pipe, ssize_t n)
+	{
+		while (n > 0)
+		{
+			ssize_t ret = splice(pipe.out(), NULL, fd, NULL, n, SPLICE_F_MOVE);
+			if (ret < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (ret <= 0)
+			{
+				fail(ret < 0 ? errno : EIO);
+				pipe.reset();
+				return false;
+			}
+			n -= ret;
+		}
+		return true;
+	}
+
+	/* UPLOAD_COPY方式：recv到用户态缓冲区 */
+	ssize_t recv_copy(int sockfd, long long n)
+	{
+		if (!buf && !(buf = (char*)malloc(UPLOAD_PIPE_SIZE)))
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		return recv(sockfd, buf, n, 0);
+	}
+
+private:
+	int fd;				// 临时文件，-1表示没有正在进行的上传
+	std::string path;	// 目标文件路径
+	std::string temp;	// 临时文件路径
+	UPLOAD_MODE mode;
+	long long length;	// 请求体长度，-1表示未知
+	long long got;		// 已经写进文件的字节数
+	int err;			// 失败的errno，0表示没有失败
+	char* buf;			// UPLOAD_COPY方式的缓冲区
+};
+
+#endif  // UPLOAD_SINK_H
@@ -0,0 +1,158 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "8-26upload_sink.h"
+
+/* 比较上传的两种接收方式：socket -> 管道 -> 文件的splice，和recv到用户态缓冲区再write。
+	发送线程在回环地址上发送指定大小的数据，接收端用epoll等待EPOLLIN，每次事件调用upload_sink::run，
+	收齐之后改名。报告吞吐量和接收线程每GB消耗的CPU时间。两种方式都只写进页缓存，不包括落盘的时间
+	编译：g++ -O2 -pthread 8-27upload_bench.cpp；用法：upload_bench 目录 [MB] [轮数]
+*/
+
+#define SEND_BUFFER_SIZE (1024 * 1024)
+
+static sockaddr_in server_addr;
+static long long upload_bytes;
+
+static double now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double thread_cpu()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 发送线程：连接接收端，发送upload_bytes字节 */
+static void* sender(void* arg)
+{
+	(void)arg;
+	char* buf = (char*)malloc(SEND_BUFFER_SIZE);
+	for (int i = 0; i < SEND_BUFFER_SIZE; i++)
+	{
+		buf[i] = (char)(i * 131);
+	}
+	int fd = socket(PF_INET, SOCK_STREAM, 0);
+	int ret = connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+	assert(ret == 0);
+	long long left = upload_bytes;
+	while (left > 0)
+	{
+		ssize_t n = send(fd, buf, left < SEND_BUFFER_SIZE ? left : SEND_BUFFER_SIZE, 0);
+		if (n <= 0)
+		{
+			break;
+		}
+		left -= n;
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+/**
+ * @brief: 用一种方式接收一次上传
+ * @param listenfd: 监听socket
+ * @param path: 目标文件
+ * @param mode: 接收方式
+ * @param pipe: 公用的管道
+*/
+static void bench(int listenfd, const char* path, UPLOAD_MODE mode, upload_pipe& pipe)
+{
+	pthread_t tid;
+	pthread_create(&tid, NULL, sender, NULL);
+	int connfd = accept(listenfd, NULL, NULL);
+	assert(connfd >= 0);
+	fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+	int epollfd = epoll_create1(0);
+	epoll_event event;
+	event.data.fd = connfd;
+	event.events = EPOLLIN | EPOLLET;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, connfd, &event);
+
+	double start = now();
+	double cpu = thread_cpu();
+	upload_sink sink;
+	TRANSFER_STATUS status = TRANSFER_ERROR;
+	if (sink.start(path, upload_bytes, mode) == 0)
+	{
+		while (1)
+		{
+			long long budget = 1024 * 1024;
+			status = sink.run(connfd, pipe, budget);
+			if (status == TRANSFER_AGAIN)
+			{
+				epoll_wait(epollfd, &event, 1, -1);
+			}
+			else if (status != TRANSFER_YIELD)
+			{
+				break;
+			}
+		}
+	}
+	bool replaced = false;
+	bool ok = (status == TRANSFER_DONE) && (sink.finish(replaced) == 0);
+	cpu = thread_cpu() - cpu;
+	double elapsed = now() - start;
+
+	pthread_join(tid, NULL);
+	close(epollfd);
+	close(connfd);
+	double gb = upload_bytes / 1e9;
+	printf("%-12s %7.0f MB/s  receiver cpu %5.3f s/GB  %s\n", (mode == UPLOAD_SPLICE) ? "splice" : "recv+write",
+		upload_bytes / 1e6 / elapsed, cpu / gb, ok ? "ok" : strerror(sink.error()));
+	unlink(path);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc <= 1)
+	{
+		printf("usage: %s directory [megabytes] [rounds]\n", basename(argv[0]));
+		return 1;
+	}
+	upload_bytes = ((argc > 2) ? atoll(argv[2]) : 1024) * 1024 * 1024;
+	int rounds = (argc > 3) ? atoi(argv[3]) : 3;
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/upload_bench.bin", argv[1]);
+
+	bzero(&server_addr, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	inet_pton(AF_INET, "127.0.0.1", &server_addr.sin_addr);
+	int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+	assert(listenfd >= 0);
+	int ret = bind(listenfd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+	assert(ret != -1);
+	ret = listen(listenfd, 5);
+	assert(ret != -1);
+	socklen_t len = sizeof(server_addr);
+	getsockname(listenfd, (struct sockaddr*)&server_addr, &len);
+
+	upload_pipe pipe;
+	if (!pipe.init())
+	{
+		printf("pipe failure\n");
+		return 1;
+	}
+	printf("%lld MB uploads, pipe size %d\n", upload_bytes >> 20, pipe.size());
+	for (int i = 0; i < rounds; i++)
+	{
+		bench(listenfd, path, UPLOAD_SPLICE, pipe);
+		bench(listenfd, path, UPLOAD_COPY, pipe);
+	}
+	close(listenfd);
+	return 0;
+}
@@ -8,229 +8,527 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "8-12http_parser.h"
+#include "8-15idle_timer.h"
+#include "8-17static_file.h"
+#include "8-20router.h"
+#include "8-23deadline_heap.h"
+#include "8-26upload_sink.h"
 
-#define BUFFER_SIZE 4096	// 读缓冲区大小 
+#define MAX_REQUEST_SIZE (32 * 1024)	// 默认情况下单个请求最多占用的读缓冲区大小
+#define MAX_PIPELINE 32		// 每个连接上最多排队等待发送的应答数
+#define FD_LIMIT 65536		// 文件描述符数量限制
+#define MAX_EVENT_NUMBER 1024	// epoll_wait一次最多返回的事件数
+#define TIMESLOT 1			// 检查空闲连接的间隔（秒）
+#define IDLE_TIMEOUT 15		// 连接空闲多久之后被关闭（秒）
+#define HEADER_TIMEOUT 10	// 从连接建立或者收到请求的第一个字节起，必须在多久之内收完请求头部（秒）
+#define MAX_HEADER_BYTES (16 * 1024)	// 请求头部的字节数上限
+#define MAX_HEADER_FIELDS 48	// 请求头部的字段数上限
 
-/* 主状态机的两种可能状态 */
-enum CHECK_STATE { 
-	CHECK_STATE_REQUESTLINE = 0,	// 当前正在分析请求行
-	CHECK_STATE_HEADER				// 当前正在分析头部字段
-};
-
-/* 从状态机的三种可能状态，即行的读取状态 */
-enum LINE_STATUS { 
-	LINE_OK = 0,	// 读取到一个完整的行
-	LINE_BAD,		// 行出错
-	LINE_OPEN		// 行数据尚且不完整
-};
+/* 一个客户连接的全部状态。原来main函数中的读写下标和主状态机都在parser中，
+	应答排在responses中，没有写完的部分（包括大文件）等EPOLLOUT之后继续写
+*/
+struct http_conn
+{
+	int sockfd;				// 连接socket
+	http_parser parser;		// 请求分析器，持有读缓冲区和状态机的状态
+	idle_timer* timer;		// 空闲超时定时器
+	deadline_timer head_timer;	// 请求头部的截止时间，一点一点发送头部的连接（slowloris）不会因为有活动而被延期
+	long long head_request;	// 截止时间属于第几个请求（已分析完的请求数），流水线上的下一个请求要重新计时
+	response_queue responses;	// 待发送的应答
+	request_arena arena;	// 当前请求的内存区，存放解码后的路径参数
+	bool closing;			// 应答发完之后关闭连接
+	long long body_bytes;	// 这个连接上收到的请求体总字节数
+	long long requests;		// 这个连接上已经分析完的请求数
+	upload_sink upload;		// 正在进行的上传，请求体写进文件
+	route_handler handler;	// 当前请求的路由，在head_cb中查找一次，dispatch直接使用
+	route_match match;		// 当前请求的路径参数，指向读缓冲区，随它一起修正
 
-/* 服务器处理HTTP请求的结果 */
-enum HTTP_CODE { 
-	NO_REQUEST, 		// 请求不完整，需要继续读取客户数据
-	GET_REQUEST, 		// 获得了一个完整的客户请求
-	BAD_REQUEST, 		// 客户请求有语法错误
-	FORBIDDEN_REQUEST,	// 客户对资源没有足够的访问权限
-	INTERNAL_ERROR, 	// 服务器内部错误
-	CLOSED_CONNECTION	// 客户端已经关闭连接
+	http_conn() : handler(NULL), match(&arena) {}
 };
 
-/* HTTP应答报文 */
-static const char* szret[] = { "I get a correct result\n", "Something wrong\n" };
+static int epollfd = -1;
+static const char* doc_root = NULL;	// 文档根目录
+static http_conn* users[FD_LIMIT];	// 以socket为下标的连接表
+static idle_timer_lst timer_lst;	// 空闲连接定时器链表
+static deadline_heap head_deadlines;	// 请求头部截止时间的时间堆
+static long long total_requests = 0;	// 已应答的请求数
+static long long total_responses = 0;	// 已经全部发出的应答数
+static long long total_bytes = 0;		// 全部发出的应答的总字节数
+static router routes;				// 动态内容的路由，没有匹配的请求按静态文件处理
+static file_meta_cache files;		// 静态文件的元数据缓存，inotify文件描述符也注册在epoll中
+static mmap_cache mappings;			// 热点小文件的映射缓存，随元数据一起作废
+static upload_pipe uploads;			// 所有上传公用的管道
 
 /**
- * @brief: 从状态机，用于解析出一行内容
- * @param buffer: 应用程序的读缓冲区
- * @param checked_index: 指向buffer中当前正在分析的字节
- * @param read_index: 指向buffer中客户数据尾部的下一字节
- * @return: LINE_STATUS类型状态
+ * @brief: 将文件描述符fd设置成非阻塞的
+ * @param fd: 文件描述符fd
+ * @return: 文件描述符fd原来的状态标志
 */
-LINE_STATUS parse_line(char* buffer, int& checked_index, int& read_index)
+int setnonblocking(int fd)
 {
-	char temp;
+	int old_option = fcntl(fd, F_GETFL);
+	int new_option = old_option | O_NONBLOCK;
+	fcntl(fd, F_SETFL, new_option);
+	return old_option;
+}
 
-	for (; checked_index < read_index; checked_index++)
+/**
+ * @brief: 将fd以ET模式注册到epoll内核事件表中。连接socket同时注册EPOLLIN和EPOLLOUT，
+ *		ET模式下EPOLLOUT只在socket从不可写变为可写时触发一次，所以之后不必再用epoll_ctl修改事件
+ * @param epollfd: 内核事件表
+ * @param fd: 文件描述符
+ * @param ptr: 事件携带的数据，监听socket为NULL
+*/
+void addfd(int epollfd, int fd, void* ptr)
+{
+	epoll_event event;
+	event.data.ptr = ptr;
+	event.events = EPOLLIN | EPOLLET;
+	if (ptr)
 	{
-		temp = buffer[checked_index];	// 当前要分析的字节
-		if (temp == '\r')	// 如果当前的字节是'\r'，即回车符，则说明可能读取到一个完整的行
-		{
-			if (checked_index + 1 == read_index)	// 如果'\r'字符是目前buffer中的最后一个被读入的数据，说明这次分析没有读入一个完整的行
-			{
-				return LINE_OPEN;
-			}
-			else if (buffer[checked_index + 1] == '\n')	// 如果下一个字符是'\n'，说明这次读取到一个完整的行
-			{
-				buffer[checked_index++] = '\0';
-				buffer[checked_index++] = '\0';
-				return LINE_OK;
-			}
-			return LINE_BAD;
-		}
-		else if (temp == '\n')	// 如果下一个字符是'\n'，说明这次可能读取到一个完整的行
-		{
-			if ((checked_index > 1) && buffer[checked_index - 1] == '\r')
-			{
-				buffer[checked_index-1] = '\0';
-				buffer[checked_index++] = '\0';
-				return LINE_OK;
-			}
-			return LINE_BAD;
-		}
+		event.events |= EPOLLOUT;
 	}
-	// 如果所有内容都分析完毕也没遇到'\r'字符，表示还需要继续读取客户数据
-	return LINE_OPEN;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+	setnonblocking(fd);
 }
 
 /**
- * @brief: 分析请求行
- * @param temp: http请求行
- * @param checkstate: 当前主状态机的状态
- * @return: HTTP_CODE类型状态
+ * @brief: 请求体回调函数，统计收到的请求体字节数；正在上传时写进文件，否则丢弃
+ * @param request: 当前请求，user_data指向所属的连接
+ * @param data: 一段请求体
+ * @param len: 这段请求体的长度
+ * @return: 总是接受，写文件出错由process在读取剩下的请求体之前处理
 */
-HTTP_CODE parse_requestline(char* temp, CHECK_STATE& checkstate)
+bool receive_body(http_request* request, const char* data, int len)
 {
-	char* url = strpbrk(temp, " \t");	// 检索字符串temp中第一个匹配字符串" \t"中字符的字符
-	if (!url)	// 如果请求行中没有空白字符或者'\t'字符，则请求必有问题 
+	http_conn* conn = (http_conn*)request->user_data;
+	conn->body_bytes += len;
+	if (conn->upload.active())
 	{
-		return BAD_REQUEST;
+		conn->upload.write(data, len);
 	}
-	*url++ = '\0';
+	return true;
+}
 
-	char* method = temp;
-	// 忽略大小写进行字符串比较
-	if (strcasecmp(method, "GET") == 0)	// 仅支持GET方法
-	{
-		printf("The request method is GET\n");
-	}
-	else
+/**
+ * @brief: 应答完成回调函数，统计发完的应答数和字节数
+ * @param response: 刚刚发完的应答
+ * @param arg: 没有使用
+*/
+void count_response(const http_response* response, void* arg)
+{
+	(void)arg;
+	total_responses++;
+	total_bytes += response->memory_len() + response->file.transferred();
+}
+
+/**
+ * @brief: 示例路由处理函数，返回服务器的连接数和已应答的请求数
+ * @param request: 请求
+ * @param match: 路由参数（没有）
+ * @return: 应答
+*/
+http_response* stats_handler(const http_request& request, route_match& match)
+{
+	(void)match;
+	char* body = (char*)malloc(256);
+	int len = body ? snprintf(body, 256, "connections: %d\nrequests: %lld\nsent: %lld responses, %lld bytes\nfile cache: %d entries, %lld hits, %lld misses\n"
+		"mmap cache: %d files, %lld bytes, %lld hits, %lld misses\n", timer_lst.size(), total_requests,
+		total_responses, total_bytes, files.size(), files.hits(), files.misses(), mappings.size(), mappings.mapped_bytes(), mappings.hits(), mappings.misses()) : 0;
+	return make_memory_response(200, CONTENT_TYPE_TEXT, body, len, request.keep_alive, request.method == HEAD);
+}
+
+/**
+ * @brief: 示例路由处理函数，取出解码后的路径参数name作为问候的对象
+ * @param request: 请求
+ * @param match: 路由参数
+ * @return: 应答，参数编码错误时返回400
+*/
+http_response* hello_handler(const http_request& request, route_match& match)
+{
+	const char* name = match.param("name");
+	if (!name)
 	{
-		return BAD_REQUEST;
+		return make_error_response(400, request.keep_alive, request.method == HEAD);
 	}
-	
-	url += strspn(url, " \t");	// 检索字符串url中第一个不在字符串" \t"中出现的字符下标
-	char* version = strpbrk(url, " \t");
-	if (!version)
+	int size = strlen(name) + 16;
+	char* body = (char*)malloc(size);
+	int len = body ? snprintf(body, size, "hello, %s\n", name) : 0;
+	return make_memory_response(200, CONTENT_TYPE_TEXT, body, len, request.keep_alive, request.method == HEAD);
+}
+
+/**
+ * @brief: 上传处理函数，请求体已经全部写进临时文件，把它改名为目标文件
+ * @param request: 请求
+ * @param match: 路由参数（文件名）
+ * @return: 应答，新建文件时返回201，替换已有文件时返回200
+*/
+http_response* upload_handler(const http_request& request, route_match& match)
+{
+	(void)match;
+	http_conn* conn = (http_conn*)request.user_data;
+	if (!conn->upload.active() && !conn->upload.failed())	// 路径不合法，上传没有开始
 	{
-		return BAD_REQUEST;
+		return make_error_response(403, request.keep_alive, false);
 	}
-	*version++ = '\0';
-	version += strspn(version, " \t");
-	if (strcasecmp(version, "HTTP/1.1") != 0)	// 仅支持HTTP/1.1
+	long long size = conn->upload.received();
+	bool replaced = false;
+	int err = conn->upload.finish(replaced);
+	if (err != 0)
 	{
-		return BAD_REQUEST;
+		return make_error_response(upload_status(err), request.keep_alive, false);
 	}
+	char* body = (char*)malloc(64);
+	int len = body ? snprintf(body, 64, "stored %lld bytes\n", size) : 0;
+	return make_memory_response(replaced ? 200 : 201, CONTENT_TYPE_TEXT, body, len, request.keep_alive, false);
+}
 
-	// 忽略大小写，将url前7个字符和 "http://" 比较
-	if (strncasecmp(url, "http://", 7) == 0)	// 检查url是否合法
+/**
+ * @brief: 头部回调函数。查找请求的路由并记在连接上，请求被路由到上传处理函数时开始上传，之后的请求体写进临时文件
+ * @param request: 当前请求，user_data指向所属的连接
+ * @return: 总是接受，上传失败由process或上传处理函数应答
+*/
+bool route_head(http_request* request)
+{
+	http_conn* conn = (http_conn*)request->user_data;
+	conn->upload.reset();
+	conn->handler = routes.find(*request, conn->match);
+	char path[FILENAME_LEN];
+	if (conn->handler == upload_handler && map_url(doc_root, request->url, request->url_len, path))
 	{
-		url += 7;
-		url = strchr(url, '/');	// 指向字符串url中字符'/'第一次出现的位置
+		/* 分块传输时长度未知，请求体只能解码之后由receive_body写入；公用管道创建失败时改用recv+write */
+		conn->upload.start(path, request->chunked ? -1 : request->content_length, (uploads.size() > 0) ? UPLOAD_SPLICE : UPLOAD_COPY);
 	}
+	return true;
+}
 
-	if (!url || url[0] != '/')
-	{
-		return BAD_REQUEST;
-	}
-	printf("The request URL is %s\n", url);
-	
-	// HTTP请求行处理完毕，状态转移到头部字段的分析
-	checkstate = CHECK_STATE_HEADER;
+/**
+ * @brief: 为分析完毕的请求生成应答：使用route_head找到的路由，没有匹配的路由时映射到文档根目录下的文件
+ * @param conn: 连接
+ * @return: 应答
+*/
+http_response* dispatch(http_conn* conn)
+{
+	const http_request& request = conn->parser.request;
+	route_handler handler = conn->handler;
+	conn->handler = NULL;
+	http_response* response = handler ? handler(request, conn->match) : make_file_response(doc_root, request, files, mappings);
+	conn->arena.reset();	// 应答不引用内存区中的数据
+	return response;
+}
+
+/**
+ * @brief: 重新注册连接的事件。ET模式下用EPOLL_CTL_MOD修改事件时，内核会重新检查fd是否就绪，
+ *		socket仍然可写就立即再产生一个EPOLLOUT，排在已经就绪的其他连接之后
+ * @param conn: 连接
+*/
+void rearm(http_conn* conn)
+{
+	epoll_event event;
+	event.data.ptr = conn;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	epoll_ctl(epollfd, EPOLL_CTL_MOD, conn->sockfd, &event);
+}
+
+/**
+ * @brief: 关闭连接，释放它的读缓冲区和定时器
+ * @param conn: 连接
+*/
+void close_conn(http_conn* conn)
+{
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->sockfd, 0);
+	close(conn->sockfd);
+	timer_lst.del_timer(conn->timer);
+	head_deadlines.del_timer(&conn->head_timer);
+	users[conn->sockfd] = NULL;
+	conn->parser.release();
+	conn->responses.clear();	// 关闭没有发完的文件
+	delete conn;
+}
 
-	return NO_REQUEST;
+/* 定时器回调函数，关闭空闲连接。定时器由tick删除 */
+void cb_func(void* user_data)
+{
+	http_conn* conn = (http_conn*)user_data;
+	conn->timer = NULL;
+	close_conn(conn);
 }
 
 /**
- * @brief: 分析头部字段
- * @param temp: http请求头
- * @return: HTTP_CODE
+ * @brief: 拒绝连接上的请求：立即把读缓冲区还给内存池，尽力发出排队的应答和出错应答，之后连接应当马上关闭。
+ *		不等EPOLLOUT，因为不读应答的客户端会一直占着连接，写不出去的应答就不发了
+ * @param conn: 连接
+ * @param code: 出错应答的状态码
 */
-HTTP_CODE parse_headers(char* temp)
+void reject(http_conn* conn, int code)
 {
-	// 遇到一个空行，说明得到了一个正确的http请求
-	if (temp[0] == '\0')
+	conn->parser.release();
+	conn->responses.push(make_error_response(code, false, false));
+	conn->responses.flush(conn->sockfd);
+	conn->closing = true;
+}
+
+/* 请求头部截止时间的回调函数，回复408并关闭连接 */
+void head_timeout_cb(void* user_data)
+{
+	http_conn* conn = (http_conn*)user_data;
+	reject(conn, 408);
+	close_conn(conn);
+}
+
+/**
+ * @brief: 连接处理完一次事件之后，按它是否在等待请求头部设置或撤销截止时间。
+ *		截止时间在开始等待一个头部时设置一次，之后收到的数据不会延后它；连接上第一个请求的等待从连接建立时开始。
+ *		同一次读入可能既结束了一个请求，又带来下一个流水线请求的部分头部，这时定时器仍在堆中，
+ *		但它属于上一个请求，要从现在起为新请求重新计时，否则正常的客户端也可能提前收到408
+ * @param conn: 连接
+ * @param cur: 当前时间
+*/
+void update_head_deadline(http_conn* conn, time_t cur)
+{
+	bool waiting = conn->parser.in_head() || (conn->requests == 0 && conn->parser.state() == CHECK_STATE_REQUESTLINE);
+	if (waiting && conn->head_timer.armed() && conn->head_request != conn->requests)
 	{
-		return GET_REQUEST;
+		head_deadlines.del_timer(&conn->head_timer);
 	}
-	else if (strncasecmp(temp, "Host:", 5) == 0)	// 处理"Host"头部字段
+	if (waiting && !conn->head_timer.armed())
 	{
-		temp += 5;
-		temp += strspn(temp, " \t");
-		printf("the request host is: %s\n", temp);
+		conn->head_timer.expire = cur + HEADER_TIMEOUT;
+		conn->head_request = conn->requests;
+		head_deadlines.add_timer(&conn->head_timer);
 	}
-	else	// 其他头部字段都不处理
-	{	
-		printf("I can not handle this header\n");
+	else if (!waiting)
+	{
+		head_deadlines.del_timer(&conn->head_timer);
 	}
-	
-	return NO_REQUEST;
 }
 
 /**
- * @brief: 分析HTTP请求的入口函数
- * @param buffer: 应用程序的读缓冲区
- * @param checked_index: 指向buffer中当前正在分析的字节
- * @param checkstate: 当前主状态机的状态
- * @param read_index: 指向buffer中客户数据尾部的下一字节
- * @param start_line: 行在buffer中的起始位置
- * @return:
+ * @brief: 处理连接上的读写事件。ET模式下每次事件都要把数据读到EAGAIN为止：
+ *		先分析缓冲区中已有的请求并生成应答，发完应答再读入新的数据；写缓冲区满时停止读取，等EPOLLOUT之后从这里继续
+ * @param conn: 连接
+ * @return: 连接应当关闭时返回false
 */
-HTTP_CODE parse_content(char* buffer, int& checked_index, CHECK_STATE& checkstate, int& read_index, int& start_line)
+bool process(http_conn* conn)
 {
-	LINE_STATUS linestatus = LINE_OK;	// 记录当前行的读取状态
-	HTTP_CODE retcode = NO_REQUEST;		// 记录http请求的处理结果
-
-	// 主状态机，用于从buffer中取出所有完整的行
-	while ((linestatus = parse_line(buffer, checked_index, read_index)) == LINE_OK)
+	http_parser& parser = conn->parser;
+	while (1)
 	{
-		char* temp = buffer + start_line;
-		printf("temp: %s\n", temp);
-		start_line = checked_index;	// 记录下一行的起始位置
+		/* 分析目前已经获得的所有客户数据。客户端可能一次发来多个流水线请求，逐个分析它们，并把各自的应答排入队列 */
+		bool batch_full = false;
+		HTTP_CODE result = NO_REQUEST;
+		while (!conn->closing)
+		{
+			if (conn->responses.size() >= MAX_PIPELINE)	// 先把这一批应答发出去
+			{
+				batch_full = true;
+				break;
+			}
+			result = parser.parse();
+			if (result != GET_REQUEST)
+			{
+				break;
+			}
+			total_requests++;
+			conn->requests++;
+			const http_response* response = conn->responses.push(dispatch(conn), parser.request.method == HEAD);
+			/* 客户端要求关闭连接，或者应答带有Connection: close（例如头部溢出后换成的500），之后的流水线请求都不再处理 */
+			if (!parser.request.keep_alive || !response->keep_alive)
+			{
+				conn->closing = true;
+			}
+		}
+		if (result != NO_REQUEST && result != GET_REQUEST)	// 请求有错误或者头部太大，应答之后关闭连接
+		{
+			reject(conn, (result == HEADER_TOO_LARGE) ? 431 : 400);
+			return false;
+		}
+		/* 把已经应答过的请求从缓冲区中移走，只保留尚未分析完的请求。应答不引用读缓冲区；
+			未分析完的请求可能已经在route_head中找到了路由，它的路径参数和请求一起修正 */
+		const char* url = parser.request.url;
+		parser.compact();
+		conn->match.rebase(url - parser.request.url);
 
-		switch (checkstate)
+		if (conn->responses.size() > 0)
 		{
-		case CHECK_STATE_REQUESTLINE:
-			retcode = parse_requestline(temp, checkstate);
-			if (retcode == BAD_REQUEST)
+			SEND_STATUS status = conn->responses.flush(conn->sockfd);
+			if (status == SEND_ERROR)
 			{
-				return BAD_REQUEST;
+				return false;
 			}
-			break;
-		case CHECK_STATE_HEADER:
-			retcode = parse_headers(temp);
-			if (retcode == BAD_REQUEST)
+			if (status == SEND_AGAIN)	// 写缓冲区已满，等待EPOLLOUT
 			{
-				return BAD_REQUEST;
+				return true;
 			}
-			else if (retcode == GET_REQUEST)
+			if (status == SEND_YIELD)	// 这个连接写得太多了，让其他连接先运行，剩下的请求和应答等下一轮
 			{
-				return GET_REQUEST;
+				rearm(conn);
+				return true;
 			}
-			break;
-		default:
-			return INTERNAL_ERROR;
 		}
-	}
+		if (conn->closing)
+		{
+			return false;
+		}
+		if (batch_full)	// 缓冲区中可能还有完整的请求没有分析
+		{
+			continue;
+		}
 
-	if (linestatus == LINE_OPEN)	// 没有读取到一个完整的行，需要进一步读取数据
-	{
-		return NO_REQUEST;
+		/* 上传的请求体不经过读缓冲区：缓冲区中的部分已经由receive_body写入，剩下的从socket直接splice进文件 */
+		if (parser.state() == CHECK_STATE_CONTENT && conn->upload.failed())	// 不再接收注定要丢弃的请求体
+		{
+			reject(conn, upload_status(conn->upload.error()));
+			return false;
+		}
+		if (parser.state() == CHECK_STATE_CONTENT && conn->upload.pending() && parser.drained())
+		{
+			long long budget = FLUSH_BUDGET;
+			long long before = conn->upload.received();
+			TRANSFER_STATUS status = conn->upload.run(conn->sockfd, uploads, budget);
+			parser.skip_body(conn->upload.received() - before);
+			conn->body_bytes += conn->upload.received() - before;
+			if (status == TRANSFER_ERROR)	// 写文件出错时应答，客户端提前关闭连接时直接关闭
+			{
+				if (conn->upload.failed())
+				{
+					reject(conn, upload_status(conn->upload.error()));
+				}
+				return false;
+			}
+			if (status == TRANSFER_AGAIN)	// socket没有数据了，等待EPOLLIN
+			{
+				return true;
+			}
+			if (status == TRANSFER_YIELD)
+			{
+				rearm(conn);
+				return true;
+			}
+			continue;	// 请求体收齐了，parse会返回这个请求
+		}
+
+		/* 取得读入位置，请求超过上限时拒绝该请求 */
+		int space = 0;
+		char* dest = parser.recv_space(space);
+		if (!dest)	// 读缓冲区达到上限，一般是头部太大
+		{
+			reject(conn, parser.in_head() ? 431 : 400);
+			return false;
+		}
+		int ret = recv(conn->sockfd, dest, space, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			/* 对于非阻塞IO，下面的条件成立表示数据已经全部读取完毕 */
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+		else if (ret == 0)	// 客户端关闭了连接，此时所有应答都已发出
+		{
+			return false;
+		}
+		parser.commit(ret);
 	}
-	else
+}
+
+/**
+ * @brief: 接受监听队列中的所有连接，为每个连接创建连接对象和定时器
+ * @param listenfd: 监听socket
+ * @param max_request_bytes: 单个请求最多占用的读缓冲区大小
+*/
+void accept_conns(int listenfd, int max_request_bytes)
+{
+	while (1)
 	{
-		return BAD_REQUEST;
+		struct sockaddr_in client_address;
+		socklen_t client_addrlength = sizeof(client_address);
+		int connfd = accept(listenfd, (sockaddr*)&client_address, &client_addrlength);
+		if (connfd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			{
+				printf("accept failed, errno is: %d\n", errno);
+			}
+			return;
+		}
+		if (connfd >= FD_LIMIT)
+		{
+			close(connfd);
+			continue;
+		}
+		http_conn* conn = new http_conn;
+		conn->sockfd = connfd;
+		conn->closing = false;
+		conn->body_bytes = 0;
+		conn->requests = 0;
+		if (!conn->parser.init(max_request_bytes))
+		{
+			close(connfd);
+			delete conn;
+			continue;
+		}
+		conn->parser.request.head_cb = route_head;
+		conn->parser.request.body_cb = receive_body;
+		conn->parser.request.user_data = conn;
+		conn->parser.request.max_head_bytes = MAX_HEADER_BYTES;
+		conn->parser.request.max_fields = MAX_HEADER_FIELDS;
+		conn->responses.set_done_handler(count_response, NULL);
+		/* 创建定时器，设置其回调函数与超时时间，然后绑定定时器与连接，最后将定时器添加到链表timer_lst中 */
+		idle_timer* timer = new idle_timer;
+		timer->user_data = conn;
+		timer->cb_func = cb_func;
+		timer->expire = time(NULL) + IDLE_TIMEOUT;
+		conn->timer = timer;
+		timer_lst.add_timer(timer);
+		/* 第一个请求头部的截止时间从现在开始计算，只连接不发送的客户端也会按时被关闭 */
+		conn->head_timer.user_data = conn;
+		conn->head_timer.cb_func = head_timeout_cb;
+		conn->head_timer.expire = time(NULL) + HEADER_TIMEOUT;
+		conn->head_request = 0;
+		head_deadlines.add_timer(&conn->head_timer);
+		users[connfd] = conn;
+		addfd(epollfd, connfd, conn);
 	}
 }
 
-
 int main(int argc, char* argv[])
 {
-	if (argc <= 2)
+	if (argc <= 3)
 	{
-		printf("usage: %s ip_address port_number\n", basename(argv[0]));
+		printf("usage: %s ip_address port_number doc_root [max_request_bytes]\n", basename(argv[0]));
 		return 1;
 	}
-	
+
 	const char* ip = argv[1];
 	int port = atoi(argv[2]);
+	doc_root = argv[3];
+	routes.add(GET, "/stats", stats_handler);
+	routes.add(GET, "/hello/:name", hello_handler);
+	routes.add(PUT, "/upload/:name", upload_handler);	// 上传到文档根目录下的upload目录，文件只有属主可读，不会被静态文件服务发送
+	/* 单个请求最多占用的读缓冲区大小，超过它的请求（例如带有巨大Cookie的请求）被拒绝 */
+	int max_request_bytes = (argc > 4) ? atoi(argv[4]) : MAX_REQUEST_SIZE;
+
+	/* 把文件描述符数量的软限制提高到硬限制，以便同时服务上万个连接 */
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	if (!uploads.init())
+	{
+		printf("pipe unavailable, uploads will use recv and write\n");
+	}
+	/* 客户端关闭连接之后再写socket会产生SIGPIPE，忽略它，由writev和sendfile返回的错误处理 */
+	signal(SIGPIPE, SIG_IGN);
 
 	struct sockaddr_in address;
 	bzero(&address, sizeof(address));
@@ -240,63 +538,84 @@ int main(int argc, char* argv[])
 
 	int listenfd = socket(PF_INET, SOCK_STREAM, 0);
 	assert(listenfd >= 0);
+	int reuse = 1;
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 	int ret = bind(listenfd,(const sockaddr*)&address, sizeof(address));
 	assert(ret != -1);
-	ret = listen(listenfd, 5);
+	ret = listen(listenfd, SOMAXCONN);	// 大量客户同时连接时，监听队列要足够长
 	assert(ret != -1);
 
-	struct sockaddr_in client_address;
-	socklen_t client_addrlength = sizeof(client_address);
-	int fd = accept(listenfd, (sockaddr*)&client_address, &client_addrlength);
-	if (fd < 0)
+	epoll_event events[MAX_EVENT_NUMBER];
+	epollfd = epoll_create(5);
+	assert(epollfd != -1);
+	addfd(epollfd, listenfd, NULL);
+	/* inotify文件描述符以files的地址作为事件数据，与连接区分开 */
+	if (files.init())
 	{
-		printf("errno is: %d\n", errno);
+		files.set_invalidate_handler(mmap_cache::on_invalidate, &mappings);
+		epoll_event event;
+		event.data.ptr = &files;
+		event.events = EPOLLIN | EPOLLET;
+		epoll_ctl(epollfd, EPOLL_CTL_ADD, files.fd(), &event);
 	}
 	else
 	{
-		char buffer[BUFFER_SIZE];	// 读缓冲区
-		memset(buffer, '\0', BUFFER_SIZE);
-		int data_read = 0;			
-		int read_index = 0;			// 当前已经读取了多少字节的客户数据
-		int checked_index = 0;		// 当前已经分析了多少字节的客户数据
-		int start_line = 0;			// 行在buffer中的起始位置
-
-		CHECK_STATE checkstate = CHECK_STATE_REQUESTLINE;	// 主状态机的初始状态
-		while (1)	// 循环读取数据并分析
+		printf("inotify unavailable, file metadata will not be cached\n");
+	}
+
+	/* 用epoll_wait的超时参数驱动定时器，每TIMESLOT秒检查一次空闲连接 */
+	time_t last_tick = time(NULL);
+	long long last_requests = 0;
+	while (1)
+	{
+		int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, TIMESLOT * 1000);
+		if ((number < 0) && (errno != EINTR))
+		{
+			printf("epoll failure\n");
+			break;
+		}
+
+		/* Date头部每秒只格式化一次，同一秒内的应答直接复制它 */
+		time_t cur = time(NULL);
+		current_date().update(cur);
+		for (int i = 0; i < number; i++)
 		{
-			data_read = recv(fd, buffer + read_index, BUFFER_SIZE - read_index, 0);
-			if (data_read == -1)
+			if (events[i].data.ptr == &files)	// 文档根目录下有文件变化，删除过时的元数据
 			{
-				printf("reading failed!\n");
-				break;
+				files.process_events();
+				continue;
 			}
-			else if (data_read == 0)
+			http_conn* conn = (http_conn*)events[i].data.ptr;
+			if (!conn)	// 监听socket上有新的连接
 			{
-				printf("remote client has closed the connection\n");
-				break;
+				accept_conns(listenfd, max_request_bytes);
 			}
-			
-			read_index += data_read;
-
-			// 分析目前已经获得的所有客户数据
-			HTTP_CODE result = parse_content(buffer, checked_index, checkstate, read_index, start_line);
-			if (result == NO_REQUEST)
+			else if (!process(conn))
 			{
-				continue;
+				close_conn(conn);
 			}
-			else if (result == GET_REQUEST)
+			else
 			{
-				send(fd, szret[0], strlen(szret[0]), 0);
-				break;
+				/* 连接上有活动，延迟它被关闭的时间；但请求头部的截止时间不因此延后 */
+				timer_lst.adjust_timer(conn->timer, cur + IDLE_TIMEOUT);
+				update_head_deadline(conn, cur);
 			}
-			else
+		}
+
+		/* 最后处理定时任务，因为I/O事件有更高的优先级 */
+		if (cur - last_tick >= TIMESLOT)
+		{
+			timer_lst.tick();
+			head_deadlines.tick(cur);
+			if (total_requests != last_requests)
 			{
-				send(fd, szret[1], strlen(szret[1]), 0);
-				break;
+				printf("%d connections, %lld requests/s\n", timer_lst.size(), (total_requests - last_requests) / (cur - last_tick));
+				last_requests = total_requests;
 			}
+			last_tick = cur;
 		}
-		close(fd);
 	}
+	close(epollfd);
 	close(listenfd);
 	return 0;
-}
\ No newline at end of file
+}
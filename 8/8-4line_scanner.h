@@ -0,0 +1,111 @@
+#ifndef LINE_SCANNER_H
+#define LINE_SCANNER_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINE_SCANNER_X86
+#endif
+
+/* 行扫描函数的类型：在buffer的[begin, end)区间中查找第一个'\r'或'\n'，找不到时返回end */
+typedef int (*crlf_scanner)(const char* buffer, int begin, int end);
+
+/**
+ * @brief: 标量版本，逐字节查找行结束符，也用于处理向量版本剩下的不足一个向量的尾部
+ * @param buffer: 待扫描的缓冲区
+ * @param begin: 扫描起始位置
+ * @param end: 扫描结束位置（不包含）
+ * @return: 第一个'\r'或'\n'的下标，找不到时返回end
+*/
+inline int scan_crlf_scalar(const char* buffer, int begin, int end)
+{
+	for (; begin < end; begin++)
+	{
+		char temp = buffer[begin];
+		if (temp == '\r' || temp == '\n')
+		{
+			break;
+		}
+	}
+	return begin;
+}
+
+#ifdef LINE_SCANNER_X86
+/**
+ * @brief: SSE2版本，每次比较16个字节
+ * @param buffer: 待扫描的缓冲区
+ * @param begin: 扫描起始位置
+ * @param end: 扫描结束位置（不包含）
+ * @return: 第一个'\r'或'\n'的下标，找不到时返回end
+*/
+__attribute__((target("sse2")))
+inline int scan_crlf_sse2(const char* buffer, int begin, int end)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	/* 只加载完整落在[begin, end)中的16字节，绝不越过read_index读取 */
+	while (begin + 16 <= end)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(buffer + begin));
+		__m128i hit = _mm_or_si128(_mm_cmpeq_epi8(block, cr), _mm_cmpeq_epi8(block, lf));
+		int mask = _mm_movemask_epi8(hit);  // 每个匹配字节对应掩码中的一位
+		if (mask != 0)
+		{
+			return begin + __builtin_ctz(mask);
+		}
+		begin += 16;
+	}
+	return scan_crlf_scalar(buffer, begin, end);
+}
+
+/**
+ * @brief: AVX2版本，每次比较32个字节，剩余部分交给SSE2版本
+ * @param buffer: 待扫描的缓冲区
+ * @param begin: 扫描起始位置
+ * @param end: 扫描结束位置（不包含）
+ * @return: 第一个'\r'或'\n'的下标，找不到时返回end
+*/
+__attribute__((target("avx2")))
+inline int scan_crlf_avx2(const char* buffer, int begin, int end)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	while (begin + 32 <= end)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)(buffer + begin));
+		__m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(block, cr), _mm256_cmpeq_epi8(block, lf));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+		if (mask != 0)
+		{
+			return begin + __builtin_ctz(mask);
+		}
+		begin += 32;
+	}
+	return scan_crlf_sse2(buffer, begin, end);
+}
+#endif
+
+/**
+ * @brief: 根据CPU在运行时支持的指令集选择最快的扫描函数
+ * @return: 选中的扫描函数
+*/
+inline crlf_scanner select_crlf_scanner()
+{
+#ifdef LINE_SCANNER_X86
+	/* 本函数在静态初始化阶段被调用，此时必须先手动初始化CPU特性信息 */
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return scan_crlf_avx2;
+	}
+	if (__builtin_cpu_supports("sse2"))
+	{
+		return scan_crlf_sse2;
+	}
+#endif
+	return scan_crlf_scalar;
+}
+
+/* 程序启动时确定一次，之后每次调用都只是一次间接跳转 */
+static const crlf_scanner scan_crlf = select_crlf_scanner();
+
+#endif  // LINE_SCANNER_H
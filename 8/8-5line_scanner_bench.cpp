@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "8-4line_scanner.h"
+
+#define BENCH_BUFFER_SIZE (256 * 1024)	// 每轮扫描的数据量
+#define BENCH_ROUNDS 200				// 每种扫描器重复的轮数
+
+/* 模拟头部较多的浏览器请求，其中包含一个较长的Cookie行 */
+static const char* sample_request =
+	"GET /index.html?from=bench HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Cookie: session=7f3a9c2e4b1d8f6a0e5c3b9d7a1f4e2c; theme=dark; tracking=a8d7f6e5c4b3a2918f7e6d5c4b3a2918f7e6d5c4b3a2918f7e6d5c4b3a2918f7e6d5c4b3a2918f7e6d5c4b3a29\r\n"
+	"Connection: keep-alive\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"If-Modified-Since: Tue, 15 Nov 1994 08:12:31 GMT\r\n"
+	"\r\n";
+
+/**
+ * @brief: 读取时间戳计数器，在非x86平台上退化为纳秒计数
+ * @return: 当前的周期数（或纳秒数）
+*/
+static inline unsigned long long read_cycles()
+{
+#ifdef LINE_SCANNER_X86
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief: 用给定的扫描器像parse_line那样逐行走完整个缓冲区
+ * @param scanner: 被测的扫描函数
+ * @param buffer: 待扫描的缓冲区
+ * @param len: 缓冲区长度
+ * @return: 找到的行数，用于校验各扫描器结果一致，同时防止循环被编译器优化掉
+*/
+static int walk_lines(crlf_scanner scanner, const char* buffer, int len)
+{
+	int lines = 0;
+	int index = 0;
+	while (index < len)
+	{
+		index = scanner(buffer, index, len);
+		if (index == len)
+		{
+			break;
+		}
+		index += (buffer[index] == '\r') ? 2 : 1;	// 跳过"\r\n"
+		lines++;
+	}
+	return lines;
+}
+
+/**
+ * @brief: 测量一个扫描器的速度并打印字节/周期
+ * @param name: 扫描器名称
+ * @param scanner: 被测的扫描函数
+ * @param buffer: 待扫描的缓冲区
+ * @param len: 缓冲区长度
+ * @param baseline: 标量版本的字节/周期，为0时不打印加速比
+ * @return: 字节/周期
+*/
+static double bench(const char* name, crlf_scanner scanner, const char* buffer, int len, double baseline)
+{
+	int lines = walk_lines(scanner, buffer, len);	// 预热，同时得到行数
+	unsigned long long best = ~0ULL;
+	for (int i = 0; i < BENCH_ROUNDS; i++)
+	{
+		unsigned long long start = read_cycles();
+		int ret = walk_lines(scanner, buffer, len);
+		unsigned long long cost = read_cycles() - start;
+		if (ret != lines)
+		{
+			printf("%s: line count mismatch\n", name);
+			exit(1);
+		}
+		if (cost < best)
+		{
+			best = cost;
+		}
+	}
+	double bpc = (double)len / (double)best;
+	if (baseline > 0)
+	{
+		printf("%-8s %8d lines  %6.2f bytes/cycle  x%.2f\n", name, lines, bpc, bpc / baseline);
+	}
+	else
+	{
+		printf("%-8s %8d lines  %6.2f bytes/cycle\n", name, lines, bpc);
+	}
+	return bpc;
+}
+
+int main()
+{
+	/* 用样例请求填满基准缓冲区 */
+	char* buffer = new char[BENCH_BUFFER_SIZE];
+	int sample_len = strlen(sample_request);
+	int len = 0;
+	while (len + sample_len <= BENCH_BUFFER_SIZE)
+	{
+		memcpy(buffer + len, sample_request, sample_len);
+		len += sample_len;
+	}
+
+	printf("scanning %d bytes, best of %d rounds\n", len, BENCH_ROUNDS);
+	double scalar = bench("scalar", scan_crlf_scalar, buffer, len, 0);
+	int expect = walk_lines(scan_crlf_scalar, buffer, len);
+#ifdef LINE_SCANNER_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		bench("sse2", scan_crlf_sse2, buffer, len, scalar);
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		bench("avx2", scan_crlf_avx2, buffer, len, scalar);
+	}
+#endif
+	/* 运行时选中的版本，即parse_line实际使用的扫描器 */
+	bench("dispatch", scan_crlf, buffer, len, scalar);
+	if (walk_lines(scan_crlf, buffer, len) != expect)
+	{
+		printf("dispatched scanner disagrees with scalar scanner\n");
+		delete[] buffer;
+		return 1;
+	}
+
+	delete[] buffer;
+	return 0;
+}
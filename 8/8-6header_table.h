@@ -0,0 +1,239 @@
+#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#define MAX_HEADERS 64	// 每个请求最多保存的头部字段数
+
+/* 常用头部字段的编号，处理函数通过编号以O(1)的代价取出对应字段 */
+enum HEADER_ID {
+	HEADER_HOST = 0,
+	HEADER_CONTENT_LENGTH,
+	HEADER_CONNECTION,
+	HEADER_TRANSFER_ENCODING,
+	HEADER_IF_MODIFIED_SINCE,
+	HEADER_IF_NONE_MATCH,
+	HEADER_IF_RANGE,
+	HEADER_RANGE,
+	HEADER_ACCEPT_ENCODING,
+	HEADER_CONTENT_TYPE,
+	HEADER_USER_AGENT,
+	HEADER_COOKIE,
+	HEADER_EXPECT,
+	HEADER_ACCEPT,
+	HEADER_REFERER,
+	HEADER_AUTHORIZATION,
+	HEADER_CACHE_CONTROL,
+	HEADER_UPGRADE,
+	HEADER_COUNT,					// 常用头部字段的个数
+	HEADER_UNKNOWN = HEADER_COUNT	// 不在上面列表中的头部字段
+};
+
+/* 常用头部字段的名字，下标即HEADER_ID */
+struct known_header
+{
+	const char* name;
+	int len;
+};
+
+static constexpr known_header known_headers[HEADER_COUNT] = {
+	{ "Host", 4 },
+	{ "Content-Length", 14 },
+	{ "Connection", 10 },
+	{ "Transfer-Encoding", 17 },
+	{ "If-Modified-Since", 17 },
+	{ "If-None-Match", 13 },
+	{ "If-Range", 8 },
+	{ "Range", 5 },
+	{ "Accept-Encoding", 15 },
+	{ "Content-Type", 12 },
+	{ "User-Agent", 10 },
+	{ "Cookie", 6 },
+	{ "Expect", 6 },
+	{ "Accept", 6 },
+	{ "Referer", 7 },
+	{ "Authorization", 13 },
+	{ "Cache-Control", 13 },
+	{ "Upgrade", 7 },
+};
+
+#define HEADER_HASH_SIZE 32		// 散列表大小，必须是2的幂
+
+/**
+ * @brief: 头部字段名的散列函数，只取长度、首字符和尾字符（忽略大小写），对上面的常用字段是完美散列
+ * @param name: 字段名
+ * @param len: 字段名长度，必须大于0
+ * @return: [0, HEADER_HASH_SIZE)中的槽位
+*/
+constexpr int header_hash(const char* name, int len)
+{
+	return (len + 7 * (name[0] | 0x20) + 24 * (name[len - 1] | 0x20)) & (HEADER_HASH_SIZE - 1);
+}
+
+/* 由上面的散列函数离线算出的槽位表，每个槽位至多对应一个常用字段 */
+static constexpr HEADER_ID header_slots[HEADER_HASH_SIZE] = {
+	HEADER_UNKNOWN,				// 0
+	HEADER_UNKNOWN,				// 1
+	HEADER_CACHE_CONTROL,		// 2
+	HEADER_CONTENT_LENGTH,		// 3
+	HEADER_AUTHORIZATION,		// 4
+	HEADER_TRANSFER_ENCODING,	// 5
+	HEADER_UNKNOWN,				// 6
+	HEADER_UNKNOWN,				// 7
+	HEADER_IF_MODIFIED_SINCE,	// 8
+	HEADER_EXPECT,				// 9
+	HEADER_UNKNOWN,				// 10
+	HEADER_UNKNOWN,				// 11
+	HEADER_IF_NONE_MATCH,		// 12
+	HEADER_ACCEPT,				// 13
+	HEADER_UNKNOWN,				// 14
+	HEADER_CONNECTION,			// 15
+	HEADER_UNKNOWN,				// 16
+	HEADER_UNKNOWN,				// 17
+	HEADER_UPGRADE,				// 18
+	HEADER_COOKIE,				// 19
+	HEADER_UNKNOWN,				// 20
+	HEADER_REFERER,				// 21
+	HEADER_UNKNOWN,				// 22
+	HEADER_UNKNOWN,				// 23
+	HEADER_UNKNOWN,				// 24
+	HEADER_CONTENT_TYPE,		// 25
+	HEADER_UNKNOWN,				// 26
+	HEADER_RANGE,				// 27
+	HEADER_HOST,				// 28
+	HEADER_USER_AGENT,			// 29
+	HEADER_ACCEPT_ENCODING,		// 30
+	HEADER_IF_RANGE,			// 31
+};
+
+/* 编译期检查：每个常用字段都恰好落在槽位表中属于它的位置上，增删字段后若散列不再完美则无法通过编译 */
+constexpr bool check_header_slots(int id)
+{
+	return (id == HEADER_COUNT)
+		|| ((header_slots[header_hash(known_headers[id].name, known_headers[id].len)] == id) && check_header_slots(id + 1));
+}
+static_assert(check_header_slots(0), "header_slots does not match header_hash");
+
+/**
+ * @brief: 把字段名映射到HEADER_ID，一次散列加一次比较，不分配内存
+ * @param name: 字段名，不要求以'\0'结尾
+ * @param len: 字段名长度
+ * @return: 对应的HEADER_ID，非常用字段返回HEADER_UNKNOWN
+*/
+inline HEADER_ID lookup_header(const char* name, int len)
+{
+	if (len <= 0)
+	{
+		return HEADER_UNKNOWN;
+	}
+	HEADER_ID id = header_slots[header_hash(name, len)];
+	if ((id != HEADER_UNKNOWN) && (known_headers[id].len == len) && (strncasecmp(known_headers[id].name, name, len) == 0))
+	{
+		return id;
+	}
+	return HEADER_UNKNOWN;
+}
+
+/* 一个头部字段，只记录字段名和字段值在读缓冲区中的位置和长度，不复制数据 */
+struct header_entry
+{
+	const char* name;
+	int name_len;
+	const char* value;
+	int value_len;
+	HEADER_ID id;
+};
+
+/* 每个请求一张的头部字段表 */
+class header_table
+{
+public:
+	header_table() { clear(); }
+
+	/* 开始分析一个新请求前清空字段表 */
+	void clear()
+	{
+		count = 0;
+		memset(known, -1, sizeof(known));
+	}
+
+	/**
+	 * @brief: 记录一个头部字段
+	 * @param name: 字段名在读缓冲区中的位置
+	 * @param name_len: 字段名长度
+	 * @param value: 字段值在读缓冲区中的位置
+	 * @param value_len: 字段值长度
+	 * @return: 字段表已满时返回false
+	*/
+	bool add(const char* name, int name_len, const char* value, int value_len)
+	{
+		if (count >= MAX_HEADERS)
+		{
+			return false;
+		}
+		header_entry& entry = entries[count];
+		entry.name = name;
+		entry.name_len = name_len;
+		entry.value = value;
+		entry.value_len = value_len;
+		entry.id = lookup_header(name, name_len);
+		/* 同名的常用字段只索引第一次出现的那个，其余的仍保存在entries中 */
+		if ((entry.id != HEADER_UNKNOWN) && (known[entry.id] < 0))
+		{
+			known[entry.id] = count;
+		}
+		count++;
+		return true;
+	}
+
+	/* 以O(1)的代价取出一个常用字段，不存在时返回NULL */
+	const header_entry* get(HEADER_ID id) const
+	{
+		return (known[id] < 0) ? NULL : &entries[(int)known[id]];
+	}
+
+	/**
+	 * @brief: 按名字查找任意字段，常用字段走散列，其他字段逐个比较
+	 * @param name: 字段名
+	 * @param len: 字段名长度
+	 * @return: 找到的字段，不存在时返回NULL
+	*/
+	const header_entry* find(const char* name, int len) const
+	{
+		HEADER_ID id = lookup_header(name, len);
+		if (id != HEADER_UNKNOWN)
+		{
+			return get(id);
+		}
+		for (int i = 0; i < count; i++)
+		{
+			if ((entries[i].name_len == len) && (strncasecmp(entries[i].name, name, len) == 0))
+			{
+				return &entries[i];
+			}
+		}
+		return NULL;
+	}
+
+	/* 读缓冲区中的数据整体前移delta字节（或被搬到另一个内存块，delta为两者地址之差）后，调整已记录的位置 */
+	void rebase(ptrdiff_t delta)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			entries[i].name -= delta;
+			entries[i].value -= delta;
+		}
+	}
+
+	int size() const { return count; }
+	const header_entry& at(int i) const { return entries[i]; }
+
+private:
+	header_entry entries[MAX_HEADERS];
+	signed char known[HEADER_COUNT];	// 常用字段在entries中的下标，-1表示该字段没有出现
+	int count;
+};
+
+#endif  // HEADER_TABLE_H
@@ -0,0 +1,293 @@
+#ifndef CHUNK_BUFFER_H
+#define CHUNK_BUFFER_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_SIZE 4096			// 内存池中每个内存块的大小
+#define CHUNK_POOL_MAX 256		// 每个线程的内存池最多缓存的空闲块数
+
+/* 读缓冲区的一个内存块，多个内存块串成一条链 */
+struct buf_chunk
+{
+	buf_chunk* next;
+	int size;		// data的容量，内存池中的块为CHUNK_SIZE，为超长的行单独申请的块更大
+	char* data;		// 紧跟在本结构体之后的数据区
+};
+
+/* 每个线程一个的空闲内存块链表，分配和归还都不需要加锁 */
+struct chunk_pool_state
+{
+	buf_chunk* free_list;
+	int free_count;
+};
+
+/* 取得当前线程的内存池，__thread变量在线程创建时被零初始化 */
+inline chunk_pool_state& local_chunk_pool()
+{
+	static __thread chunk_pool_state pool;
+	return pool;
+}
+
+/**
+ * @brief: 申请一个内存块。CHUNK_SIZE大小的块优先从当前线程的内存池中取
+ * @param size: 数据区的容量
+ * @return: 内存块，申请失败时返回NULL
+*/
+inline buf_chunk* chunk_alloc(int size = CHUNK_SIZE)
+{
+	chunk_pool_state& pool = local_chunk_pool();
+	buf_chunk* chunk = NULL;
+	if ((size == CHUNK_SIZE) && pool.free_list)
+	{
+		chunk = pool.free_list;
+		pool.free_list = chunk->next;
+		pool.free_count--;
+	}
+	else
+	{
+		chunk = (buf_chunk*)malloc(sizeof(buf_chunk) + size);
+		if (!chunk)
+		{
+			return NULL;
+		}
+		chunk->size = size;
+		chunk->data = (char*)(chunk + 1);
+	}
+	chunk->next = NULL;
+	return chunk;
+}
+
+/**
+ * @brief: 把一条内存块链归还给当前线程的内存池，超长块和超出缓存上限的块直接释放
+ * @param chunk: 内存块链的头部
+*/
+inline void chunk_free(buf_chunk* chunk)
+{
+	chunk_pool_state& pool = local_chunk_pool();
+	while (chunk)
+	{
+		buf_chunk* next = chunk->next;
+		if ((chunk->size == CHUNK_SIZE) && (pool.free_count < CHUNK_POOL_MAX))
+		{
+			chunk->next = pool.free_list;
+			pool.free_list = chunk;
+			pool.free_count++;
+		}
+		else
+		{
+			free(chunk);
+		}
+		chunk = next;
+	}
+}
+
+/* 分段读缓冲区。
+	客户数据总是读入链表的最后一个内存块（tail），分析也只在tail中进行，下面的读写下标都是相对于tail->data的。
+	前面的内存块都已经分析完毕，但仍保存着当前请求已分析出的请求行和头部字段，直到请求被应答后才释放。
+	一行数据跨越内存块边界时，把这一行已读入的部分搬到新内存块的开头，使每一行在内存中总是连续的；
+	比CHUNK_SIZE还长的行（例如巨大的Cookie）则搬到一个单独申请的更大的块中。
+	请求体被交给回调函数后就不再需要，只含请求体的内存块会被反复复用，因此读取请求体只需要一个额外的内存块。
+	小请求只占用一个内存块，不会发生任何复制。
+*/
+class read_buffer
+{
+public:
+	read_buffer() : head(NULL), tail(NULL), bytes(0), max_bytes(CHUNK_SIZE), body_only(false) {}
+	~read_buffer() { release(); }
+
+	/**
+	 * @brief: 申请第一个内存块
+	 * @param limit: 单个请求最多占用的缓冲区字节数，至少为一个内存块
+	 * @return: 申请失败时返回false
+	*/
+	bool init(int limit)
+	{
+		max_bytes = (limit > CHUNK_SIZE) ? limit : CHUNK_SIZE;
+		head = tail = chunk_alloc();
+		bytes = head ? CHUNK_SIZE : 0;
+		body_only = false;
+		return head != NULL;
+	}
+
+	/* 把所有内存块归还给内存池 */
+	void release()
+	{
+		chunk_free(head);
+		head = tail = NULL;
+		bytes = 0;
+	}
+
+	/* 当前正在读入和分析的内存块 */
+	char* data() { return tail->data; }
+	const char* data() const { return tail->data; }
+	int capacity() const { return tail->size; }
+
+	/**
+	 * @brief: tail已满时换一个新的内存块，并把尚未读完的那一行搬过去
+	 * @param read_index: tail中客户数据尾部的下一字节
+	 * @param checked_index: tail中当前正在分析的字节
+	 * @param start_line: tail中未完成的行的起始位置
+	 * @return: 请求超过了上限时返回false
+	*/
+	bool extend(int& read_index, int& checked_index, int& start_line)
+	{
+		int partial = read_index - start_line;
+		/* 未完成的行较短时换一个普通内存块，否则申请一个至少能容纳它两倍长度的超长块 */
+		int size = CHUNK_SIZE;
+		if (partial > CHUNK_SIZE / 2)
+		{
+			size = (partial * 2 + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+		}
+		/* 整个tail都是这一行时，tail中没有其他需要保留的数据，搬走之后就可以释放 */
+		int reclaim = (start_line == 0) ? tail->size : 0;
+		if (bytes - reclaim + size > max_bytes)
+		{
+			size = max_bytes - (bytes - reclaim);	// 按剩余的额度申请
+			if (size <= partial)
+			{
+				return false;
+			}
+		}
+
+		buf_chunk* chunk = chunk_alloc(size);
+		if (!chunk)
+		{
+			return false;
+		}
+		memcpy(chunk->data, tail->data + start_line, partial);
+		if (reclaim)
+		{
+			replace_tail(chunk);
+		}
+		else
+		{
+			tail->next = chunk;
+			tail = chunk;
+		}
+		bytes += size - reclaim;
+		body_only = false;
+		read_index = partial;
+		checked_index -= start_line;
+		start_line = 0;
+		return true;
+	}
+
+	/**
+	 * @brief: 读取请求体时tail已满。tail中start_line之前的请求体都已交给回调函数，
+	 *		如果tail只含请求体就把剩余数据移到开头后直接复用，否则换一个只存放请求体的新内存块
+	 * @param read_index: tail中客户数据尾部的下一字节
+	 * @param checked_index: tail中当前正在分析的字节
+	 * @param start_line: tail中尚未交出的数据的起始位置
+	 * @return: 申请内存失败时返回false
+	*/
+	bool recycle(int& read_index, int& checked_index, int& start_line)
+	{
+		int partial = read_index - start_line;
+		if (body_only)
+		{
+			memmove(tail->data, tail->data + start_line, partial);
+		}
+		else
+		{
+			/* tail中还有当前请求的头部字段，不能覆盖。这个新块不计入请求的上限，请求体阶段最多只有这一块 */
+			buf_chunk* chunk = chunk_alloc();
+			if (!chunk)
+			{
+				return false;
+			}
+			memcpy(chunk->data, tail->data + start_line, partial);
+			tail->next = chunk;
+			tail = chunk;
+			bytes += CHUNK_SIZE;
+			body_only = true;
+		}
+		read_index = partial;
+		checked_index -= start_line;
+		start_line = 0;
+		return true;
+	}
+
+	/**
+	 * @brief: 丢弃已经应答过的数据：释放tail之前的所有内存块，并把tail中剩余的数据移到开头
+	 * @param consumed: tail中已经应答过的字节数
+	 * @param read_index: tail中客户数据尾部的下一字节
+	 * @param checked_index: tail中当前正在分析的字节
+	 * @param start_line: tail中未完成的行的起始位置
+	*/
+	void compact(int consumed, int& read_index, int& checked_index, int& start_line)
+	{
+		if (head != tail)
+		{
+			buf_chunk* old = head;
+			while (old->next != tail)
+			{
+				old = old->next;
+			}
+			old->next = NULL;
+			chunk_free(head);
+			head = tail;
+		}
+		int remain = read_index - consumed;
+		buf_chunk* chunk = NULL;
+		/* 超长块只为一个超长的请求服务，剩余数据放得进普通内存块时就把它还掉，避免长连接一直占着它 */
+		if ((tail->size != CHUNK_SIZE) && (remain <= CHUNK_SIZE) && (chunk = chunk_alloc()))
+		{
+			memcpy(chunk->data, tail->data + consumed, remain);
+			chunk_free(tail);
+			head = tail = chunk;
+		}
+		else
+		{
+			memmove(tail->data, tail->data + consumed, remain);
+		}
+		bytes = tail->size;
+		body_only = false;	// 剩余数据属于下一个请求
+		read_index -= consumed;
+		checked_index -= consumed;
+		start_line -= consumed;
+	}
+
+	/* 当前占用的内存块数 */
+	int size() const
+	{
+		int n = 0;
+		for (buf_chunk* chunk = head; chunk; chunk = chunk->next)
+		{
+			n++;
+		}
+		return n;
+	}
+
+private:
+	/* 用chunk替换掉tail，并释放原来的tail */
+	void replace_tail(buf_chunk* chunk)
+	{
+		buf_chunk* old = tail;
+		if (head == tail)
+		{
+			head = chunk;
+		}
+		else
+		{
+			buf_chunk* prev = head;
+			while (prev->next != tail)
+			{
+				prev = prev->next;
+			}
+			prev->next = chunk;
+		}
+		tail = chunk;
+		old->next = NULL;
+		chunk_free(old);
+	}
+
+private:
+	buf_chunk* head;	// 最早的内存块
+	buf_chunk* tail;	// 正在读入和分析的内存块
+	int bytes;			// 当前占用的缓冲区字节数
+	int max_bytes;		// 单个请求最多占用的缓冲区字节数
+	bool body_only;		// tail中是否只有请求体
+};
+
+#endif  // CHUNK_BUFFER_H
@@ -0,0 +1,225 @@
+#ifndef CHUNKED_DECODER_H
+#define CHUNKED_DECODER_H
+
+#define CHUNKED_MAX_SIZE_DIGITS 15		// 块大小最多的十六进制位数，保证不会溢出long long
+#define CHUNKED_MAX_LINE 4096			// 块大小行（含扩展）和每个尾部字段行的最大长度
+#define CHUNKED_MAX_TRAILER 8192		// 尾部字段的总长度上限
+
+/* 分块传输编码解码器的状态，每个状态只依赖当前这一个字节，所以可以在任意位置被recv的边界打断 */
+enum CHUNKED_STATE {
+	CHUNKED_SIZE = 0,		// 正在读取块大小的十六进制数字
+	CHUNKED_EXT,			// 正在跳过块扩展（";name=value"）或块大小之后的空白
+	CHUNKED_SIZE_LF,		// 块大小行的'\r'之后，等待'\n'
+	CHUNKED_DATA,			// 正在读取块数据
+	CHUNKED_DATA_CR,		// 块数据之后，等待'\r'
+	CHUNKED_DATA_LF,		// 块数据之后，等待'\n'
+	CHUNKED_TRAILER,		// 最后一个块之后，位于一行的开头：空行表示结束，否则是一个尾部字段
+	CHUNKED_TRAILER_LINE,	// 正在跳过一个尾部字段
+	CHUNKED_TRAILER_LF,		// 尾部字段行的'\r'之后，等待'\n'
+	CHUNKED_END_LF,			// 结束空行的'\r'之后，等待'\n'
+	CHUNKED_FINISHED		// 请求体已经完整
+};
+
+/* 解码一步的结果 */
+enum CHUNKED_RESULT {
+	CHUNKED_AGAIN = 0,		// 输入已经用完，需要更多数据
+	CHUNKED_GOT_DATA,		// 得到一段块数据
+	CHUNKED_DONE,			// 请求体结束
+	CHUNKED_ERROR			// 编码格式错误或超出限制
+};
+
+/**
+ * @brief: 十六进制数字的值，块大小和URL的百分号解码都使用它
+ * @param c: 字符
+ * @return: 0到15，不是十六进制数字时返回-1
+*/
+inline int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	c |= 0x20;	// 转成小写
+	if (c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+/* 可恢复的分块传输编码解码器。
+	解码器不复制也不申请任何内存：得到的块数据直接指向调用者的缓冲区，整个状态只有几个整数，
+	所以可以作为请求的成员随请求复用，也不受recv边界的影响
+*/
+class chunked_decoder
+{
+public:
+	chunked_decoder() { reset(); }
+
+	/* 开始解码一个新的请求体 */
+	void reset()
+	{
+		state = CHUNKED_SIZE;
+		chunk_remaining = 0;
+		digits = 0;
+		line_bytes = 0;
+		trailer_bytes = 0;
+		decoded = 0;
+	}
+
+	/**
+	 * @brief: 解码，直到得到一段块数据、输入用完、请求体结束或出错
+	 * @param data: 输入数据
+	 * @param len: 输入数据长度
+	 * @param consumed: 返回本次消耗的输入字节数，包括块数据本身
+	 * @param out: 返回CHUNKED_GOT_DATA时指向data中的块数据
+	 * @param out_len: 块数据长度
+	 * @return: CHUNKED_RESULT
+	*/
+	CHUNKED_RESULT decode(const char* data, int len, int& consumed, const char*& out, int& out_len)
+	{
+		int i = 0;
+		while (i < len)
+		{
+			if (state == CHUNKED_DATA)
+			{
+				/* 块数据不逐字节处理，一次交出输入中属于当前块的全部数据 */
+				int n = len - i;
+				if (n > chunk_remaining)
+				{
+					n = (int)chunk_remaining;
+				}
+				out = data + i;
+				out_len = n;
+				chunk_remaining -= n;
+				decoded += n;
+				if (chunk_remaining == 0)
+				{
+					state = CHUNKED_DATA_CR;
+				}
+				consumed = i + n;
+				return CHUNKED_GOT_DATA;
+			}
+
+			char c = data[i++];
+			switch (state)
+			{
+			case CHUNKED_SIZE:
+			{
+				int v = hex_value(c);
+				if (v >= 0)
+				{
+					if (++digits > CHUNKED_MAX_SIZE_DIGITS)
+					{
+						return CHUNKED_ERROR;
+					}
+					chunk_remaining = chunk_remaining * 16 + v;
+					break;
+				}
+				if (digits == 0)	// 块大小至少要有一位数字
+				{
+					return CHUNKED_ERROR;
+				}
+				if (c == '\r')
+				{
+					state = CHUNKED_SIZE_LF;
+				}
+				else if (c == ';' || c == ' ' || c == '\t')
+				{
+					state = CHUNKED_EXT;
+				}
+				else
+				{
+					return CHUNKED_ERROR;
+				}
+				break;
+			}
+			case CHUNKED_EXT:
+				if (c == '\r')
+				{
+					state = CHUNKED_SIZE_LF;
+				}
+				else if (c == '\n' || ++line_bytes > CHUNKED_MAX_LINE)
+				{
+					return CHUNKED_ERROR;
+				}
+				break;
+			case CHUNKED_SIZE_LF:
+				if (c != '\n')
+				{
+					return CHUNKED_ERROR;
+				}
+				digits = 0;
+				line_bytes = 0;
+				/* 大小为0的块是最后一个块，其后是可选的尾部字段 */
+				state = (chunk_remaining == 0) ? CHUNKED_TRAILER : CHUNKED_DATA;
+				break;
+			case CHUNKED_DATA_CR:
+				if (c != '\r')
+				{
+					return CHUNKED_ERROR;
+				}
+				state = CHUNKED_DATA_LF;
+				break;
+			case CHUNKED_DATA_LF:
+				if (c != '\n')
+				{
+					return CHUNKED_ERROR;
+				}
+				state = CHUNKED_SIZE;
+				break;
+			case CHUNKED_TRAILER:
+				if (c == '\r')
+				{
+					state = CHUNKED_END_LF;
+					break;
+				}
+				state = CHUNKED_TRAILER_LINE;
+				/* 尾部字段不被使用，跳过它，只检查长度 */
+				// fall through
+			case CHUNKED_TRAILER_LINE:
+				if (c == '\r')
+				{
+					state = CHUNKED_TRAILER_LF;
+				}
+				else if (c == '\n' || ++trailer_bytes > CHUNKED_MAX_TRAILER)
+				{
+					return CHUNKED_ERROR;
+				}
+				break;
+			case CHUNKED_TRAILER_LF:
+				if (c != '\n')
+				{
+					return CHUNKED_ERROR;
+				}
+				state = CHUNKED_TRAILER;
+				break;
+			case CHUNKED_END_LF:
+				if (c != '\n')
+				{
+					return CHUNKED_ERROR;
+				}
+				state = CHUNKED_FINISHED;
+				consumed = i;	// 之后的数据属于下一个流水线请求
+				return CHUNKED_DONE;
+			default:
+				return CHUNKED_ERROR;
+			}
+		}
+		consumed = i;
+		return CHUNKED_AGAIN;
+	}
+
+	/* 已经解码出的请求体字节数 */
+	long long total() const { return decoded; }
+
+private:
+	CHUNKED_STATE state;		// 当前状态
+	long long chunk_remaining;	// 当前块中尚未读取的字节数
+	int digits;					// 块大小已读入的位数
+	int line_bytes;				// 当前块扩展已读入的字节数
+	int trailer_bytes;			// 尾部字段已读入的总字节数
+	long long decoded;			// 已解码出的请求体总字节数
+};
+
+#endif  // CHUNKED_DECODER_H
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "8-8chunked_decoder.h"
+
+#define RECV_SIZE 4096		// 模拟每次recv读到的字节数，与读缓冲区内存块的大小一致
+
+/**
+ * @brief: 获取单调时钟的当前时间
+ * @return: 纳秒数
+*/
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief: 把payload按chunk_size大小分块编码
+ * @param payload: 原始数据
+ * @param len: 原始数据长度
+ * @param chunk_size: 每块的大小
+ * @param encoded_len: 返回编码后的长度
+ * @return: 编码后的数据，由调用者delete[]
+*/
+static char* encode(const char* payload, int len, int chunk_size, int& encoded_len)
+{
+	/* 每块最多额外占用"xxxxxxxx\r\n"和"\r\n"共12字节 */
+	int capacity = len + (len / chunk_size + 1) * 12 + 16;
+	char* out = new char[capacity];
+	int pos = 0;
+	for (int i = 0; i < len; i += chunk_size)
+	{
+		int n = (len - i < chunk_size) ? (len - i) : chunk_size;
+		pos += sprintf(out + pos, "%x\r\n", n);
+		memcpy(out + pos, payload + i, n);
+		pos += n;
+		out[pos++] = '\r';
+		out[pos++] = '\n';
+	}
+	pos += sprintf(out + pos, "0\r\n\r\n");
+	encoded_len = pos;
+	return out;
+}
+
+/**
+ * @brief: 按RECV_SIZE分片喂给解码器，像请求体回调那样累加解码出的数据
+ * @param data: 编码后的数据
+ * @param len: 编码后的长度
+ * @param checksum: 返回解码出的数据的简单校验和
+ * @return: 解码出的字节数，出错时返回-1
+*/
+static long long decode_all(const char* data, int len, unsigned int& checksum)
+{
+	chunked_decoder decoder;
+	checksum = 0;
+	for (int begin = 0; begin < len; begin += RECV_SIZE)
+	{
+		int end = (begin + RECV_SIZE < len) ? (begin + RECV_SIZE) : len;
+		int index = begin;
+		while (index < end)
+		{
+			int consumed = 0;
+			const char* out = NULL;
+			int out_len = 0;
+			CHUNKED_RESULT ret = decoder.decode(data + index, end - index, consumed, out, out_len);
+			index += consumed;
+			if (ret == CHUNKED_GOT_DATA)
+			{
+				checksum += (unsigned char)out[0] + (unsigned char)out[out_len - 1] + out_len;
+			}
+			else if (ret == CHUNKED_DONE)
+			{
+				return decoder.total();
+			}
+			else if (ret == CHUNKED_ERROR)
+			{
+				return -1;
+			}
+		}
+	}
+	return -1;
+}
+
+int main(int argc, char* argv[])
+{
+	/* 第一个参数是请求体大小（MB），默认64MB */
+	int mb = (argc > 1) ? atoi(argv[1]) : 64;
+	int len = mb * 1024 * 1024;
+	char* payload = new char[len];
+	for (int i = 0; i < len; i++)
+	{
+		payload[i] = (char)(i * 131 + 7);
+	}
+
+	static const int chunk_sizes[] = { 1, 16, 256, 4096, 65536 };
+	printf("%10s %12s %12s %12s %14s\n", "chunk", "wire MB", "payload MB/s", "wire MB/s", "ns/chunk");
+	for (unsigned int k = 0; k < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); k++)
+	{
+		int chunk_size = chunk_sizes[k];
+		/* 1字节的块会让编码后的数据膨胀到原来的6倍，缩小这种情况下的数据量 */
+		int payload_len = (chunk_size < 256) ? (len / 8) : len;
+		int encoded_len = 0;
+		char* encoded = encode(payload, payload_len, chunk_size, encoded_len);
+
+		unsigned int checksum = 0;
+		long long best = 0x7fffffffffffffffLL;
+		for (int round = 0; round < 3; round++)
+		{
+			long long start = now_ns();
+			long long decoded = decode_all(encoded, encoded_len, checksum);
+			long long cost = now_ns() - start;
+			if (decoded != payload_len)
+			{
+				printf("chunk size %d: decoded %lld bytes, expected %d\n", chunk_size, decoded, payload_len);
+				return 1;
+			}
+			if (cost < best)
+			{
+				best = cost;
+			}
+		}
+		double seconds = best / 1e9;
+		long long chunks = (payload_len + chunk_size - 1) / chunk_size;
+		printf("%10d %12.1f %12.1f %12.1f %14.1f\n", chunk_size, encoded_len / 1048576.0,
+			payload_len / 1048576.0 / seconds, encoded_len / 1048576.0 / seconds, (double)best / chunks);
+		delete[] encoded;
+	}
+
+	delete[] payload;
+	return 0;
+}